@@ -1,9 +1,15 @@
 #include "include/apu.h"
 #include "include/cpu.h"
 #include "include/util.h"
+#include "include/log.h"
+#include "include/stats.h"
+#include "include/wav.h"
 
 static void apu_half_frame_tick(apu_t *apu);
 static void apu_quarter_frame_tick(apu_t *apu);
+static void apu_frame_step(apu_t *apu);
+static void apu_run(apu_t *apu, u32 until);
+static void apu_update_channels(apu_t *apu, u32 time);
 
 const u8 LC_LENGTHS[32] = {0x0A, 0xFE, 0x14, 0x02, 0x28, 0x04, 0x50, 0x06, 0xA0, 0x08, 0x3C, 0x0A,
                            0x0E, 0x0C, 0x1A, 0x0E, 0x0C, 0x10, 0x18, 0x12, 0x30, 0x14, 0x60, 0x16,
@@ -17,19 +23,39 @@ const u8 SQUARE_SEQ[4][8] = {{0, 1, 0, 0, 0, 0, 0, 0},
 const u8 TRIANGLE_SEQ[32] = {15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
                              0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
 
-const u8 ENVELOPE_SEQ[16] = {15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0};
-
 const u16 NOISE_SEQ_LENS[16] = {4, 8, 16, 32, 64, 96, 128, 160, 202,
                                 254, 380, 508, 762, 1016, 2034, 4068};
 
-// Lookup tables
-f64 pulse_periods[2048];
-f64 triangle_periods[2048];
-f64 noise_periods[16];
-
-u32 env_periods[16];
-f64 pulse_volume_table[31];
-f64 tnd_volume_table[203];
+// Mixer lookup tables, an approximation of the NES DAC from http://nesdev.com/apu_ref.txt, scaled to INT16_MAX
+// and rounded. Indexed by pulse1 + pulse2:
+//   PULSE_MIX[i] = 95.52 / (8128 / i + 100)
+const i16 PULSE_MIX[31] = {
+    0, 380, 752, 1114, 1468, 1814, 2152, 2482, 2805, 3120, 3429, 3731,
+    4026, 4316, 4599, 4876, 5148, 5414, 5675, 5930, 6181, 6426, 6667, 6903,
+    7135, 7362, 7586, 7805, 8020, 8231, 8438
+};
+
+// Indexed by 3 * triangle + 2 * noise + dmc:
+//   TND_MIX[i] = 163.67 / (24329 / i + 100)
+const i16 TND_MIX[203] = {
+    0, 220, 437, 653, 867, 1080, 1291, 1500, 1707, 1913, 2117, 2320,
+    2521, 2720, 2918, 3115, 3309, 3503, 3694, 3885, 4074, 4261, 4447, 4632,
+    4815, 4997, 5178, 5357, 5535, 5712, 5887, 6061, 6234, 6406, 6576, 6745,
+    6913, 7079, 7245, 7409, 7572, 7734, 7895, 8055, 8214, 8371, 8528, 8683,
+    8837, 8991, 9143, 9294, 9444, 9593, 9741, 9888, 10035, 10180, 10324, 10467,
+    10610, 10751, 10891, 11031, 11170, 11307, 11444, 11580, 11715, 11849, 11983, 12115,
+    12247, 12378, 12508, 12637, 12765, 12893, 13020, 13146, 13271, 13395, 13519, 13642,
+    13764, 13886, 14006, 14126, 14246, 14364, 14482, 14599, 14715, 14831, 14946, 15061,
+    15174, 15287, 15400, 15511, 15622, 15733, 15842, 15952, 16060, 16168, 16275, 16382,
+    16488, 16593, 16698, 16802, 16906, 17009, 17112, 17213, 17315, 17416, 17516, 17616,
+    17715, 17813, 17911, 18009, 18106, 18202, 18298, 18394, 18489, 18583, 18677, 18770,
+    18863, 18955, 19047, 19139, 19230, 19320, 19410, 19500, 19589, 19677, 19765, 19853,
+    19940, 20027, 20113, 20199, 20285, 20370, 20454, 20538, 20622, 20705, 20788, 20871,
+    20953, 21034, 21116, 21196, 21277, 21357, 21437, 21516, 21595, 21673, 21751, 21829,
+    21906, 21983, 22060, 22136, 22212, 22287, 22362, 22437, 22511, 22586, 22659, 22733,
+    22806, 22878, 22950, 23022, 23094, 23165, 23236, 23307, 23377, 23447, 23517, 23586,
+    23655, 23724, 23792, 23860, 23928, 23996, 24063, 24130, 24196, 24262, 24328
+};
 
 u8 apu_read(nes_t *nes, u16 addr) {
   apu_t *apu = nes->apu;
@@ -46,8 +72,19 @@ u8 apu_read(nes_t *nes, u16 addr) {
   }
 }
 
-void apu_write(nes_t *nes, u16 addr, u8 val) {
-  apu_t *apu = nes->apu;
+// Appends a record to the frame's log if there's an audio thread to replay it
+static void apu_log(apu_t *apu, u16 addr, u8 val) {
+  if (!apu->synth)
+    return;
+
+  apu_log_t *log = apu->log_cur;
+  log->recs[log->n++] = (apu_log_rec_t) {.time = apu->time, .addr = addr, .val = val};
+}
+
+// Applies a register write at apu->time. Returns false if addr isn't a writable APU register
+static bool apu_write_reg(apu_t *apu, u16 addr, u8 val) {
+  // Render the channels up to now before their state changes
+  apu_run(apu, apu->time);
 
   // TODO: Side effects
   switch (addr) {
@@ -83,11 +120,9 @@ void apu_write(nes_t *nes, u16 addr, u8 val) {
       if (apu->status.pulse1_enable)
         apu->pulse1.lc = LC_LENGTHS[apu->pulse1.lc_idx];
 
-      // Restart sequence but not divider (seq_c)
+      // Restart sequence but not divider (timer_next)
 //      apu->pulse1.seq_idx = 0;
-//      apu->pulse1.seq_c = 0;
-      apu->pulse1.env.env_seq_i = 0;
-      apu->pulse1.env.env_c = 0;
+      apu->pulse1.env.start = true;
       break;
     case 0x4004:
       // Pulse 2 volume parameters: DDLC NNNN
@@ -120,11 +155,9 @@ void apu_write(nes_t *nes, u16 addr, u8 val) {
       if (apu->status.pulse2_enable)
         apu->pulse2.lc = LC_LENGTHS[apu->pulse2.lc_idx];
 
-      // Restart sequence but not divider (seq_c)
+      // Restart sequence but not divider (timer_next)
 //      apu->pulse2.seq_idx = 0;
-//      apu->pulse2.seq_c = 0;
-      apu->pulse2.env.env_seq_i = 0;
-      apu->pulse2.env.env_c = 0;
+      apu->pulse2.env.start = true;
       break;
     case 0x4008:
       // Triangle linear counter control/lc halt and linear counter reload value
@@ -166,8 +199,7 @@ void apu_write(nes_t *nes, u16 addr, u8 val) {
       apu->noise.lc_idx = val >> 3;
       if (apu->status.noise_enable)
         apu->noise.lc = LC_LENGTHS[apu->noise.lc_idx];
-      apu->noise.env.env_seq_i = 0;
-      apu->noise.env.env_c = 0;
+      apu->noise.env.start = true;
       break;
     case 0x4010:
       // DMC control flags
@@ -219,35 +251,44 @@ void apu_write(nes_t *nes, u16 addr, u8 val) {
       apu->frame_counter.divider = 0;
       break;
     default:
-      printf("apu_write: invalid write to $%04X\n", addr);
-      break;
+      return false;
   }
-}
-
-// Mixes raw channel output into a signed 16-bit sample
-static i16 apu_mix_audio(u8 pulse1_out, u8 pulse2_out, u8 triangle_out, u8 noise_out, u8 dmc_out) {
-  f64 square_out = pulse_volume_table[pulse1_out + pulse2_out];
-  f64 tnd_out = tnd_volume_table[3 * triangle_out + 2 * noise_out + dmc_out];
 
-  return (i16) ((square_out + tnd_out) * INT16_MAX);
+  apu_update_channels(apu, apu->time);
+  return true;
 }
 
-// Increment APU waveform period counter with proper wrap around
-// Pulse channel sequence length is 8, triangle is 32; noise *frequency* is from a 16-entry lookup table
-static void apu_clock_sequence_counter(f64 *seq_c, u8 *seq_idx, u32 seq_len, f64 smp_per_sec) {
-  *seq_c += 1.;
+void apu_write(nes_t *nes, u16 addr, u8 val) {
+  apu_t *apu = nes->apu;
 
-  if (*seq_c >= smp_per_sec) {
-    *seq_c -= smp_per_sec;
-    *seq_idx = (*seq_idx + 1) % seq_len;
+  if (!apu_write_reg(apu, addr, val)) {
+    log_msg(LOG_WARN, LOG_CAT_APU, "apu_write: invalid write to $%04X", addr);
+    return;
   }
+  apu_log(apu, addr, val);
 }
 
-static void apu_clock_envelope(envelope_t *env) {
-  const u32 ENV_PERIOD = env_periods[env->env_seq_i];
+// Mixes raw channel output into a signed 16-bit sample
+static i16 apu_mix_audio(u8 pulse1_out, u8 pulse2_out, u8 triangle_out, u8 noise_out, u8 dmc_out) {
+  return PULSE_MIX[pulse1_out + pulse2_out] + TND_MIX[3 * triangle_out + 2 * noise_out + dmc_out];
+}
 
-  env->env_volume = ENVELOPE_SEQ[env->env_seq_i];
-  apu_clock_sequence_counter(&env->env_c, &env->env_seq_i, 16, ENV_PERIOD);
+// Clocked every quarter frame. The divider counts down from n, and each time it expires the decay level drops by one
+// (and wraps back to 15 if looping)
+static void apu_clock_envelope(envelope_t *env) {
+  if (env->start) {
+    env->start = false;
+    env->decay = 15;
+    env->divider = env->n;
+  } else if (env->divider == 0) {
+    env->divider = env->n;
+    if (env->decay > 0)
+      env->decay--;
+    else if (env->loop)
+      env->decay = 15;
+  } else {
+    env->divider--;
+  }
 }
 
 // Clock an APU su unit, updating a period `target_pd` with its output
@@ -284,67 +325,351 @@ static void apu_clock_sweep_unit(sweep_unit_t *su, u16 *target_pd, i32 (*negate_
 static u8 apu_get_envelope_volume(envelope_t *env) {
   // If the envelope disable flag is set, the volume is the envelope's n value
   // Else, return the envelope's current volume
-  return env->disable ? env->n : env->env_volume;
-}
-
-static void apu_render_audio(apu_t *apu) {
-  const u32 BYTES_PER_SAMPLE = apu->audio_spec.channels * sizeof(i16);
-
-  const f64 PULSE1_SMP_PER_SEQ = pulse_periods[apu->pulse1.timer];
-  const f64 PULSE2_SMP_PER_SEQ = pulse_periods[apu->pulse2.timer];
-  const f64 TRIANGLE_SMP_PER_SEQ = triangle_periods[apu->triangle.timer];
-  const f64 NOISE_SMP_PER_SEQ = noise_periods[apu->noise.period];
-
-  u8 pulse1_out = 0, pulse2_out = 0, triangle_out = 0, noise_out = 0, dmc_out = 0;
-  // printf("apu_render_audio: bufsz=%d p1 seq_c=%.2f, p2 seq_c=%.2f, t seq_c=%.2f, n seq_c=%.2f\n",
-  //        SDL_GetQueuedAudioSize(apu->device_id), apu->pulse1.seq_c, apu->pulse2.seq_c, apu->triangle.seq_c,
-  //        apu->noise.seq_c);
-  // TODO: Adjust the audio buffer scaling factor dynamically when a buffer underrun is detected
-  while (SDL_GetQueuedAudioSize(apu->device_id) < apu->audio_spec.freq / apu->buf_scale_factor) {
-    // **** Pulse 1 synth ****
-    if (apu->status.pulse1_enable && apu->pulse1.lc > 0 && apu->pulse1.timer > 7) {
-      pulse1_out = SQUARE_SEQ[apu->pulse1.duty][apu->pulse1.seq_idx] * apu_get_envelope_volume(&apu->pulse1.env);
-      apu_clock_sequence_counter(&apu->pulse1.seq_c, &apu->pulse1.seq_idx, 8, PULSE1_SMP_PER_SEQ);
-    }
+  return env->disable ? env->n : env->decay;
+}
 
-    // **** Pulse 2 synth ****
-    if (apu->status.pulse2_enable && apu->pulse2.lc > 0 && apu->pulse2.timer > 7) {
-      pulse2_out = SQUARE_SEQ[apu->pulse2.duty][apu->pulse2.seq_idx] * apu_get_envelope_volume(&apu->pulse2.env);
-      apu_clock_sequence_counter(&apu->pulse2.seq_c, &apu->pulse2.seq_idx, 8, PULSE2_SMP_PER_SEQ);
-    }
+// SDL audio callback, runs on SDL's audio thread. Pulls samples from the ring and never blocks
+static void apu_audio_callback(void *userdata, u8 *stream, int len) {
+  apu_t *apu = userdata;
+  i16 *out = (i16 *) stream;
+  u32 n = len / sizeof *out;
 
-    // **** Triangle synth ****
-//    printf("pd=%.2f timer=%d, seq_c=%.2f seq_idx=%d\n", TRIANGLE_SMP_PER_SEQ, apu->triangle.timer, apu->triangle.seq_c, apu->triangle.seq_idx);
-    if (apu->status.triangle_enable && apu->triangle.lc > 0 && apu->triangle.linc > 0) {
-      triangle_out = TRIANGLE_SEQ[apu->triangle.seq_idx];
+  u32 got = ring_read(&apu->smp_ring, out, n);
 
-      // Fix popping in Mega Man 2
-      if (apu->triangle.timer < 3) {
-        apu->triangle.seq_c = 0.;
-      } else {
-        apu_clock_sequence_counter(&apu->triangle.seq_c, &apu->triangle.seq_idx, 32, TRIANGLE_SMP_PER_SEQ);
-      }
+  // Hold the last sample on underrun instead of dropping to silence
+  i16 hold = got ? out[got - 1] : apu->cb_last_sample;
+  for (u32 i = got; i < n; i++)
+    out[i] = hold;
+  apu->cb_last_sample = hold;
+
+  SDL_SemPost(apu->drained);
+}
+
+// CPU cycles between sequencer clocks for each channel
+static u32 apu_pulse_period(pulse_t *pulse) {
+  return 2 * (pulse->timer + 1);
+}
+
+static u32 apu_triangle_period(apu_t *apu) {
+  return apu->triangle.timer + 1;
+}
+
+static u32 apu_noise_period(apu_t *apu) {
+  return NOISE_SEQ_LENS[apu->noise.period];
+}
+
+// A channel's timer only runs while the channel can make sound. Stopped channels generate no edges, and their timers
+// restart when they become audible again
+static bool apu_pulse_active(pulse_t *pulse, u8 enable) {
+  return enable && pulse->lc > 0 && pulse->timer > 7;
+}
+
+static bool apu_triangle_active(apu_t *apu) {
+  // Periods below 3 are ultrasonic, the sequencer is held instead (fixes popping in Mega Man 2)
+  return apu->status.triangle_enable && apu->triangle.lc > 0 && apu->triangle.linc > 0 && apu->triangle.timer >= 3;
+}
+
+static bool apu_noise_active(apu_t *apu) {
+  return apu->status.noise_enable && apu->noise.lc > 0;
+}
+
+static u8 apu_pulse_output(pulse_t *pulse, u8 enable) {
+  if (!apu_pulse_active(pulse, enable))
+    return 0;
+  return SQUARE_SEQ[pulse->duty][pulse->seq_idx] * apu_get_envelope_volume(&pulse->env);
+}
+
+static u8 apu_triangle_output(apu_t *apu) {
+  // The triangle holds its level when the sequencer stops, instead of dropping to zero
+  return apu->status.triangle_enable ? TRIANGLE_SEQ[apu->triangle.seq_idx] : 0;
+}
+
+static u8 apu_noise_output(apu_t *apu) {
+  if (!apu_noise_active(apu))
+    return 0;
+  return !(apu->noise.shift_reg & 1) * apu_get_envelope_volume(&apu->noise.env);
+}
+
+// Recomputes the mixer output and records any change in the blip buffer
+static void apu_update_mix(apu_t *apu, u32 time) {
+  i32 level = apu_mix_audio(apu->pulse1.out, apu->pulse2.out, apu->triangle.out, apu->noise.out, 64);
+
+  if (level != apu->mix_level) {
+    blip_add_delta(&apu->blip, time, level - apu->mix_level);
+    apu->mix_level = level;
+  }
+}
+
+// Starts or stops a channel timer when the channel's active state changes
+static void apu_update_timer(u32 *timer_next, bool active, u32 time, u32 period) {
+  if (!active)
+    *timer_next = APU_TIMER_STOPPED;
+  else if (*timer_next == APU_TIMER_STOPPED)
+    *timer_next = time + period;
+}
+
+// Picks up channel state changes made by register writes and frame counter ticks
+static void apu_update_channels(apu_t *apu, u32 time) {
+  if (!apu->audio)
+    return;
+
+  apu_update_timer(&apu->pulse1.timer_next, apu_pulse_active(&apu->pulse1, apu->status.pulse1_enable), time,
+                   apu_pulse_period(&apu->pulse1));
+  apu_update_timer(&apu->pulse2.timer_next, apu_pulse_active(&apu->pulse2, apu->status.pulse2_enable), time,
+                   apu_pulse_period(&apu->pulse2));
+  apu_update_timer(&apu->triangle.timer_next, apu_triangle_active(apu), time, apu_triangle_period(apu));
+  apu_update_timer(&apu->noise.timer_next, apu_noise_active(apu), time, apu_noise_period(apu));
+
+  apu->pulse1.out = apu_pulse_output(&apu->pulse1, apu->status.pulse1_enable);
+  apu->pulse2.out = apu_pulse_output(&apu->pulse2, apu->status.pulse2_enable);
+  apu->triangle.out = apu_triangle_output(apu);
+  apu->noise.out = apu_noise_output(apu);
+  apu_update_mix(apu, time);
+}
+
+// Clocks the channel timers up to and including CPU cycle `until`. Timer expirations from all channels are merged
+// in time order, since the mixer is nonlinear and each edge's delta depends on the other channels' levels
+static void apu_run(apu_t *apu, u32 until) {
+  if (!apu->audio)
+    return;
+
+  for (;;) {
+    u32 t = MIN(MIN(apu->pulse1.timer_next, apu->pulse2.timer_next),
+                MIN(apu->triangle.timer_next, apu->noise.timer_next));
+    if (t > until)
+      break;
+
+    if (apu->pulse1.timer_next == t) {
+      apu->pulse1.seq_idx = (apu->pulse1.seq_idx + 1) & 7;
+      apu->pulse1.timer_next += apu_pulse_period(&apu->pulse1);
+      apu->pulse1.out = apu_pulse_output(&apu->pulse1, apu->status.pulse1_enable);
+    }
+    if (apu->pulse2.timer_next == t) {
+      apu->pulse2.seq_idx = (apu->pulse2.seq_idx + 1) & 7;
+      apu->pulse2.timer_next += apu_pulse_period(&apu->pulse2);
+      apu->pulse2.out = apu_pulse_output(&apu->pulse2, apu->status.pulse2_enable);
+    }
+    if (apu->triangle.timer_next == t) {
+      apu->triangle.seq_idx = (apu->triangle.seq_idx + 1) & 31;
+      apu->triangle.timer_next += apu_triangle_period(apu);
+      apu->triangle.out = apu_triangle_output(apu);
+    }
+    if (apu->noise.timer_next == t) {
+      // Shift noise shift register
+      const u8 FEEDBACK_BIT_NUM = apu->noise.mode ? 6 : 1;
+      u8 feedback_bit = (apu->noise.shift_reg & 1) ^ GET_BIT(apu->noise.shift_reg, FEEDBACK_BIT_NUM);
+      apu->noise.shift_reg >>= 1;
+      apu->noise.shift_reg |= feedback_bit << 14;
+
+      apu->noise.timer_next += apu_noise_period(apu);
+      apu->noise.out = apu_noise_output(apu);
     }
 
-    // **** Noise synth ****
-    if (apu->status.noise_enable && apu->noise.lc > 0) {
-      noise_out = !(apu->noise.shift_reg & 1) * apu_get_envelope_volume(&apu->noise.env);
-      apu->noise.seq_c += 1.;
-      if (apu->noise.seq_c >= NOISE_SMP_PER_SEQ) {
-        apu->noise.seq_c = 0;
-
-        // Shift noise shift register
-        const u8 FEEDBACK_BIT_NUM = apu->noise.mode ? 6 : 1;
-        u8 feedback_bit = (apu->noise.shift_reg & 1) ^ GET_BIT(apu->noise.shift_reg, FEEDBACK_BIT_NUM);
-        apu->noise.shift_reg >>= 1;
-        apu->noise.shift_reg |= feedback_bit << 14;
-      }
+    apu_update_mix(apu, t);
+  }
+}
+
+// Moves a running timer back by one frame's worth of cycles
+static void apu_rebase_timer(u32 *timer_next, u32 time) {
+  if (*timer_next != APU_TIMER_STOPPED)
+    *timer_next -= time;
+}
+
+// Starts a new drift measurement
+static void apu_reset_drift(apu_t *apu) {
+  apu->drift_t0 = SDL_GetPerformanceCounter();
+  apu->drift_cycles = 0;
+  apu->drift_frames = 0;
+  apu->fill_sum = 0;
+}
+
+// Compares the CPU cycles emulated since the last measurement against the host time that passed and corrects the
+// output rate. Running fast means the device wants more samples per frame than it's getting, so the rate goes up.
+// Each measurement ends on a callback boundary and is off by up to a callback's worth of time, so only a quarter of
+// the measured drift is corrected at a time
+static void apu_correct_drift(apu_t *apu) {
+  i64 elapsed = (i64) (SDL_GetPerformanceCounter() - apu->drift_t0);
+  i64 expected = (i64) ((double) apu->drift_cycles * SDL_GetPerformanceFrequency() / NTSC_CPU_SPEED / apu->speed);
+  apu->drift_ppm = (i32) ((expected - elapsed) * 1000000 / MAX(elapsed, 1));
+
+  i64 rate = apu->audio_spec.freq + apu->rate_adj;
+  i64 adj = apu->rate_adj + rate * apu->drift_ppm / (4 * 1000000);
+  i64 max_adj = apu->audio_spec.freq / APU_RATE_ADJ_DIV;
+  i64 lo = apu->speed_adj - max_adj, hi = apu->speed_adj + max_adj;
+  apu->rate_adj = (i32) (adj > hi ? hi : adj < lo ? lo : adj);
+  SDL_AtomicSet(&apu->out_rate, apu->audio_spec.freq + apu->rate_adj);
+
+  log_msg(LOG_DEBUG, LOG_CAT_APU, "apu_correct_drift: drift=%dppm rate=%dHz latency=%.1fms", apu->drift_ppm,
+          apu->audio_spec.freq + apu->rate_adj, 1000. * apu->fill_sum / apu->drift_frames / apu->audio_spec.freq);
+  apu_reset_drift(apu);
+}
+
+// Replays a frame's log through the audio thread's channels and synthesizes its samples. Runs on the audio thread
+static void apu_synth_frame(nes_t *nes, apu_log_t *log) {
+  apu_t *apu = nes->apu;
+  apu_t *synth = apu->synth;
+
+  for (u32 i = 0; i < log->n; i++) {
+    apu_log_rec_t *rec = &log->recs[i];
+    synth->time = rec->time;
+    if (rec->addr == APU_LOG_FRAME_STEP)
+      apu_frame_step(synth);
+    else
+      apu_write_reg(synth, rec->addr, rec->val);
+  }
+
+  synth->time = log->time;
+  apu_run(synth, synth->time);
+  blip_end_frame(&synth->blip, synth->time);
+  apu_rebase_timer(&synth->pulse1.timer_next, synth->time);
+  apu_rebase_timer(&synth->pulse2.timer_next, synth->time);
+  apu_rebase_timer(&synth->triangle.timer_next, synth->time);
+  apu_rebase_timer(&synth->noise.timer_next, synth->time);
+  synth->time = 0;
+
+  u32 n_raw = blip_read_samples(&synth->blip, synth->raw_buf, blip_samples_avail(&synth->blip));
+  log->n_samples = n_raw;
+
+  // Captured audio goes through its own resampler at a fixed ratio, so it only depends on what was emulated
+  if (nes->audio_out) {
+    u32 n_cap = resample_process(&synth->cap_rs, synth->raw_buf, n_raw, synth->cap_buf, synth->cap_buf_len);
+    wav_write(nes->audio_out, synth->cap_buf, n_cap);
+  }
+
+  if (!synth->device)
+    return;
+
+  u32 rate = SDL_AtomicGet(&apu->out_rate);
+  if (rate != synth->rs_rate) {
+    resample_set_ratio(&synth->rs, NTSC_CPU_SPEED, (u64) APU_SAMPLE_DIV * rate);
+    synth->rs_rate = rate;
+  }
+
+  u32 n_samples = resample_process(&synth->rs, synth->raw_buf, n_raw, synth->smp_buf, synth->smp_buf_len);
+  ring_write(&apu->smp_ring, synth->smp_buf, n_samples);
+}
+
+static int apu_synth_thread(void *data) {
+  nes_t *nes = data;
+  apu_t *apu = nes->apu;
+
+  for (u32 tail = 0;; tail++) {
+    SDL_SemWait(apu->log_ready);
+
+    // apu_destroy() posts once more without handing off a frame
+    if (tail == (u32) SDL_AtomicGet(&apu->log_head))
+      break;
+
+    apu_synth_frame(nes, &apu->log[tail % APU_LOG_SLOTS]);
+    SDL_SemPost(apu->log_free);
+  }
+  return 0;
+}
+
+void apu_end_frame(nes_t *nes) {
+  apu_t *apu = nes->apu;
+
+  if (!apu->synth) {
+    apu->time = 0;
+    return;
+  }
+
+  // Hand the frame to the audio thread and start logging the next one in a free slot
+  apu->log_cur->time = apu->time;
+  u32 head = SDL_AtomicAdd(&apu->log_head, 1) + 1;
+  SDL_SemPost(apu->log_ready);
+  apu->drift_cycles += apu->time;
+  apu->time = 0;
+
+  SDL_SemWait(apu->log_free);
+  apu->log_cur = &apu->log[head % APU_LOG_SLOTS];
+  apu->log_cur->n = 0;
+
+  // Slots are freed in order, so this one's frame has been synthesized. Its samples are counted here since the
+  // counters aren't shared between threads
+  STAT_ADD(apu_samples, apu->log_cur->n_samples);
+  apu->log_cur->n_samples = 0;
+
+  if (!apu->device)
+    return;
+
+  // If the audio callback ran dry since the last frame, our latency target is too low for this machine
+  u32 underruns = SDL_AtomicGet(&apu->smp_ring.underruns);
+  if (underruns != apu->last_underruns) {
+    apu->last_underruns = underruns;
+    if (apu->smp_target < apu->smp_target_max) {
+      apu->smp_target = MIN(apu->smp_target + apu->audio_spec.samples, apu->smp_target_max);
+      log_msg(LOG_DEBUG, LOG_CAT_APU, "apu_end_frame: underrun, raising latency target to %u samples",
+              apu->smp_target);
     }
+  }
+
+  u32 fill = ring_fill(&apu->smp_ring);
+  if (apu->audio_started) {
+    apu->fill_sum += fill;
+    if (++apu->drift_frames == APU_DRIFT_FRAMES)
+      apu_correct_drift(apu);
+  } else if (fill >= apu->smp_target) {
+    // Don't start pulling samples until the latency target has been buffered, so startup doesn't count as underruns
+    SDL_PauseAudioDevice(apu->device_id, 0);
+    apu->audio_started = true;
+    apu_reset_drift(apu);
+  }
+}
+
+void apu_sync(nes_t *nes) {
+  apu_t *apu = nes->apu;
+  if (!apu->synth)
+    return;
+
+  // Once every free slot has been taken, the audio thread is done with all the frames it was handed
+  for (int i = 0; i < APU_LOG_SLOTS - 1; i++)
+    SDL_SemWait(apu->log_free);
+  for (int i = 0; i < APU_LOG_SLOTS; i++) {
+    STAT_ADD(apu_samples, apu->log[i].n_samples);
+    apu->log[i].n_samples = 0;
+  }
+  for (int i = 0; i < APU_LOG_SLOTS - 1; i++)
+    SDL_SemPost(apu->log_free);
+}
 
-    // Mix channels together to get the final sample
-    i16 final_sample = apu_mix_audio(pulse1_out, pulse2_out, triangle_out, noise_out, 64);
-    SDL_QueueAudio(apu->device_id, &final_sample, BYTES_PER_SAMPLE);
+bool apu_wait(nes_t *nes) {
+  apu_t *apu = nes->apu;
+  if (!apu->audio_started)
+    return false;
+
+  // The callback pulls a buffer every audio_spec.samples samples. If a few of those go by without one, the device
+  // has stalled and waiting any longer would just freeze the emulator
+  u32 timeout_ms = 4 * 1000 * apu->audio_spec.samples / apu->audio_spec.freq + 1;
+  while (ring_fill(&apu->smp_ring) > apu->smp_target) {
+    if (SDL_SemWaitTimeout(apu->drained, timeout_ms) == SDL_MUTEX_TIMEDOUT) {
+      log_msg(LOG_WARN, LOG_CAT_APU, "apu_wait: audio device stopped pulling samples");
+      return false;
+    }
   }
+  return true;
+}
+
+void apu_set_speed(nes_t *nes, double speed) {
+  apu_t *apu = nes->apu;
+  if (!apu->device || speed == apu->speed)
+    return;
+
+  // Running at speed takes 1 / speed times the samples per second. Start the output rate there rather than waiting
+  // for the drift correction to get to it
+  i32 speed_adj = (i32) (apu->audio_spec.freq / speed) - apu->audio_spec.freq;
+  apu->rate_adj += speed_adj - apu->speed_adj;
+  apu->speed_adj = speed_adj;
+  apu->speed = speed;
+  SDL_AtomicSet(&apu->out_rate, apu->audio_spec.freq + apu->rate_adj);
+  apu_reset_drift(apu);
+}
+
+double apu_buffered_ms(nes_t *nes) {
+  apu_t *apu = nes->apu;
+  if (!apu->device)
+    return -1;
+  return 1000. * ring_fill(&apu->smp_ring) / apu->audio_spec.freq;
 }
 
 static void apu_quarter_frame_tick(apu_t *apu) {
@@ -382,114 +707,203 @@ static void apu_half_frame_tick(apu_t *apu) {
   apu_clock_sweep_unit(&apu->pulse2.sweep, &apu->pulse2.timer, twos_complement);
 }
 
-// Increment APU frame counter.
-void apu_tick(nes_t *nes) {
-  apu_t *apu = nes->apu;
-
-  const u32 TICKS_PER_FRAME_SEQ = (int) (NTSC_CPU_SPEED / 240);  // 240 APU ticks per second
-  if (apu->frame_counter.divider == TICKS_PER_FRAME_SEQ) {
-    apu->frame_counter.divider = 0;
+// Clocks the frame counter sequencer one step
+static void apu_frame_step(apu_t *apu) {
+  apu_run(apu, apu->time);
+
+  const u8 STEPS_IN_SEQ = apu->frame_counter.seq_mode ? 5 : 4;
+  if (STEPS_IN_SEQ == 4) {
+    // *********** 4-step sequence mode ***********
+    // Sequence = [0, 1, 2, 3, 0, 1, 2, 3, ...]
+    // Trigger CPU frame IRQ
+    if (apu->frame_counter.step == 3 && !apu->frame_counter.irq_disable) {
+      apu->frame_interrupt = true;
+    }
 
-    const u8 STEPS_IN_SEQ = apu->frame_counter.seq_mode ? 5 : 4;
-    if (STEPS_IN_SEQ == 4) {
-      // *********** 4-step sequence mode ***********
-      // Sequence = [0, 1, 2, 3, 0, 1, 2, 3, ...]
-      // Trigger CPU frame IRQ
-      if (apu->frame_counter.step == 3 && !apu->frame_counter.irq_disable) {
-        apu->frame_interrupt = true;
-      }
+    // Trigger half-frame ticks on every odd sequence step
+    if (apu->frame_counter.step & 1)
+      apu_half_frame_tick(apu);
 
-      // Trigger half-frame ticks on every odd sequence step
-      if (apu->frame_counter.step & 1)
+    apu_quarter_frame_tick(apu);
+  } else {
+    // *********** 5-step sequence mode ***********
+    // Sequence = [0, 1, 2, 3, 4, 0, 1, 2, 3, 4, ...]
+    if (apu->frame_counter.step != 4) {
+      // Trigger half-frame ticks on every even sequence step
+      if (apu->frame_counter.step % 2 == 0)
         apu_half_frame_tick(apu);
 
       apu_quarter_frame_tick(apu);
-      apu_render_audio(apu);
-    } else {
-      // *********** 5-step sequence mode ***********
-      // Sequence = [0, 1, 2, 3, 4, 0, 1, 2, 3, 4, ...]
-      if (apu->frame_counter.step != 4) {
-        // Trigger half-frame ticks on every even sequence step
-        if (apu->frame_counter.step % 2 == 0)
-          apu_half_frame_tick(apu);
-
-        apu_quarter_frame_tick(apu);
-        apu_render_audio(apu);
-      }
     }
+  }
+  apu_update_channels(apu, apu->time);
 
-    // Increment current sequence
-    if (apu->frame_counter.step == STEPS_IN_SEQ - 1)
-      apu->frame_counter.step = 0;
-    else
-      apu->frame_counter.step++;
+  // Increment current sequence
+  if (apu->frame_counter.step == STEPS_IN_SEQ - 1)
+    apu->frame_counter.step = 0;
+  else
+    apu->frame_counter.step++;
+}
+
+// Increment APU frame counter.
+void apu_tick(nes_t *nes) {
+  apu_t *apu = nes->apu;
+
+  // apu_tick() runs every other CPU cycle
+  apu->time += 2;
+
+  const u32 TICKS_PER_FRAME_SEQ = (int) (NTSC_CPU_SPEED / 240);  // 240 APU ticks per second
+  if (apu->frame_counter.divider == TICKS_PER_FRAME_SEQ) {
+    apu->frame_counter.divider = 0;
+    apu_frame_step(apu);
+    apu_log(apu, APU_LOG_FRAME_STEP, 0);
   } else {
     apu->frame_counter.divider++;
   }
 
   apu->ticks++;
+
+  // Frames are normally ended by the video side, this only keeps the blip buffer from overflowing if they aren't
+  if (apu->time >= APU_MAX_FRAME_CYCLES)
+    apu_end_frame(nes);
 }
 
-static void apu_init_lookup_tables(apu_t *apu) {
-  // *************** APU mixer lookup tables ***************
-  // Approximation of NES DAC mixer from http://nesdev.com/apu_ref.txt
-  // **** Pulse channels ****
-  f64 smp_rate_d = (f64) apu->audio_spec.freq;
+// Power up state of the channels and frame counter
+static void apu_reset(apu_t *apu) {
+  // Initialize all APU state to zero
+  memset(apu, 0, sizeof *apu);
 
-  for (int i = 0; i < 31; i++)
-    pulse_volume_table[i] = 95.52 / (8128. / i + 100);
+  apu->noise.shift_reg = 1;
+  apu->pulse1.timer_next = APU_TIMER_STOPPED;
+  apu->pulse2.timer_next = APU_TIMER_STOPPED;
+  apu->triangle.timer_next = APU_TIMER_STOPPED;
+  apu->noise.timer_next = APU_TIMER_STOPPED;
+}
 
-  // **** Triangle, noise, and DMC channels ****
-  for (int i = 0; i < 203; i++)
-    tnd_volume_table[i] = 163.67 / (24329. / i + 100);
+void apu_init(nes_t *nes, bool audio, u32 sample_rate, u32 buf_len, u32 latency_ms) {
+  apu_t *apu = nes->apu;
+  apu_reset(apu);
+
+  // Channels are synthesized if anyone is listening: the audio device, a capture file or both
+  apu->device = audio;
+  apu->speed = 1;
+  apu->speed_adj = 0;
+  if (!audio && !nes->audio_out)
+    return;
+
+  // The blip buffer has to hold the longest frame at the internal rate. Its rate is exactly one sample every
+  // APU_SAMPLE_DIV cycles
+  u32 max_raw_samples = APU_MAX_FRAME_CYCLES / APU_SAMPLE_DIV + 2;
+  u32 max_frame_samples = 0;
+
+  if (apu->device) {
+    // Request audio spec. Init code based on
+    // https://stackoverflow.com/questions/10110905/simple-sound-wave-generator-with-sdl-in-c
+    SDL_AudioSpec want;
+    want.freq = (i32) sample_rate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.callback = apu_audio_callback;
+    want.userdata = apu;
+    want.samples = buf_len;
+
+    if ((apu->drained = SDL_CreateSemaphore(0)) == NULL)
+      crash_and_burn("apu_init: SDL_CreateSemaphore failed: %s\n", SDL_GetError());
+    if ((apu->device_id = SDL_OpenAudioDevice(NULL, 0, &want, &apu->audio_spec, 0)) == 0)
+      crash_and_burn("apu_init: could not open audio device: %s\n", SDL_GetError());
+
+    // Resampled output for the longest frame plus the input the resampler held back, with some headroom for the
+    // rate adjustment
+    max_frame_samples =
+        (u64) (max_raw_samples + RS_TAPS) * APU_SAMPLE_DIV * apu->audio_spec.freq * 101 / 100 / NTSC_CPU_SPEED + 1;
+    SDL_AtomicSet(&apu->out_rate, apu->audio_spec.freq);
+
+    // The ring has to hold the largest latency target plus a frame's worth of samples. Sound starts once the latency
+    // target has been buffered
+    apu->smp_target = MAX(apu->audio_spec.freq * latency_ms / 1000, apu->audio_spec.samples);
+    apu->smp_target_max = 4 * apu->smp_target;
+    ring_init(&apu->smp_ring, apu->smp_target_max + max_frame_samples);
+  }
 
-  // *************** APU envelope lookup tables ***************
-  // There are 16 possible envelope periods (env->n is a 4-bit value)
-  for (int i = 0; i < 16; i++)
-    env_periods[i] = NTSC_CPU_SPEED / (i + 1);
+  // The audio thread's copy of the channels, and everything it synthesizes into
+  apu_t *synth = apu->synth = nes_malloc(sizeof *synth);
+  apu_reset(synth);
+  synth->audio = true;
+  synth->device = apu->device;
+
+  blip_init(&synth->blip, max_raw_samples);
+  blip_set_rates(&synth->blip, APU_SAMPLE_DIV, 1);
+  synth->raw_buf = nes_malloc(max_raw_samples * sizeof *synth->raw_buf);
+
+  if (nes->audio_out) {
+    resample_init(&synth->cap_rs, max_raw_samples, NTSC_CPU_SPEED / APU_SAMPLE_DIV);
+    resample_set_ratio(&synth->cap_rs, NTSC_CPU_SPEED, (u64) APU_SAMPLE_DIV * APU_CAPTURE_RATE);
+    synth->cap_buf_len = (u64) (max_raw_samples + RS_TAPS) * APU_SAMPLE_DIV * APU_CAPTURE_RATE / NTSC_CPU_SPEED + 1;
+    synth->cap_buf = nes_malloc(synth->cap_buf_len * sizeof *synth->cap_buf);
+  }
 
-  // *************** APU frequency lookup tables ***************
-  for (int i = 0; i < 2048; i++) {
-    pulse_periods[i] = smp_rate_d / (NTSC_CPU_SPEED / (i + 1) / 2);
-    triangle_periods[i] = smp_rate_d / (NTSC_CPU_SPEED / (i + 1));
+  if (apu->device) {
+    resample_init(&synth->rs, max_raw_samples, NTSC_CPU_SPEED / APU_SAMPLE_DIV);
+    resample_set_ratio(&synth->rs, NTSC_CPU_SPEED, (u64) APU_SAMPLE_DIV * apu->audio_spec.freq);
+    synth->rs_rate = apu->audio_spec.freq;
+    synth->smp_buf_len = max_frame_samples;
+    synth->smp_buf = nes_malloc(synth->smp_buf_len * sizeof *synth->smp_buf);
   }
 
-  for (int i = 0; i < 16; i++)
-    noise_periods[i] = smp_rate_d / (NTSC_CPU_SPEED / NOISE_SEQ_LENS[i]);
+  // The first slot is logged into right away, the others are free
+  for (int i = 0; i < APU_LOG_SLOTS; i++)
+    apu->log[i].recs = nes_malloc(APU_LOG_SZ * sizeof *apu->log[i].recs);
+  apu->log_cur = &apu->log[0];
+
+  apu->log_ready = SDL_CreateSemaphore(0);
+  apu->log_free = SDL_CreateSemaphore(APU_LOG_SLOTS - 1);
+  if (apu->log_ready == NULL || apu->log_free == NULL)
+    crash_and_burn("apu_init: SDL_CreateSemaphore failed: %s\n", SDL_GetError());
+  if ((apu->synth_thread = SDL_CreateThread(apu_synth_thread, "cnes-apu", nes)) == NULL)
+    crash_and_burn("apu_init: SDL_CreateThread failed: %s\n", SDL_GetError());
 }
 
-void apu_init(nes_t *nes, u32 sample_rate, u32 buf_len) {
+void apu_destroy(nes_t *nes) {
   apu_t *apu = nes->apu;
+  apu_t *synth = apu->synth;
 
-  // Initialize all APU state to zero
-  memset(apu, 0, sizeof *apu);
+  if (!synth)
+    return;
 
-  apu->buf_scale_factor = 16;
-  apu->noise.shift_reg = 1;
+  // Let the audio thread finish the frames it was handed and exit. The frame being logged is dropped
+  SDL_SemPost(apu->log_ready);
+  SDL_WaitThread(apu->synth_thread, NULL);
+  SDL_DestroySemaphore(apu->log_ready);
+  SDL_DestroySemaphore(apu->log_free);
+  for (int i = 0; i < APU_LOG_SLOTS; i++)
+    free(apu->log[i].recs);
 
-  // Request audio spec. Init code based on
-  // https://stackoverflow.com/questions/10110905/simple-sound-wave-generator-with-sdl-in-c
-  SDL_AudioSpec want;
-  want.freq = (i32) sample_rate;
-  want.format = AUDIO_S16SYS;
-  want.channels = 1;
-  want.callback = NULL;
-  want.userdata = NULL;
-  want.samples = buf_len;
+  blip_destroy(&synth->blip);
+  free(synth->raw_buf);
 
-  if ((apu->device_id = SDL_OpenAudioDevice(NULL, 0, &want, &apu->audio_spec, 0)) == 0)
-    crash_and_burn("apu_init: could not open audio device: %s\n", SDL_GetError());
+  if (nes->audio_out) {
+    resample_destroy(&synth->cap_rs);
+    free(synth->cap_buf);
+  }
 
-  // Initialize APU output level lookup tables
-  apu_init_lookup_tables(apu);
+  if (apu->device) {
+    resample_destroy(&synth->rs);
+    free(synth->smp_buf);
+  }
 
-  // Start sound
-  SDL_PauseAudioDevice(apu->device_id, 0);
-}
+  free(synth);
+  apu->synth = NULL;
 
-void apu_destroy(nes_t *nes) {
-  // Stop sound
-  SDL_PauseAudioDevice(nes->apu->device_id, 1);
+  if (!apu->device)
+    return;
+
+  // Stop sound. Once the device is closed the callback no longer touches the ring
+  SDL_PauseAudioDevice(apu->device_id, 1);
+  SDL_CloseAudioDevice(apu->device_id);
 
-  SDL_CloseAudioDevice(nes->apu->device_id);
+  log_msg(LOG_INFO, LOG_CAT_APU, "apu_destroy: audio underruns=%d overruns=%d latency=%.1fms drift=%dppm rate=%dHz",
+          SDL_AtomicGet(&apu->smp_ring.underruns), SDL_AtomicGet(&apu->smp_ring.overruns),
+          1000. * apu->smp_target / apu->audio_spec.freq, apu->drift_ppm, apu->audio_spec.freq + apu->rate_adj);
+  SDL_DestroySemaphore(apu->drained);
+  ring_destroy(&apu->smp_ring);
 }
\ No newline at end of file
@@ -1,18 +1,63 @@
 #include "include/args.h"
 #include "include/util.h"
+#include "include/trace.h"
+#include "include/log.h"
+#include "include/scale.h"
+#include "include/ntsc.h"
+
+static const char *USAGE =
+    "usage: cnes [options] <rom.nes>\n"
+    "options:\n"
+    "  --trace <file>          write a binary CPU trace to <file> (convert it with trace2log)\n"
+    "  --trace-records <n>     number of instructions kept in the trace ring (default %d)\n"
+    "  --ppu-thread            rasterize frames on a separate thread, one frame behind emulation\n"
+    "  --ppu-workers <n>       rasterize scanlines on <n> threads in parallel, 0 for one per CPU (implies --ppu-thread)\n"
+    "  --ntsc <n>              apply the NTSC composite video filter, output <n> (2-4) times as wide as the picture\n"
+    "  --ntsc-threads <n>      threads running the NTSC filter, 0 for one per CPU (default 1)\n"
+    "  --scale <n>             window size as a multiple of the picture's, 1-4 (default 2)\n"
+    "  --filter <name>         upscaling filter: nearest, scanlines, scalex or xbr (default nearest)\n"
+    "  --filter-threads <n>    threads running the upscaling filter, 0 for one per CPU (default 1)\n"
+    "  --overlay               show emulated FPS, frame times and audio buffer fill on screen\n"
+    "  --frameskip <n>         only draw one frame out of every <n> + 1, the others are emulated without pixels\n"
+    "  --audio-latency <ms>    initial audio latency target in milliseconds (default 32)\n"
+    "  --no-audio              don't open an audio device\n"
+    "  --audio-out <file>      capture audio to <file> at 48000 Hz, as WAV if it ends in .wav, else raw PCM\n"
+    "  --nsf                   <rom.nes> is an NSF tune, render it to --audio-out as fast as possible\n"
+    "  --nsf-song <n>          song to render, starting from 1 (default: the tune's default song)\n"
+    "  --nsf-seconds <n>       seconds of audio to render (default 120)\n"
+    "  --stats <file>          write hot-path counters as JSON to <file> (CNES_STATS builds only)\n"
+    "  --log-level <level>     debug, info, warn or error (default info)\n"
+    "  --log-cats <list>       comma separated categories to log: main,cpu,ppu,apu,mapper,input (default all)\n";
 
 void args_init(args_t *args) {
   // TODO: Add more config parameters here
+  args->cart_fn = NULL;
   args->cpu_log_output = false;
-  if (args->cpu_log_output)
-    args->cpu_logf = nes_fopen("../logs/cpu.log", "w");
-  else
-    args->cpu_logf = NULL;
+  args->cpu_trace_fn = NULL;
+  args->cpu_trace_records = TRACE_DEFAULT_RECORDS;
+  args->stats_fn = NULL;
+  args->log_level = LOG_INFO;
+  args->log_cats = LOG_CAT_ALL;
+  args->ppu_thread = false;
+  args->ppu_workers = 1;
+  args->frameskip = 0;
+  args->ntsc_scale = 0;
+  args->ntsc_threads = 1;
+  args->scale = 2;
+  args->filter = SCALE_NEAREST;
+  args->filter_threads = 1;
+  args->overlay = false;
 
   // Query default audio device sample rate. If it can't be found, use a default value
   const u16 default_buf_len = 64;
   const i32 default_sample_rate = 48000;
+  args->apu_audio = true;
   args->apu_buf_len = default_buf_len;
+  args->apu_latency_ms = 32;
+  args->apu_capture_fn = NULL;
+  args->nsf = false;
+  args->nsf_song = 0;
+  args->nsf_seconds = 120;
 
   char *default_device_name;
   SDL_AudioSpec default_spec;
@@ -32,8 +77,109 @@ void args_init(args_t *args) {
   }
 }
 
+// Returns the value of the option at argv[*i] and advances past it
+static char *args_next_val(int argc, char **argv, int *i) {
+  if (*i + 1 >= argc)
+    crash_and_burn("args_parse: %s requires a value\n", argv[*i]);
+  return argv[++*i];
+}
+
+// Parses a comma separated list of log categories into a bitmask
+static u32 args_parse_log_cats(char *list) {
+  u32 mask = 0;
+
+  for (char *cat = strtok(list, ","); cat; cat = strtok(NULL, ",")) {
+    int n = log_cat_from_str(cat);
+    if (n < 0)
+      crash_and_burn("args_parse: unknown log category \"%s\"\n", cat);
+    mask |= 1 << n;
+  }
+
+  return mask;
+}
+
+void args_parse(args_t *args, int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--trace") == 0) {
+      args->cpu_log_output = true;
+      args->cpu_trace_fn = args_next_val(argc, argv, &i);
+    } else if (strcmp(argv[i], "--trace-records") == 0) {
+      args->cpu_trace_records = strtoul(args_next_val(argc, argv, &i), NULL, 0);
+    } else if (strcmp(argv[i], "--ppu-thread") == 0) {
+      args->ppu_thread = true;
+    } else if (strcmp(argv[i], "--ppu-workers") == 0) {
+      args->ppu_workers = strtoul(args_next_val(argc, argv, &i), NULL, 0);
+      args->ppu_thread = true;
+    } else if (strcmp(argv[i], "--ntsc") == 0) {
+      args->ntsc_scale = strtoul(args_next_val(argc, argv, &i), NULL, 0);
+    } else if (strcmp(argv[i], "--ntsc-threads") == 0) {
+      args->ntsc_threads = strtoul(args_next_val(argc, argv, &i), NULL, 0);
+    } else if (strcmp(argv[i], "--scale") == 0) {
+      args->scale = strtoul(args_next_val(argc, argv, &i), NULL, 0);
+    } else if (strcmp(argv[i], "--filter") == 0) {
+      const char *val = args_next_val(argc, argv, &i);
+      int filter = scale_filter_from_str(val);
+      if (filter < 0)
+        crash_and_burn("args_parse: unknown filter \"%s\"\n", val);
+      args->filter = filter;
+    } else if (strcmp(argv[i], "--filter-threads") == 0) {
+      args->filter_threads = strtoul(args_next_val(argc, argv, &i), NULL, 0);
+    } else if (strcmp(argv[i], "--overlay") == 0) {
+      args->overlay = true;
+    } else if (strcmp(argv[i], "--frameskip") == 0) {
+      args->frameskip = strtoul(args_next_val(argc, argv, &i), NULL, 0);
+    } else if (strcmp(argv[i], "--audio-latency") == 0) {
+      args->apu_latency_ms = strtoul(args_next_val(argc, argv, &i), NULL, 0);
+    } else if (strcmp(argv[i], "--no-audio") == 0) {
+      args->apu_audio = false;
+    } else if (strcmp(argv[i], "--audio-out") == 0) {
+      args->apu_capture_fn = args_next_val(argc, argv, &i);
+    } else if (strcmp(argv[i], "--nsf") == 0) {
+      args->nsf = true;
+    } else if (strcmp(argv[i], "--nsf-song") == 0) {
+      args->nsf_song = strtoul(args_next_val(argc, argv, &i), NULL, 0);
+    } else if (strcmp(argv[i], "--nsf-seconds") == 0) {
+      args->nsf_seconds = strtoul(args_next_val(argc, argv, &i), NULL, 0);
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      args->stats_fn = args_next_val(argc, argv, &i);
+    } else if (strcmp(argv[i], "--log-level") == 0) {
+      char *val = args_next_val(argc, argv, &i);
+      int level = log_level_from_str(val);
+      if (level < 0)
+        crash_and_burn("args_parse: unknown log level \"%s\"\n", val);
+      args->log_level = level;
+    } else if (strcmp(argv[i], "--log-cats") == 0) {
+      args->log_cats = args_parse_log_cats(args_next_val(argc, argv, &i));
+    } else if (argv[i][0] == '-' || args->cart_fn) {
+      crash_and_burn(USAGE, TRACE_DEFAULT_RECORDS);
+    } else {
+      args->cart_fn = argv[i];
+    }
+  }
+
+  if (!args->cart_fn)
+    crash_and_burn(USAGE, TRACE_DEFAULT_RECORDS);
+
+  // The NSF player only renders to a file, and there's no PPU for the trace to sample
+  if (args->nsf && !args->apu_capture_fn)
+    crash_and_burn("args_parse: --nsf needs --audio-out\n");
+  if (args->nsf && args->cpu_log_output)
+    crash_and_burn("args_parse: --trace isn't supported with --nsf\n");
+
+  if (args->ntsc_scale && (args->ntsc_scale < 2 || args->ntsc_scale > NTSC_MAX_SCALE))
+    crash_and_burn("args_parse: --ntsc must be 2 to %d\n", NTSC_MAX_SCALE);
+
+  // Filters other than nearest scale the picture by --scale on the CPU, which the NTSC filter's output can't go through
+  if (args->scale < 1 || args->scale > SCALE_MAX)
+    crash_and_burn("args_parse: --scale must be 1 to %d\n", SCALE_MAX);
+  if (args->filter != SCALE_NEAREST && args->scale < 2)
+    crash_and_burn("args_parse: --filter %s needs a --scale of 2 or more\n", scale_filter_name(args->filter));
+  if (args->filter != SCALE_NEAREST && args->ntsc_scale)
+    crash_and_burn("args_parse: --filter %s can't be combined with --ntsc\n", scale_filter_name(args->filter));
+  if (args->filter == SCALE_SCALEX && args->scale > 3)
+    crash_and_burn("args_parse: --filter scalex only scales by 2 or 3\n");
+}
+
 void args_destroy(args_t *args) {
-  if (args->cpu_logf)
-    nes_fclose(args->cpu_logf);
   memset(args, 0, sizeof *args);
 }
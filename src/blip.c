@@ -0,0 +1,93 @@
+#include "include/blip.h"
+#include "include/util.h"
+
+// Band-limited impulse for each sub-sample phase: a windowed sinc with a cutoff of 0.45 * the sample rate and a
+// Blackman window, tap i of phase p sitting at x = i - (BLIP_WIDTH / 2 - 1) - p / BLIP_PHASES samples from the edge.
+// Every phase sums to exactly 1 << BLIP_KERNEL_BITS, so a step of delta integrates to exactly delta. The table is
+// precomputed so the output doesn't depend on the host's libm
+static const i16 BLIP_KERNEL[BLIP_PHASES][BLIP_WIDTH] = {
+    {2, -14, 45, -105, 195, -296, 378, 3686, 378, -296, 195, -105, 45, -14, 2, 0},
+    {2, -14, 43, -99, 178, -253, 265, 3681, 497, -339, 212, -111, 46, -14, 2, 0},
+    {2, -13, 41, -93, 160, -210, 157, 3667, 620, -381, 227, -116, 47, -14, 2, 0},
+    {2, -13, 39, -86, 141, -167, 54, 3642, 748, -422, 242, -120, 48, -14, 2, 0},
+    {2, -12, 37, -78, 122, -125, -42, 3607, 879, -462, 254, -123, 48, -13, 2, 0},
+    {2, -12, 35, -71, 103, -83, -132, 3563, 1013, -499, 266, -125, 47, -13, 2, 0},
+    {2, -11, 32, -63, 84, -43, -215, 3508, 1150, -534, 276, -126, 46, -12, 2, 0},
+    {2, -10, 29, -55, 65, -4, -292, 3445, 1290, -566, 283, -126, 45, -11, 1, 0},
+    {1, -9, 26, -47, 47, 33, -361, 3374, 1430, -596, 289, -125, 43, -10, 1, 0},
+    {1, -9, 24, -39, 29, 68, -424, 3293, 1572, -621, 292, -123, 41, -9, 1, 0},
+    {1, -8, 21, -31, 11, 101, -480, 3206, 1714, -643, 294, -120, 38, -8, 0, 0},
+    {1, -7, 18, -23, -5, 131, -529, 3109, 1856, -660, 292, -116, 35, -6, 0, 0},
+    {1, -6, 15, -16, -21, 160, -571, 3007, 1996, -673, 288, -110, 31, -4, -1, 0},
+    {1, -5, 12, -8, -36, 185, -606, 2897, 2135, -681, 282, -103, 27, -3, -1, 0},
+    {1, -5, 9, -1, -50, 208, -634, 2781, 2272, -683, 273, -95, 22, 0, -2, 0},
+    {1, -4, 7, 5, -63, 229, -656, 2660, 2405, -680, 261, -86, 17, 2, -2, 0},
+    {0, -3, 4, 11, -75, 246, -671, 2537, 2535, -671, 246, -75, 11, 4, -3, 0},
+    {0, -2, 2, 17, -86, 261, -680, 2405, 2660, -656, 229, -63, 5, 7, -4, 1},
+    {0, -2, 0, 22, -95, 273, -683, 2272, 2781, -634, 208, -50, -1, 9, -5, 1},
+    {0, -1, -3, 27, -103, 282, -681, 2135, 2897, -606, 185, -36, -8, 12, -5, 1},
+    {0, -1, -4, 31, -110, 288, -673, 1996, 3007, -571, 160, -21, -16, 15, -6, 1},
+    {0, 0, -6, 35, -116, 292, -660, 1856, 3109, -529, 131, -5, -23, 18, -7, 1},
+    {0, 0, -8, 38, -120, 294, -643, 1714, 3206, -480, 101, 11, -31, 21, -8, 1},
+    {0, 1, -9, 41, -123, 292, -621, 1572, 3293, -424, 68, 29, -39, 24, -9, 1},
+    {0, 1, -10, 43, -125, 289, -596, 1430, 3374, -361, 33, 47, -47, 26, -9, 1},
+    {0, 1, -11, 45, -126, 283, -566, 1290, 3445, -292, -4, 65, -55, 29, -10, 2},
+    {0, 2, -12, 46, -126, 276, -534, 1150, 3508, -215, -43, 84, -63, 32, -11, 2},
+    {0, 2, -13, 47, -125, 266, -499, 1013, 3563, -132, -83, 103, -71, 35, -12, 2},
+    {0, 2, -13, 48, -123, 254, -462, 879, 3607, -42, -125, 122, -78, 37, -12, 2},
+    {0, 2, -14, 48, -120, 242, -422, 748, 3642, 54, -167, 141, -86, 39, -13, 2},
+    {0, 2, -14, 47, -116, 227, -381, 620, 3667, 157, -210, 160, -93, 41, -13, 2},
+    {0, 2, -14, 46, -111, 212, -339, 497, 3681, 265, -253, 178, -99, 43, -14, 2}
+};
+
+void blip_init(blip_t *blip, u32 max_samples) {
+  memset(blip, 0, sizeof *blip);
+  blip->buf_len = max_samples;
+  blip->buf = nes_calloc(max_samples + BLIP_WIDTH, sizeof *blip->buf);
+}
+
+void blip_destroy(blip_t *blip) {
+  free(blip->buf);
+  memset(blip, 0, sizeof *blip);
+}
+
+void blip_set_rates(blip_t *blip, u32 clock_rate, u32 sample_rate) {
+  blip->factor = ((u64) sample_rate << BLIP_FRAC_BITS) / clock_rate;
+}
+
+void blip_add_delta(blip_t *blip, u32 time, i32 delta) {
+  u64 pos = blip->offset + time * blip->factor;
+  u32 idx = pos >> BLIP_FRAC_BITS;
+  u32 phase = (pos >> (BLIP_FRAC_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+
+  assert(idx < blip->buf_len);
+  i32 *out = blip->buf + idx;
+  const i16 *k = BLIP_KERNEL[phase];
+  for (int i = 0; i < BLIP_WIDTH; i++)
+    out[i] += delta * k[i];
+}
+
+void blip_end_frame(blip_t *blip, u32 time) {
+  blip->offset += time * blip->factor;
+  assert(blip_samples_avail(blip) <= blip->buf_len);
+}
+
+u32 blip_read_samples(blip_t *blip, i16 *out, u32 n) {
+  n = MIN(n, blip_samples_avail(blip));
+
+  i32 sum = blip->integrator;
+  for (u32 i = 0; i < n; i++) {
+    sum += blip->buf[i];
+    i32 s = sum >> BLIP_KERNEL_BITS;
+    out[i] = (i16) (s > INT16_MAX ? INT16_MAX : s < INT16_MIN ? INT16_MIN : s);
+  }
+  blip->integrator = sum;
+
+  // Shift the unread deltas, including the kernel tails that spilled past the end of the frame, to the front
+  u32 remain = blip_samples_avail(blip) - n + BLIP_WIDTH;
+  memmove(blip->buf, blip->buf + n, remain * sizeof *blip->buf);
+  memset(blip->buf + remain, 0, n * sizeof *blip->buf);
+  blip->offset -= (u64) n << BLIP_FRAC_BITS;
+
+  return n;
+}
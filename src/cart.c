@@ -1,5 +1,6 @@
 #include "include/cart.h"
 #include "include/util.h"
+#include "include/log.h"
 
 static u8 get_mapper(cart_t *cart) {
   u8 low, high;
@@ -37,13 +38,13 @@ void cart_init(cart_t *cart, char *cart_fn) {
 
   // The lower bound is 0x4000 because I am using the chr buffer directly as cartridge space + vram
   // TODO: This might not work at all and at the very least it's hacky
-  cart->chr = nes_malloc(MAX(CHR_SZ, 0x4000));
+  cart->chr_sz = MAX(CHR_SZ, 0x4000);
+  cart->chr = nes_malloc(cart->chr_sz);
   nes_fread(cart->chr, INES_CHRROM_BLOCKSZ, cart->header.chrrom_n, cart_f);
 
   nes_fclose(cart_f);
-  printf("cart_init: loaded cart prgrom=16K*%d chrrom=8K*%d trainer=%s\n",
-         cart->header.prgrom_n, cart->header.chrrom_n,
-         cart->header.flags6 & 0x04 ? "yes" : "no");
+  log_msg(LOG_INFO, LOG_CAT_MAPPER, "cart_init: loaded cart prgrom=16K*%d chrrom=8K*%d trainer=%s",
+          cart->header.prgrom_n, cart->header.chrrom_n, cart->header.flags6 & 0x04 ? "yes" : "no");
 
   cart->fixed_mirror = cart->header.flags6 & 1;
   cart->mapno = get_mapper(cart);
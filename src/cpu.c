@@ -5,6 +5,9 @@
 #include "include/ppu.h"
 #include "include/apu.h"
 #include "include/args.h"
+#include "include/mappers.h"
+#include "include/trace.h"
+#include "include/stats.h"
 
 #define OP_FUNC static inline void
 
@@ -12,13 +15,15 @@
 
 // TODO: This whole file needs a refactor. I hate seeing nes-> everywhere, plus it makes the code less readable
 static bool cpu_get_operand_tick(nes_t *nes, u16 *operand, bool is_read_op);
-static void cpu_log_op(nes_t *nes, bool debug_nmi);
+static void cpu_trace_op(nes_t *nes, bool debug_nmi);
 static void cpu_branch_op(nes_t *nes, u8 flag_bit, bool branch_if_flag);
 static void cpu_pull_reg_op(nes_t *nes, bool reg_a);
 static void cpu_push_reg_op(nes_t *nes, bool reg_a);
 static void cpu_compare_op(nes_t *nes, u8 val1);
 static void cpu_add_op(nes_t *nes, bool subtract);
 static void cpu_rmw_op(nes_t *nes, rmw_op_type_t op_type);
+static inline u8 cpu_load8(nes_t *nes, u16 addr);
+static inline void cpu_store8(nes_t *nes, u16 addr, u8 val);
 
 // TODO: Implement open-bus behavior. This is also unclean and should probably be behind some interface
 u16 addr_bus = 0;
@@ -28,6 +33,9 @@ u8 data_bus = 0;
 u16 oam_dma_byte = 0;
 bool oam_dma_read = true;
 
+// Cycles left to wait after a bulk OAM DMA copy
+u16 oam_dma_stall = 0;
+
 // Current cycle in interrupt setup sequence
 u8 intr_cyc = 0;
 
@@ -48,7 +56,7 @@ OP_FUNC oADC(nes_t *nes) {
 OP_FUNC oAND(nes_t *nes) {
   u16 addr = 0;
   if (cpu_get_operand_tick(nes, &addr, true)) {
-    nes->cpu->a &= cpu_read8(nes, addr);
+    nes->cpu->a &= cpu_load8(nes, addr);
     cpu_set_nz(nes, nes->cpu->a);
     nes->cpu->fetch_op = true;
   }
@@ -74,7 +82,7 @@ OP_FUNC oBIT(nes_t *nes) {
   cpu_t *cpu = nes->cpu;
   u16 addr = 0;
   if (cpu_get_operand_tick(nes, &addr, false)) {
-    u8 val = cpu_read8(nes, addr);
+    u8 val = cpu_load8(nes, addr);
     SET_BIT(cpu->p, Z_FLAG, (cpu->a & val) == 0);
 
     // Overflow flag is set to bit 6 of memory value
@@ -161,7 +169,7 @@ OP_FUNC oDEY(nes_t *nes) {
 OP_FUNC oEOR(nes_t *nes) {
   u16 addr = 0;
   if (cpu_get_operand_tick(nes, &addr, true)) {
-    nes->cpu->a ^= cpu_read8(nes, addr);
+    nes->cpu->a ^= cpu_load8(nes, addr);
     cpu_set_nz(nes, nes->cpu->a);
     nes->cpu->fetch_op = true;
   }
@@ -259,7 +267,7 @@ OP_FUNC oJSR(nes_t *nes) {
 OP_FUNC oLDA(nes_t *nes) {
   u16 addr = 0;
   if (cpu_get_operand_tick(nes, &addr, true)) {
-    nes->cpu->a = cpu_read8(nes, addr);
+    nes->cpu->a = cpu_load8(nes, addr);
     cpu_set_nz(nes, nes->cpu->a);
     nes->cpu->fetch_op = true;
   }
@@ -268,7 +276,7 @@ OP_FUNC oLDA(nes_t *nes) {
 OP_FUNC oLDX(nes_t *nes) {
   u16 addr = 0;
   if (cpu_get_operand_tick(nes, &addr, true)) {
-    nes->cpu->x = cpu_read8(nes, addr);
+    nes->cpu->x = cpu_load8(nes, addr);
     cpu_set_nz(nes, nes->cpu->x);
     nes->cpu->fetch_op = true;
   }
@@ -277,7 +285,7 @@ OP_FUNC oLDX(nes_t *nes) {
 OP_FUNC oLDY(nes_t *nes) {
   u16 addr = 0;
   if (cpu_get_operand_tick(nes, &addr, true)) {
-    nes->cpu->y = cpu_read8(nes, addr);
+    nes->cpu->y = cpu_load8(nes, addr);
     cpu_set_nz(nes, nes->cpu->y);
     nes->cpu->fetch_op = true;
   }
@@ -294,7 +302,7 @@ OP_FUNC oNOP(nes_t *nes) {
 OP_FUNC oORA(nes_t *nes) {
   u16 addr = 0;
   if (cpu_get_operand_tick(nes, &addr, true)) {
-    nes->cpu->a |= cpu_read8(nes, addr);
+    nes->cpu->a |= cpu_load8(nes, addr);
     cpu_set_nz(nes, nes->cpu->a);
     nes->cpu->fetch_op = true;
   }
@@ -394,7 +402,7 @@ OP_FUNC oSEI(nes_t *nes) {
 OP_FUNC oSTA(nes_t *nes) {
   u16 addr = 0;
   if (cpu_get_operand_tick(nes, &addr, false)) {
-    cpu_write8(nes, addr, nes->cpu->a);
+    cpu_store8(nes, addr, nes->cpu->a);
     nes->cpu->fetch_op = true;
   }
 }
@@ -402,7 +410,7 @@ OP_FUNC oSTA(nes_t *nes) {
 OP_FUNC oSTX(nes_t *nes) {
   u16 addr = 0;
   if (cpu_get_operand_tick(nes, &addr, false)) {
-    cpu_write8(nes, addr, nes->cpu->x);
+    cpu_store8(nes, addr, nes->cpu->x);
     nes->cpu->fetch_op = true;
   }
 }
@@ -410,7 +418,7 @@ OP_FUNC oSTX(nes_t *nes) {
 OP_FUNC oSTY(nes_t *nes) {
   u16 addr = 0;
   if (cpu_get_operand_tick(nes, &addr, false)) {
-    cpu_write8(nes, addr, nes->cpu->y);
+    cpu_store8(nes, addr, nes->cpu->y);
     nes->cpu->fetch_op = true;
   }
 }
@@ -554,7 +562,7 @@ static void cpu_compare_op(nes_t *nes, u8 val1) {
 
   // TODO: Can compare ops incur page cross penalties? I believe they can
   if (cpu_get_operand_tick(nes, &addr, true)) {
-    u8 val2 = cpu_read8(nes, addr);
+    u8 val2 = cpu_load8(nes, addr);
     SET_BIT(cpu->p, C_FLAG, val1 >= val2);
     cpu_set_nz(nes, val1 - val2);
     cpu->fetch_op = true;
@@ -610,12 +618,12 @@ static void cpu_rmw_op(nes_t *nes, rmw_op_type_t op_type) {
     switch (cpu->op.cyc) {
       case 0:
         // Write original value back to address and do the transformation
-        cpu_write8(nes, addr_bus, data_bus);
+        cpu_store8(nes, addr_bus, data_bus);
         cpu_rmw_modify(nes, &data_bus, op_type);
         break;
       case 1:
         // Write new value
-        cpu_write8(nes, addr_bus, data_bus);
+        cpu_store8(nes, addr_bus, data_bus);
         cpu->fetch_op = true;
         break;
       default:
@@ -625,7 +633,7 @@ static void cpu_rmw_op(nes_t *nes, rmw_op_type_t op_type) {
   } else {
     // RMW ops do not incur page crossing penalties
     if (cpu_get_operand_tick(nes, &addr_bus, false)) {
-      data_bus = cpu_read8(nes, addr_bus);
+      data_bus = cpu_load8(nes, addr_bus);
       cpu->op.rmw_did_read = true;
       cpu->op.cyc = 0;
       return;
@@ -637,7 +645,7 @@ static void cpu_add_op(nes_t *nes, bool subtract) {
   cpu_t *cpu = nes->cpu;
   u16 addr = 0;
   if (cpu_get_operand_tick(nes, &addr, true)) {
-    u8 val = cpu_read8(nes, addr);
+    u8 val = cpu_load8(nes, addr);
 
     // Subtraction is implemented by simply negating the operand
     if (subtract)
@@ -660,6 +668,7 @@ static void cpu_add_op(nes_t *nes, bool subtract) {
 }
 
 static void cpu_set_op(cpu_t *cpu, u8 opcode) {
+  STAT_INC(opcodes[opcode]);
   cpu->op.code = opcode;
   cpu->op.mode = cpu_op_addrmodes[opcode];
   cpu->op.handler = cpu_op_handlers[opcode];
@@ -667,6 +676,25 @@ static void cpu_set_op(cpu_t *cpu, u8 opcode) {
   cpu->op.cyc = 0;
 }
 
+// Zero page operands can only be internal RAM, so instructions using them skip the address decode in cpu_read8() and
+// cpu_write8()
+static inline bool cpu_op_is_zp(const cpu_t *cpu) {
+  return cpu->op.mode == ZP || cpu->op.mode == ZP_IDX_X || cpu->op.mode == ZP_IDX_Y;
+}
+
+// Reads the operand of a load, arithmetic or read-modify-write instruction
+static inline u8 cpu_load8(nes_t *nes, u16 addr) {
+  return cpu_op_is_zp(nes->cpu) ? cpu_zp_read8(nes, (u8) addr) : cpu_read8(nes, addr);
+}
+
+// Writes the operand of a store or read-modify-write instruction
+static inline void cpu_store8(nes_t *nes, u16 addr, u8 val) {
+  if (cpu_op_is_zp(nes->cpu))
+    cpu_zp_write8(nes, (u8) addr, val);
+  else
+    cpu_write8(nes, addr, val);
+}
+
 // Does an operand fetch cycle for the current op. This is called once per cycle and takes a variable number of cycles
 // to complete, depending on the addressing mode. Returns true when the final operand address is calculated and placed
 // into `operand`. Returns false and does not set `operand` otherwise.
@@ -745,7 +773,7 @@ static bool cpu_get_operand_tick(nes_t *nes, u16 *operand, bool is_read_op) {
         case 1:
           // Add index reg to ZP address
           // Zero-page dummy reads are free from side effects so we can leave it here
-          cpu_read8(nes, addr_bus);
+          cpu_zp_read8(nes, addr_bus);
 
           u8 inc_val = cpu->op.mode == ZP_IDX_X ? cpu->x : cpu->y;
           addr_bus = (addr_bus + inc_val) & 0xFF;
@@ -765,19 +793,19 @@ static bool cpu_get_operand_tick(nes_t *nes, u16 *operand, bool is_read_op) {
           return false;
         case 1:
           // Dummy read from pointer, then add X to it
-          cpu_read8(nes, data_bus);
+          cpu_zp_read8(nes, data_bus);
           // This properly wraps around to the correct zero-page address since data_bus is a u8
           data_bus += cpu->x;
           cpu->op.cyc++;
           return false;
         case 2:
           // Fetch effective address low
-          SET_BYTE_LO(addr_bus, cpu_read8(nes, data_bus));
+          SET_BYTE_LO(addr_bus, cpu_zp_read8(nes, data_bus));
           cpu->op.cyc++;
           return false;
         case 3:
           // Fetch effective address high
-          SET_BYTE_HI(addr_bus, cpu_read8(nes, (data_bus + 1) & 0xFF));
+          SET_BYTE_HI(addr_bus, cpu_zp_read8(nes, data_bus + 1));
           cpu->op.cyc++;
           return false;
         case 4:
@@ -795,12 +823,12 @@ static bool cpu_get_operand_tick(nes_t *nes, u16 *operand, bool is_read_op) {
           return false;
         case 1:
           // Fetch effective address low
-          SET_BYTE_LO(addr_bus, cpu_read8(nes, data_bus));
+          SET_BYTE_LO(addr_bus, cpu_zp_read8(nes, data_bus));
           cpu->op.cyc++;
           return false;
         case 2:
           // Fetch effective address high
-          SET_BYTE_HI(addr_bus, cpu_read8(nes, (data_bus + 1) & 0xFF));
+          SET_BYTE_HI(addr_bus, cpu_zp_read8(nes, data_bus + 1));
           cpu->op.cyc++;
           return false;
         case 3: {
@@ -869,7 +897,7 @@ static void cpu_init_tables() {
 // Returns true when interrupt sequence has finished
 static bool cpu_handle_interrupt(nes_t *nes, interrupt_t intr_type) {
   cpu_t *cpu = nes->cpu;
-//  printf("handle irq type=%d cyc=%d\n", intr_type, intr_cyc);
+  STAT_INC(intr_cycles[intr_type]);
   switch (intr_cyc) {
     case 0:
       // Read next instruction byte and throw it away
@@ -918,33 +946,52 @@ static bool cpu_handle_interrupt(nes_t *nes, interrupt_t intr_type) {
   return false;
 }
 
-static bool cpu_do_oam_dma(nes_t *nes) {
+// Copies the whole OAM DMA source page into OAM at once. This is only possible when reading the page has no side
+// effects, i.e. it is internal RAM or cartridge ROM. Returns false if the page has to be copied one byte at a time
+static bool cpu_oam_dma_bulk(nes_t *nes) {
   cpu_t *cpu = nes->cpu;
   ppu_t *ppu = nes->ppu;
+  u16 base = cpu->oam_dma_base;
+
+  if (base <= 0x1FFF) {
+    // 2KB internal RAM. The base is page aligned, so the page never wraps around the mirror
+    memcpy(ppu->oam, &cpu->mem[base % CPU_MEM_SZ], OAM_SZ);
+  } else if (base >= 0x8000) {
+    // PRG ROM
+    for (u16 i = 0; i < OAM_SZ; i++)
+      ppu->oam[i] = nes->mapper->cpu_read(nes, base + i);
+  } else {
+    return false;
+  }
+  ppu_oam_page_written(nes);
+  return true;
+}
+
+static bool cpu_do_oam_dma(nes_t *nes) {
+  cpu_t *cpu = nes->cpu;
+  STAT_INC(oam_dma_cycles);
 
-//  // Alternate read/write cycles
-//  oam_dma_read = !oam_dma_read;
+  // Try to do the whole transfer on the first cycle. The CPU is still suspended for the same number of cycles as a
+  // byte-by-byte transfer so the PPU and APU stay in sync
+  if (oam_dma_byte == 0 && oam_dma_read && cpu_oam_dma_bulk(nes)) {
+    oam_dma_byte = 256;
+    oam_dma_stall = 2 * 256 - 1;
+    return false;
+  }
+
+  if (oam_dma_stall > 0) {
+    oam_dma_stall--;
+    return false;
+  }
 
   // Read a page of memory starting at cpu->oam_dma_base into PPU OAM
   if (oam_dma_byte < 256) {
     if (oam_dma_read) {
       // Read byte to be placed into OAM
       data_bus = cpu_read8(nes, cpu->oam_dma_base + oam_dma_byte);
-//      printf("oam dma read, dma_base=$%04X dma_byte=$%02X data=$%02X\n", cpu->oam_dma_base, oam_dma_byte, data_bus);
     } else {
-//      printf("oam dma write, dma_base=$%04X dma_byte=$%02X data=$%02X\n", cpu->oam_dma_base, oam_dma_byte, data_bus);
-      // Write byte to OAM. There are four bytes per sprite, so calculate the index into the sprite array
-      u8 attr_idx = oam_dma_byte % 4;
-      u8 sprite_idx = oam_dma_byte >> 2;
-      if (attr_idx == 0)
-        ppu->oam[sprite_idx].data.y_pos = data_bus;
-      else if (attr_idx == 1)
-        ppu->oam[sprite_idx].data.tile_idx = data_bus;
-      else if (attr_idx == 2)
-        ppu->oam[sprite_idx].data.attr = data_bus;
-      else if (attr_idx == 3)
-        ppu->oam[sprite_idx].data.x_pos = data_bus;
-      ppu->oam[sprite_idx].sprite0 = sprite_idx == 0;
+      // Write byte to OAM
+      ppu_oam_write(nes, oam_dma_byte, data_bus);
       oam_dma_byte++;
     }
 
@@ -980,12 +1027,12 @@ void cpu_tick(nes_t *nes) {
       cpu->nmi = false;
 
       if (nes->args->cpu_log_output) {
-        cpu_log_op(nes, true);
+        cpu_trace_op(nes, true);
       }
     } else {
       // Normal instruction sequence
       if (nes->args->cpu_log_output) {
-        cpu_log_op(nes, false);
+        cpu_trace_op(nes, false);
       }
     }
 
@@ -1024,130 +1071,74 @@ void cpu_destroy(nes_t *nes) {
   memset(nes->cpu, 0, sizeof *nes->cpu);
 }
 
-static void cpu_log_op(nes_t *nes, bool debug_nmi) {
-  const int OPERAND_SIZES[] = {2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 0};
-  u8 num_operands, low, high;
-  cpu_t *cpu = nes->cpu;
+// Reads memory for the CPU trace. Internal RAM and cartridge PRG RAM and ROM ($6000-$FFFF) can be read without side
+// effects, so code running from any of them is traced correctly. The PPU, APU and I/O registers read as zero
+static u8 cpu_peek8(nes_t *nes, u16 addr) {
+  if (addr <= 0x1FFF)
+    return nes->cpu->mem[addr % CPU_MEM_SZ];
+  else if (addr >= 0x6000)
+    return nes->mapper->cpu_read(nes, addr);
+  return 0;
+}
 
-  // Get operand for logging purposes
-  u8 opcode = cpu_read8(nes, cpu->pc);
-  addrmode_t mode = get_addrmode(opcode);
-  u8 dbg_operand_sz = OPERAND_SIZES[mode];
-  u16 operand = 0;
-  if (dbg_operand_sz == 2)
-    operand = cpu_read16(nes, cpu->pc + 1);
-  else if (dbg_operand_sz == 1)
-    operand = cpu_read8(nes, cpu->pc + 1);
-
-  FILE *log_f = nes->args->cpu_logf;
-
-  fprintf(log_f, "%04X  ", cpu->pc);
-  num_operands = OPERAND_SIZES[mode];
-  low = operand & 0x00FF;
-  high = (operand & 0xFF00) >> 8;
-  switch (num_operands) {
-    case 0:
-      fprintf(log_f, "%02X       ", opcode);
-      break;
-    case 1:
-      fprintf(log_f, "%02X %02X    ", opcode, low);
-      break;
-    case 2:
-      fprintf(log_f, "%02X %02X %02X ", opcode, low, high);
-      break;
-    default:
-      crash_and_burn("cpu_log_op: invalid operand count, wtf?\n");
-  }
-  fprintf(log_f, " %s", cpu_opcode_tos(opcode));
-  switch (mode) {
+// Records the instruction at PC in the CPU trace. Formatting is left to tools/trace2log.c, so this only copies raw
+// state and resolves the effective address the same way the text log shows it
+static void cpu_trace_op(nes_t *nes, bool debug_nmi) {
+  cpu_t *cpu = nes->cpu;
+  trace_rec_t *rec = trace_next(nes->trace);
+
+  rec->cycle = cpu->ticks;
+  rec->pc = cpu->pc;
+  rec->scanline = nes->ppu->scanline;
+  rec->dot = nes->ppu->dot;
+  rec->opcode = cpu_peek8(nes, cpu->pc);
+  rec->operand[0] = cpu_peek8(nes, cpu->pc + 1);
+  rec->operand[1] = cpu_peek8(nes, cpu->pc + 2);
+  rec->mode = cpu_op_addrmodes[rec->opcode];
+  rec->a = cpu->a;
+  rec->x = cpu->x;
+  rec->y = cpu->y;
+  rec->p = cpu->p;
+  rec->sp = cpu->sp;
+  rec->flags = (debug_nmi ? TRACE_FLAG_NMI : 0) | (cpu->do_oam_dma ? TRACE_FLAG_OAM_DMA : 0);
+
+  u8 zp = rec->operand[0];
+  u16 operand = rec->operand[0] | (rec->operand[1] << 8);
+  u16 eff_addr = 0;
+  rec->ind_addr = 0;
+  switch (rec->mode) {
     case ABS:
-      // JSR and JMP absolute shouldn't display val @ address
-      if (opcode == 0x20 || opcode == 0x4C)
-        fprintf(log_f, " $%04X                       ", operand);
-      else {
-        // We don't want to access reg that have side effects, like PPU reg, OAM DMA,
-        if (!(operand >= 0x2000 && operand <= 0x3FFF) && !(operand >= 0x4000 && operand <= 0x4020))
-          fprintf(log_f, " $%04X = %02X                  ", operand, cpu_read8(nes, operand));
-        else
-          fprintf(log_f, " $%04X                       ", operand);
-      }
+      eff_addr = operand;
       break;
-    case ABS_IND: {
-      u8 lo = cpu_read8(nes, operand);
-      u8 hi = cpu_read8(nes, ((operand + 1) & 0xFF) | (operand & ~0xFF));
-      u16 fin = lo | (hi << 8);
-      fprintf(log_f, " ($%04X) = %04X              ", operand, fin);
+    case ABS_IND:
+      // The pointer increment does not cross page boundaries
+      rec->ind_addr = cpu_peek8(nes, operand) | (cpu_peek8(nes, ((operand + 1) & 0xFF) | (operand & ~0xFF)) << 8);
       break;
-    }
     case ABS_IDX_X:
-    case ABS_IDX_Y: {
-      u8 inc = mode == ABS_IDX_X ? cpu->x : cpu->y;
-      fprintf(log_f, " $%04X,%s @ %04X = %02X         ", operand,
-              mode == ABS_IDX_X ? "X" : "Y", (operand + inc) & 0xFFFF, cpu_read8(nes, operand + inc));
-      break;
-    }
-    case REL:
-      // Add two because we haven't advanced the PC when this function is called
-      fprintf(log_f, " $%04X                       ", nes->cpu->pc + (i8) operand + 2);
+      eff_addr = operand + cpu->x;
       break;
-    case IMM:
-      fprintf(log_f, " #$%02X                        ", operand);
+    case ABS_IDX_Y:
+      eff_addr = operand + cpu->y;
       break;
     case ZP:
-      fprintf(log_f, " $%02X = %02X                    ", operand,
-              cpu_read8(nes, operand));
+      eff_addr = zp;
       break;
     case ZP_IDX_X:
-    case ZP_IDX_Y: {
-      u8 inc_val = mode == ZP_IDX_X ? cpu->x : cpu->y;
-      fprintf(log_f, " $%02X,%s @ %02X = %02X             ", operand,
-              mode == ZP_IDX_X ? "X" : "Y", (operand + inc_val) & 0xFF, cpu_read8(nes, (operand + inc_val) & 0xFF));
+      eff_addr = (u8) (zp + cpu->x);
       break;
-    }
-    case ZP_IDX_IND: {
-      u16 zp_addr = (operand + cpu->x) & 0xFF;
-      u8 at_zp_lo = cpu_read8(nes, zp_addr);
-      u8 at_zp_hi = cpu_read8(nes, (zp_addr + 1) & 0xFF);
-      u16 fin_zp = at_zp_lo | (at_zp_hi << 8);
-      fprintf(log_f, " ($%02X,X) @ %02X = %04X = %02X    ", operand,
-              (operand + cpu->x) & 0xFF, fin_zp, cpu_read8(nes, fin_zp));
+    case ZP_IDX_Y:
+      eff_addr = (u8) (zp + cpu->y);
+      break;
+    case ZP_IDX_IND:
+      rec->ind_addr = cpu_zp_read8(nes, zp + cpu->x) | (cpu_zp_read8(nes, zp + cpu->x + 1) << 8);
+      eff_addr = rec->ind_addr;
       break;
-    }
     case ZP_IND_IDX_Y:
-      low = cpu_read8(nes, operand);
-      high = cpu_read8(nes, (operand + 1) & 0xFF);
-      u16 ind_addr = low | (high << 8);
-      fprintf(log_f, " ($%02X),Y = %04X @ %04X = %02X  ", operand,
-              ind_addr, (ind_addr + cpu->y) & 0xFFFF, cpu_read8(nes, ind_addr + cpu->y));
+      rec->ind_addr = cpu_zp_read8(nes, zp) | (cpu_zp_read8(nes, zp + 1) << 8);
+      eff_addr = rec->ind_addr + cpu->y;
       break;
-    case IMPL_ACCUM:
-      // For some dumb reason, accumulator arithmetic instructions have "A" as
-      // the operand...
-      // OP_LSR OP_ASL OP_ROL OP_ROR
-      if (opcode == 0x4A || opcode == 0x0A || opcode == 0x2A || opcode == 0x6A)
-        fprintf(log_f, " A                           ");
-      else
-        fprintf(log_f, "                             ");
+    default:
       break;
   }
-
-  // Print registers
-  fprintf(log_f,
-          "A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3u,%3u CYC:%lu",
-          cpu->a, cpu->x, cpu->y, cpu->p, cpu->sp, nes->ppu->scanline,
-          nes->ppu->dot, cpu->ticks);
-
-  // Mark where interrupts occur
-  if (cpu->do_oam_dma) {
-    fprintf(log_f, " OAM_DMA! ");
-  }
-  if (debug_nmi) {
-    fprintf(log_f, " NMI!");
-  }
-//  else if (cpu->irq_pending) {
-//    fprintf(log_f, " IRQ!");
-//  }
-
-  fprintf(log_f, "\n");
-//  fflush(log_f);
-}
\ No newline at end of file
+  rec->mem_val = cpu_peek8(nes, eff_addr);
+}
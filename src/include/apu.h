@@ -2,19 +2,63 @@
 #define CNES_APU_H
 
 #include "nes.h"
+#include "ring.h"
+#include "blip.h"
+#include "resample.h"
 
 // NTSC CPU speed in Hz (~1.78 MHz)
-#define NTSC_CPU_SPEED 1789773.
+#define NTSC_CPU_SPEED 1789773
+
+// The APU is synthesized at a fixed NTSC_CPU_SPEED / APU_SAMPLE_DIV (~55.9 kHz) and resampled to the device's rate
+#define APU_SAMPLE_DIV 32
+
+// The output sample rate is adjusted by at most 1 / APU_RATE_ADJ_DIV (0.5%) to keep emulation running at the NES's
+// speed while the audio device paces it
+#define APU_RATE_ADJ_DIV 200
+
+// Sample rate of --audio-out captures. Fixed so captures don't depend on the audio device
+#define APU_CAPTURE_RATE 48000
+
+// Audio frames between drift measurements (~2 seconds)
+#define APU_DRIFT_FRAMES 120
+
+// Timer value of a channel that is silent and not generating edges
+#define APU_TIMER_STOPPED UINT32_MAX
+
+// Longest stretch of CPU cycles the APU renders without apu_end_frame() being called
+#define APU_MAX_FRAME_CYCLES (4 * 29781)
+
+// Frames of register writes that can be queued for the audio thread. A frame logs at most one write every other CPU
+// cycle (read-modify-write instructions write twice in seven cycles) plus its frame counter steps
+#define APU_LOG_SLOTS 3
+#define APU_LOG_SZ    (APU_MAX_FRAME_CYCLES / 2 + 16)
+
+// Address of a log record that stands for a frame counter step rather than a register write
+#define APU_LOG_FRAME_STEP 0
+
+typedef struct apu_log_rec {
+  u32 time;  // CPU cycles since the start of the frame
+  u16 addr;
+  u8 val;
+} apu_log_rec_t;
+
+typedef struct apu_log {
+  apu_log_rec_t *recs;
+  u32 n;
+  u32 time;  // Length of the frame in CPU cycles, set when it is handed off
+  u32 n_samples;  // Samples the audio thread synthesized for the frame, read back when the slot is reused
+} apu_log_t;
 
 typedef struct envelope {
   u8 loop;
   u8 disable;
   u8 n;
 
-  // Envelope divider
-  u8 env_volume;
-  u8 env_seq_i;
-  f64 env_c;
+  // Envelope divider and decay level. start is set by length counter writes and restarts the envelope on the next
+  // quarter frame
+  bool start;
+  u8 divider;
+  u8 decay;
 } envelope_t;
 
 typedef struct sweep_unit {
@@ -27,56 +71,34 @@ typedef struct sweep_unit {
   bool reload;
 } sweep_unit_t;
 
-typedef struct apu {
-  // ******************** Pulse channel 1 ********************
-  struct {
-    // Duty cycle/volume parameters
-    u8 duty;
-    u8 lc_disable;
-    envelope_t env;
+typedef struct pulse {
+  // Duty cycle/volume parameters
+  u8 duty;
+  u8 lc_disable;
+  envelope_t env;
 
-    // Sweep unit
-    sweep_unit_t sweep;
+  // Sweep unit
+  sweep_unit_t sweep;
 
-    // Length counter load value/timer high
-    u8 lc_idx;
+  // Length counter load value/timer high
+  u8 lc_idx;
 
-    // Timer/frequency of output waveform
-    u16 timer;
-    u8 sweep_c;
+  // Timer/frequency of output waveform
+  u16 timer;
 
-    // Length counter
-    u8 lc;
+  // Length counter
+  u8 lc;
 
-    // Where in the output sequence the channel currently is
-    u8 seq_idx;
-    f64 seq_c;
-  } pulse1;
+  // Where in the output sequence the channel currently is, and the CPU cycle the sequencer is next clocked on
+  u8 seq_idx;
+  u32 timer_next;
+  u8 out;
+} pulse_t;
 
-  // ******************** Pulse channel 2 ********************
-  struct {
-    // Duty cycle/volume parameters
-    u8 duty;
-    u8 lc_disable;
-    envelope_t env;
-
-    // Sweep unit parameters
-    sweep_unit_t sweep;
-
-    // Length counter load value/timer high
-    u8 lc_idx;
-
-    // Timer/frequency of output waveform
-    u16 timer;
-
-    // Sweep unit
-    u8 sweep_c;
-    u8 lc;
-
-    // Where in the output sequence the channel currently is
-    u8 seq_idx;
-    f64 seq_c;
-  } pulse2;
+typedef struct apu {
+  // ******************** Pulse channels ********************
+  pulse_t pulse1;
+  pulse_t pulse2;
 
   // ******************** Triangle channel ********************
   struct {
@@ -94,9 +116,10 @@ typedef struct apu {
     u8 linc;
     bool linc_reload;
 
-    // Where in the output sequence the channel currently is
+    // Where in the output sequence the channel currently is, and the CPU cycle the sequencer is next clocked on
     u8 seq_idx;
-    f64 seq_c;
+    u32 timer_next;
+    u8 out;
   } triangle;
 
   // ******************** Noise channel ********************
@@ -114,7 +137,8 @@ typedef struct apu {
 
     u8 lc;
     u16 shift_reg;
-    f64 seq_c;
+    u32 timer_next;
+    u8 out;
   } noise;
 
   // ******************** DMC channel ********************
@@ -151,7 +175,76 @@ typedef struct apu {
 
   bool frame_interrupt;
   u64 ticks;
-  u32 buf_scale_factor;  // Basically, how many samples are generated before being added to the queue
+
+  // Channels are synthesized on a separate audio thread. nes->apu only keeps the state the CPU can see, and logs
+  // every register write and frame counter step with its time in the frame. apu_end_frame() hands the frame's log to
+  // the audio thread, which replays it through its own apu_t (synth) and synthesizes the frame's samples while the
+  // next frame is emulated. synth is NULL when there's neither an audio device nor a capture file
+  apu_t *synth;
+  apu_log_t log[APU_LOG_SLOTS];
+  apu_log_t *log_cur;           // Frame being logged
+  SDL_atomic_t log_head;        // Frames handed to the audio thread
+  SDL_sem *log_ready;           // Posted for every frame handed off
+  SDL_sem *log_free;            // Posted by the audio thread for every frame it's done with
+  SDL_Thread *synth_thread;
+
+  // audio is only set on synth, the copy that synthesizes, and nothing below is used or allocated without it. device
+  // is false when running without an audio device
+  bool audio;
+  bool device;
+
+  // Channel output is synthesized from the amplitude changes of the mixed signal. time counts CPU cycles since the
+  // start of the current audio frame, mix_level is the mixer output at that time
+  u32 time;
+  i32 mix_level;
+  blip_t blip;
+
+  // Each audio frame's samples are read out of the blip buffer into raw_buf at the internal rate, resampled to the
+  // device rate into smp_buf, then pushed onto nes->apu's smp_ring, which the SDL audio callback drains. rs_rate is
+  // the output rate rs is currently set up for, out_rate the one the drift correction asks for
+  i16 *raw_buf;
+  resampler_t rs;
+  u32 rs_rate;
+  i16 *smp_buf;
+  u32 smp_buf_len;
+  ring_t smp_ring;
+  SDL_atomic_t out_rate;
+
+  // raw_buf resampled to APU_CAPTURE_RATE for nes->audio_out
+  resampler_t cap_rs;
+  i16 *cap_buf;
+  u32 cap_buf_len;
+
+  // Number of samples we try to keep in the ring, i.e. the output latency. It starts at the requested latency and
+  // grows by one callback buffer each time the callback runs dry, up to smp_target_max. apu_wait() blocks the main
+  // thread until the callback has drained the ring down to the target, so the sound card's clock paces emulation
+  u32 smp_target;
+  u32 smp_target_max;
+  u32 last_underruns;
+  bool audio_started;
+
+  // Posted by the audio callback every time it pulls a buffer
+  SDL_sem *drained;
+
+  // The sound card's clock never exactly matches the host's, so pacing by audio alone would run emulation slightly
+  // fast or slow. Every APU_DRIFT_FRAMES frames the emulated speed is measured against the host clock (drift_ppm,
+  // positive when running fast) and the output rate is corrected by rate_adj Hz, at most 1 / APU_RATE_ADJ_DIV.
+  // fill_sum adds up the ring fill at the end of each frame to report the average latency
+  u64 drift_t0;
+  u64 drift_cycles;
+  u32 drift_frames;
+  u64 fill_sum;
+  i32 drift_ppm;
+  i32 rate_adj;
+
+  // Emulation speed the drift correction aims for, relative to the NES's. It's 1 unless emulation is locked to a
+  // display refresh rate close to the NES's frame rate, in which case speed_adj moves the output rate by the
+  // difference and rate_adj is limited to within 1 / APU_RATE_ADJ_DIV of that
+  double speed;
+  i32 speed_adj;
+
+  // Last sample handed to SDL, repeated on underrun so the output doesn't pop. Only touched by the audio callback
+  i16 cb_last_sample;
 
   SDL_AudioDeviceID device_id;
   SDL_AudioSpec audio_spec;
@@ -160,8 +253,29 @@ typedef struct apu {
 u8 apu_read(nes_t *nes, u16 addr);
 void apu_write(nes_t *nes, u16 addr, u8 val);
 
-void apu_init(nes_t *nes, u32 sample_rate, u32 buf_len);
+// With audio off no device is opened, and unless nes->audio_out is capturing, the channels aren't synthesized. Only
+// the state the CPU can observe (length counters, the frame counter and its IRQ, $4015) is kept, so emulation runs
+// exactly as it would with sound
+void apu_init(nes_t *nes, bool audio, u32 sample_rate, u32 buf_len, u32 latency_ms);
 void apu_tick(nes_t *nes);
+
+// Finishes the current audio frame and hands it to the audio thread. Called once per video frame. Only waits when
+// every log slot is still queued for the audio thread
+void apu_end_frame(nes_t *nes);
+
+// Waits for the audio thread to synthesize every frame it was handed and counts their samples, so the stats are up to
+// date. The frame being logged isn't handed off
+void apu_sync(nes_t *nes);
+
+// Blocks until the audio device has played the ring down to the latency target. Returns false without waiting if
+// audio isn't playing yet, or if the device stopped pulling samples, in which case the caller has to pace itself
+bool apu_wait(nes_t *nes);
+
+// Sets the emulation speed the audio device paces to, relative to the NES's. Only meant for small corrections
+void apu_set_speed(nes_t *nes, double speed);
+
+// Milliseconds of audio buffered for the device, -1 if there's no device
+double apu_buffered_ms(nes_t *nes);
 void apu_destroy(nes_t *nes);
 
 #endif
@@ -8,16 +8,46 @@ typedef struct args {
   // Cart parameters
   char *cart_fn;
 
-  // CPU logging parameters
+  // CPU trace parameters
   bool cpu_log_output;
-  FILE *cpu_logf;
+  char *cpu_trace_fn;
+  u32 cpu_trace_records;
+
+  // Stats dump file, stdout if NULL. Only used in CNES_STATS builds
+  char *stats_fn;
+
+  // Logging parameters
+  u8 log_level;
+  u32 log_cats;
+
+  // PPU parameters
+  bool ppu_thread;     // Rasterize on a separate thread, one frame behind emulation
+  u32 ppu_workers;     // Threads rasterizing scanlines in parallel with ppu_thread, 0 for one per CPU
+  u32 frameskip;       // Frames emulated without drawing after each drawn one
+
+  // Display parameters
+  u32 ntsc_scale;      // NTSC filter output width as a multiple of the NES picture's, 0 without the filter
+  u32 ntsc_threads;    // Threads running the NTSC filter, 0 for one per CPU
+  u32 scale;           // Window size as a multiple of the NES picture's
+  u8 filter;           // scale_filter_t upscaling the picture to the window
+  u32 filter_threads;  // Threads running the upscaling filter, 0 for one per CPU
+  bool overlay;        // Draw the performance overlay into every frame
 
   // APU parameters
+  bool apu_audio;      // False to run without sound, e.g. for batch runs
   u32 apu_buf_len;
+  u32 apu_latency_ms;  // Initial audio latency target, raised automatically on underrun
   u32 sample_rate;
+  char *apu_capture_fn;  // Audio capture file, .wav or raw PCM, NULL if not capturing
+
+  // NSF player parameters. cart_fn is the NSF file
+  bool nsf;
+  u32 nsf_song;          // 1-based, 0 for the tune's default song
+  u32 nsf_seconds;
 } args_t;
 
 void args_init(args_t *args);
+void args_parse(args_t *args, int argc, char **argv);
 void args_destroy(args_t *args);
 
 
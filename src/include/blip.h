@@ -0,0 +1,46 @@
+#ifndef CNES_BLIP_H
+#define CNES_BLIP_H
+
+#include "nes.h"
+
+// Band-limited step synthesis. Instead of rendering every output sample, sound channels report each change in their
+// amplitude as a delta at a clock time. Each delta is added to the buffer as a band-limited impulse, and the buffer is
+// integrated once per frame to produce output samples. Waveform edges land between samples instead of snapping to
+// them, so square waves don't alias, and the work done is proportional to the number of edges instead of the number
+// of samples.
+
+#define BLIP_PHASE_BITS  5                      // Sub-sample positions an edge can land on, as a power of two
+#define BLIP_PHASES      (1 << BLIP_PHASE_BITS)
+#define BLIP_WIDTH       16                     // Kernel taps per edge
+#define BLIP_KERNEL_BITS 12                     // Kernel taps are fixed point with this many fractional bits
+#define BLIP_FRAC_BITS   32                     // Sample positions are 32.32 fixed point
+
+typedef struct blip {
+  i32 *buf;       // Deltas, one slot per output sample plus room for the kernel tail
+  u32 buf_len;    // Maximum number of samples one frame may produce
+  u64 factor;     // Output samples per clock, 32.32 fixed point
+  u64 offset;     // Position of clock time 0 in the buffer, 32.32 fixed point
+  i32 integrator; // Running sum of the deltas read so far
+} blip_t;
+
+void blip_init(blip_t *blip, u32 max_samples);
+void blip_destroy(blip_t *blip);
+
+// Sets the ratio between the clock that delta times are given in and the output sample rate
+void blip_set_rates(blip_t *blip, u32 clock_rate, u32 sample_rate);
+
+// Adds an amplitude change of delta at the given clock time, relative to the start of the current frame
+void blip_add_delta(blip_t *blip, u32 time, i32 delta);
+
+// Ends the current frame at the given clock time. The next frame's clock times start at 0 again
+void blip_end_frame(blip_t *blip, u32 time);
+
+// Number of samples that can be read, after blip_end_frame()
+static inline u32 blip_samples_avail(blip_t *blip) {
+  return blip->offset >> BLIP_FRAC_BITS;
+}
+
+// Reads up to n samples and returns how many were read
+u32 blip_read_samples(blip_t *blip, i16 *out, u32 n);
+
+#endif
@@ -28,6 +28,7 @@ typedef struct cart {
   u8 fixed_mirror;  // Fixed mirroring type. This only applies to mappers with a fixed mirroring type
   u8 *prg;          // PRG ROM
   u8 *chr;          // CHR ROM/RAM
+  size_t chr_sz;
 } cart_t;
 
 void cart_init(cart_t *cart, char *cart_fn);
@@ -0,0 +1,56 @@
+#ifndef CNES_LOG_H
+#define CNES_LOG_H
+
+#include "types.h"
+
+// Asynchronous diagnostics. log_msg() captures the format string and its arguments into a fixed-size record and
+// pushes it onto a lock-free single-producer/single-consumer queue. A background thread formats the records and
+// writes them out, so console I/O never stalls emulation.
+//
+// log_msg() must only be called from the emulation thread. Before log_init() and after log_destroy() messages are
+// printed synchronously.
+
+#define LOG_QUEUE_SZ     1024  // Records in the queue, must be a power of two
+#define LOG_MAX_ARGS     8     // Maximum number of format arguments per message
+#define LOG_STR_SZ       96    // Space for copies of %s arguments in each record
+
+// Rate limiting: each call site (format string) may log LOG_RATE_BURST messages per LOG_RATE_WINDOW_MS, the rest
+// are counted and reported with the next message that gets through
+#define LOG_RATE_BURST     8
+#define LOG_RATE_WINDOW_MS 1000
+#define LOG_RATE_SLOTS     64
+
+typedef enum log_level {
+  LOG_DEBUG,
+  LOG_INFO,
+  LOG_WARN,
+  LOG_ERROR
+} log_level_t;
+
+typedef enum log_cat {
+  LOG_CAT_MAIN,    // Frontend, window and command line
+  LOG_CAT_CPU,
+  LOG_CAT_PPU,
+  LOG_CAT_APU,
+  LOG_CAT_MAPPER,  // Cartridge and mappers
+  LOG_CAT_INPUT,
+  LOG_NUM_CATS
+} log_cat_t;
+
+#define LOG_CAT_ALL ((1 << LOG_NUM_CATS) - 1)
+
+void log_init(log_level_t level, u32 cat_mask);
+void log_destroy(void);
+
+// Writes out everything that is queued. Blocks until the writer thread has caught up
+void log_flush(void);
+
+// printf-style logging. Supports the standard integer, floating point, character, string and pointer conversions;
+// '*' widths are not supported
+void log_msg(log_level_t level, log_cat_t cat, const char *fmt, ...);
+
+// Parses a level/category name as used on the command line. Returns -1 if the name is unknown
+int log_level_from_str(const char *str);
+int log_cat_from_str(const char *str);
+
+#endif
@@ -37,7 +37,12 @@ typedef struct mapper {
   void (*cpu_write)(nes_t *nes, u16 addr, u8 val);
   void (*ppu_write)(nes_t *nes, u16 addr, u8 val);
 
+  // Everything the PPU side of the mapper depends on besides CHR memory itself. The PPU render thread keeps its own
+  // copy of the mapper, so this must not live anywhere else
   mirror_type_t mirror_type;
+  u8 chr_bank0;
+  u8 chr_bank1;
+  u16 chr_banksz;  // 4K or 8K CHR window (MMC1)
 } mapper_t;
 
 void mapper_init(mapper_t *mapper, cart_t *cart);
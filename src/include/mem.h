@@ -2,6 +2,8 @@
 #define CNES_MEM_H
 
 #include "nes.h"
+#include "cpu.h"
+#include "util.h"
 
 // cpu_xxx functions deal with CPU memory
 void cpu_write8(nes_t *nes, u16 addr, u8 val);
@@ -9,10 +11,36 @@ void cpu_write16(nes_t *nes, u16 addr, u16 val);
 u8   cpu_read8(nes_t *nes, u16 addr);
 u16  cpu_read16(nes_t *nes, u16 addr);
 
+// Zero page and stack access
+// $0000-$01FF always lands in internal RAM, which has no side effects on access, so these skip the address decode
+// in cpu_read8()/cpu_write8()
+static inline u8 cpu_zp_read8(nes_t *nes, u8 addr) {
+  return nes->cpu->mem[addr];
+}
+
+static inline void cpu_zp_write8(nes_t *nes, u8 addr, u8 val) {
+  nes->cpu->mem[addr] = val;
+}
+
 // Stack operations
-void cpu_push8(nes_t *nes, u8 val);
-void cpu_push16(nes_t *nes, u16 val);
-u8   cpu_pop8(nes_t *nes);
-u16  cpu_pop16(nes_t *nes);
+static inline void cpu_push8(nes_t *nes, u8 val) {
+  nes->cpu->mem[STACK_BASE + nes->cpu->sp--] = val;
+}
+
+static inline void cpu_push16(nes_t *nes, u16 val) {
+  cpu_push8(nes, GET_BYTE_HI(val));
+  cpu_push8(nes, GET_BYTE_LO(val));
+}
+
+static inline u8 cpu_pop8(nes_t *nes) {
+  return nes->cpu->mem[STACK_BASE + ++nes->cpu->sp];
+}
+
+static inline u16 cpu_pop16(nes_t *nes) {
+  u8 lo = cpu_pop8(nes);
+  u8 hi = cpu_pop8(nes);
+
+  return lo | (hi << 8);
+}
 
 #endif
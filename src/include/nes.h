@@ -21,6 +21,9 @@ typedef struct window window_t;
 typedef struct args args_t;
 typedef struct mapper mapper_t;
 typedef struct apu apu_t;
+typedef struct trace trace_t;
+typedef struct wav wav_t;
+typedef struct nsf nsf_t;
 
 typedef struct nes {
   cpu_t *cpu;
@@ -29,6 +32,9 @@ typedef struct nes {
   args_t *args;
   mapper_t *mapper;
   apu_t *apu;
+  trace_t *trace;    // CPU trace, NULL unless tracing is enabled
+  wav_t *audio_out;  // Audio capture, NULL unless capturing
+  nsf_t *nsf;        // NSF being played, NULL when running a cartridge. There's no cart or PPU then
 
   // Controller 1 shift registers
   u8 ctrl1_sr;
@@ -41,6 +47,7 @@ typedef struct nes {
 
 void nes_init(nes_t *nes, args_t *args);
 void nes_reset(nes_t *nes);
-void nes_destroy(nes_t *nes);
+// Returns false if the audio capture lost samples
+bool nes_destroy(nes_t *nes);
 
 #endif
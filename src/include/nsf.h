@@ -0,0 +1,53 @@
+#ifndef CNES_NSF_H
+#define CNES_NSF_H
+
+#include "nes.h"
+
+// NSF music player. An NSF file is a tune's sound driver and music data without the rest of the game. The player
+// calls the tune's INIT routine once, then its PLAY routine at a fixed rate, and only the CPU and APU are emulated.
+// There's no PPU or window, so playback isn't tied to real time and is rendered straight to the audio capture file.
+// File format information from NESdev wiki
+// https://wiki.nesdev.com/w/index.php/NSF
+
+#define NSF_MAGIC      "NESM\x1a"
+#define NSF_HEADER_SZ  0x80
+#define NSF_BANK_SZ    0x1000
+#define NSF_WRAM_SZ    0x2000
+
+// INIT and PLAY return to this address, which the player watches for instead of executing it
+#define NSF_RETURN_ADDR 0x5FF0
+
+// How long INIT gets to return before the player gives up on it (one second)
+#define NSF_INIT_MAX_CYCLES NTSC_CPU_SPEED
+
+typedef struct nsf {
+  u8 n_songs;
+  u8 start_song;   // 1-based
+  u16 load_addr;
+  u16 init_addr;
+  u16 play_addr;
+  u16 speed_us;    // Microseconds between PLAY calls (NTSC)
+  u8 init_banks[8];
+
+  // Tunes that bankswitch map 4K of the image into each 4K slot of $8000-$FFFF through writes to $5FF8-$5FFF.
+  // Tunes that don't are treated as if banks 0-7 were mapped, with the image starting at the load address
+  bool banked;
+  u8 banks[8];
+  u8 *image;
+  u32 image_len;
+
+  u8 wram[NSF_WRAM_SZ];  // $6000-$7FFF
+
+  bool idle;       // Set once INIT or PLAY has returned
+} nsf_t;
+
+// Loads the NSF file named by args->cart_fn and sets up the CPU and APU to play it into nes->audio_out
+void nsf_init(nes_t *nes, args_t *args);
+
+// Renders `seconds` seconds of song number `song` (1-based, 0 for the tune's default song)
+void nsf_render(nes_t *nes, u32 song, u32 seconds);
+
+// Returns false if the audio capture lost samples
+bool nsf_destroy(nes_t *nes);
+
+#endif
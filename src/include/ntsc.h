@@ -0,0 +1,65 @@
+#ifndef CNES_NTSC_H
+#define CNES_NTSC_H
+
+#include "nes.h"
+#include "palette.h"
+
+// NTSC composite video filter. Indexed pixels are turned into the signal the PPU would put out (8 samples per pixel at
+// 12 samples per color subcarrier cycle, square waves between two levels, emphasis darkening parts of the cycle) and
+// decoded back to RGB the way a TV would, which gives the chroma/luma crosstalk and artifact colors of the real thing.
+//
+// Everything up to the final clamp is linear, so each pixel's contribution to the output around it only depends on
+// its index, emphasis bits and subcarrier phase. Those contributions are precomputed as kernels when the filter is set
+// up, and filtering a row comes down to adding one kernel per pixel into an accumulator, which is done with SIMD.
+// Rows are independent, a frame can be split across worker threads.
+
+#define NTSC_MAX_SCALE      4  // Output pixels per input pixel, 2 to 4
+#define NTSC_SAMPLES        8  // Signal samples per pixel
+#define NTSC_PHASES         3  // Pixels start on one of three subcarrier phases, 8 samples apart mod 12
+#define NTSC_KERNEL_PIXELS  3  // A pixel reaches the pixel on either side once decoded
+#define NTSC_KERNEL_LEFT    1
+#define NTSC_HUE_OFFSET     3.9  // Samples the demodulator's phase is shifted by, to get the usual hues
+
+typedef struct ntsc ntsc_t;
+
+// A thread filtering rows, with its accumulator
+typedef struct ntsc_worker {
+  ntsc_t *ntsc;
+  i16 *acc;
+  SDL_Thread *thread;
+} ntsc_worker_t;
+
+struct ntsc {
+  u32 scale;
+  u32 out_w;                    // WINDOW_W * scale
+
+  // kernel[(color * NTSC_PHASES + phase) * kernel_len ...]: for each output pixel from NTSC_KERNEL_LEFT input pixels
+  // to the left on, four channels in the byte order of an output pixel, in 1/16ths. kernel_len is padded for SIMD
+  i16 *kernel;
+  u32 kernel_len;
+  u32 acc_len;
+  u32 alpha;                    // Alpha bits of an output pixel
+  bool avx2;                    // Accumulate with AVX2, checked once at init
+
+  // Workers. workers[0] is the calling thread, the others have threads of their own
+  u32 n_workers;
+  ntsc_worker_t *workers;
+  const pixel_t *job_in;        // The job being filtered
+  u32 *job_out;
+  const u16 *job_rows;
+  u32 job_n_rows;
+  SDL_atomic_t next_row;        // Index into job_rows of the next row to hand out
+  bool quit;
+  SDL_sem *go;                  // Posted once per worker thread for every job, and on exit
+  SDL_sem *done;                // Posted by each worker thread when no rows are left
+};
+
+// Sets up the filter for scale (2 to NTSC_MAX_SCALE) output pixels per input pixel, filtering on n_threads threads (0
+// for one per CPU)
+void ntsc_init(ntsc_t *ntsc, u32 scale, u32 n_threads);
+void ntsc_destroy(ntsc_t *ntsc);
+
+// Filters the listed rows of an indexed frame. Row y of in (WINDOW_W pixels) goes to row y of out (out_w pixels)
+void ntsc_filter(ntsc_t *ntsc, const pixel_t *in, u32 *out, const u16 *rows, u32 n_rows);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef CNES_OVERLAY_H
+#define CNES_OVERLAY_H
+
+#include "nes.h"
+
+// Performance overlay: emulated FPS, the frame timing percentiles and the audio buffer fill, drawn into the top left
+// of each finished frame with a 3x5 pixel font. The text is only rebuilt every OVERLAY_UPDATE_FRAMES frames, drawing
+// it is a few hundred pixel writes plus rehashing the rows it covers.
+
+#define OVERLAY_LINES         5
+#define OVERLAY_LINE_LEN      40
+#define OVERLAY_UPDATE_FRAMES 30  // ~0.5 seconds
+#define OVERLAY_X             2   // Top left corner of the box
+#define OVERLAY_Y             2
+#define OVERLAY_GLYPH_W       3
+#define OVERLAY_GLYPH_H       5
+#define OVERLAY_FG            0x30  // System palette white
+#define OVERLAY_BG            0x0F  // and black
+
+typedef struct overlay {
+  char lines[OVERLAY_LINES][OVERLAY_LINE_LEN];
+
+  // Frames emulated since the text was last rebuilt, and when that was
+  u32 frames;
+  u64 t0;
+} overlay_t;
+
+void overlay_init(overlay_t *ov);
+
+// Counts an emulated frame and rebuilds the text if it's time. Called by the emulation thread after every frame
+void overlay_update(overlay_t *ov, nes_t *nes, window_t *wnd);
+
+// Draws the text into wnd->fb[wnd->back] and updates the hashes of the rows it covers
+void overlay_draw(const overlay_t *ov, window_t *wnd);
+
+#endif
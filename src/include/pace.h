@@ -0,0 +1,71 @@
+#ifndef CNES_PACE_H
+#define CNES_PACE_H
+
+#include "nes.h"
+#include "window.h"
+
+// Frame pacing for the emulation thread. Frames are scheduled on the performance counter at a fractional period, so
+// the NES's 60.0988 Hz doesn't get rounded to whole milliseconds or ticks, and the thread sleeps until each deadline
+// instead of polling for it.
+//
+// The clock is the audio device whenever it's playing (see apu_wait()) and the schedule otherwise. When the display
+// refreshes close enough to the NES's frame rate, emulation runs at the display's measured rate instead, so every
+// frame is shown for exactly one refresh rather than one being dropped or repeated every few seconds. The audio
+// output rate is steered to match.
+
+// Largest difference between the display's refresh rate and the NES's frame rate that emulation follows, in ppm.
+// Has to stay well inside the audio rate adjustment range (1 / APU_RATE_ADJ_DIV)
+#define PACE_VSYNC_MAX_PPM 3000
+
+// Smaller changes in the measured refresh rate are ignored, so the audio drift correction isn't restarted every time
+#define PACE_RETUNE_PPM 100
+
+// Frame times are summarized in a debug message every PACE_REPORT_FRAMES frames (~10 seconds)
+#define PACE_REPORT_FRAMES 600
+
+// A wakeup this late (in microseconds) after its deadline is counted as late
+#define PACE_LATE_US 1000
+
+typedef enum pace_clock {
+  PACE_CLOCK_TIMER,
+  PACE_CLOCK_AUDIO
+} pace_clock_t;
+
+// Frame time statistics, in performance counter ticks
+typedef struct pace_stats {
+  u64 frames;
+  double sum;
+  double sum_sq;
+  u64 min;
+  u64 max;
+  u64 late;  // Timer wakeups more than PACE_LATE_US after their deadline
+} pace_stats_t;
+
+typedef struct pace {
+  u64 freq;                     // Performance counter ticks per second
+  double hz;                    // Target frame rate
+  double period;                // Target frame period in ticks
+  bool vsync;                   // hz is the display's refresh rate
+  int vsync_period;             // The display's period hz was last set from
+
+  // The schedule: frame n is due at base + n * period
+  u64 base;
+  u64 n;
+  pace_clock_t clock;
+
+  // Time between the ends of consecutive frames, since the start and since the last report
+  u64 last_frame;
+  pace_stats_t total;
+  pace_stats_t recent;
+} pace_t;
+
+void pace_init(pace_t *pace);
+
+// Waits until the next frame is due, by the audio device or the schedule. Called by the emulation thread after each
+// frame
+void pace_frame(pace_t *pace, nes_t *nes, window_t *wnd);
+
+// Logs the frame time statistics
+void pace_destroy(pace_t *pace);
+
+#endif
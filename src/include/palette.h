@@ -0,0 +1,33 @@
+#ifndef CNES_PALETTE_H
+#define CNES_PALETTE_H
+
+#include "nes.h"
+
+// The PPU draws indexed pixels: a 6-bit system palette index with the three PPUMASK color emphasis bits above it.
+// They're converted to ARGB once per frame, and only if the frame is displayed.
+
+// Size of a palette
+#define PALETTE_SZ         64
+#define PALETTE_EMPH_SHIFT 6
+#define PALETTE_N_COLORS   (PALETTE_SZ << 3)  // Every index with every combination of emphasis bits
+
+typedef u16 pixel_t;
+
+typedef struct color {
+  u8 r;
+  u8 g;
+  u8 b;
+} color_t;
+
+typedef struct palette {
+  u32 argb[PALETTE_N_COLORS];
+  bool avx2;  // Convert with AVX2 gathers, checked once when the palette is loaded
+} palette_t;
+
+// Reads in a .pal file as the NES system palette
+void palette_load(palette_t *pal, const char *fn);
+
+// Converts n indexed pixels to ARGB32
+void palette_to_argb(const palette_t *pal, const pixel_t *in, u32 *out, u32 n);
+
+#endif
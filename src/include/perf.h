@@ -0,0 +1,46 @@
+#ifndef CNES_PERF_H
+#define CNES_PERF_H
+
+#include "nes.h"
+
+// Frame timing histograms. Each histogram is written by a single thread, which counts samples into log-scale
+// microsecond buckets and every PERF_SLOT_SAMPLES samples publishes the median, 99th percentile and maximum over the
+// last PERF_SLOTS slots of samples. Other threads only read those published values, so nothing is ever locked.
+//
+// Buckets are 1/16th of an octave wide (3-6% of the value, 1 ms between 16 and 33 ms), which keeps 16.7 and 20 ms apart,
+// and percentiles are interpolated within the bucket they fall into.
+
+#define PERF_SUB_BUCKETS  16   // Buckets per octave, every microsecond below this has a bucket of its own
+#define PERF_BUCKETS      240  // From 1 µs to ~260 ms, the last one also counts anything longer
+#define PERF_SLOTS        8    // The rolling window is PERF_SLOTS * PERF_SLOT_SAMPLES samples (~4 seconds of frames)
+#define PERF_SLOT_SAMPLES 30
+
+typedef struct perf_hist {
+  const char *name;
+
+  // Writer side. slots[slot] is being filled, the others hold the rest of the rolling window
+  u32 slots[PERF_SLOTS][PERF_BUCKETS];
+  u32 slot_max[PERF_SLOTS];
+  u32 slot;
+  u32 slot_n;
+
+  // Every sample since perf_init(), for the summary at exit
+  u64 total[PERF_BUCKETS];
+  u64 total_n;
+  u32 total_max;
+
+  // The rolling window's percentiles, in µs, readable from any thread
+  SDL_atomic_t p50;
+  SDL_atomic_t p99;
+  SDL_atomic_t max;
+} perf_hist_t;
+
+void perf_init(perf_hist_t *hist, const char *name);
+
+// Records a sample of the given number of performance counter ticks. Only called by the histogram's writer
+void perf_add(perf_hist_t *hist, u64 ticks);
+
+// Logs the percentiles over every sample. The writer has to be done, or be the caller
+void perf_log_total(const perf_hist_t *hist);
+
+#endif
@@ -2,6 +2,9 @@
 #define CNES_PPU_H
 
 #include "nes.h"
+#include "cart.h"
+#include "mappers.h"
+#include "window.h"
 
 #define PPUCTRL_VRAM_INC_BIT      2
 #define PPUCTRL_SPR_PT_BASE_BIT   3
@@ -27,8 +30,7 @@
 // Size of total PPU internal memory (2kB)
 //#define PPU_VRAM_SZ   0x1000
 
-// Size of a palette
-#define PALETTE_SZ   64
+// Palette RAM
 #define PALETTE_BASE 0x3F00
 
 // 262 scanlines per frame: 1 pre-render, 240 visible, 1 post-render, and 20 vblank lines.
@@ -37,6 +39,7 @@
 #define NUM_SCANLINES     262
 #define DOTS_PER_SCANLINE 341
 
+#define OAM_SZ          0x100
 #define OAM_NUM_SPR     64
 #define SEC_OAM_NUM_SPR 8
 
@@ -51,28 +54,88 @@ typedef enum ppureg {
   PPUDATA     // $2007: PPU VRAM data register (read, write)
 } ppureg_t;
 
-typedef struct color {
-  u8 r;
-  u8 g;
-  u8 b;
-} color_t;
+// A single OAM entry. The field order matches the byte order of the entry in OAM
+typedef struct oam_sprite {
+  u8 y_pos;     // Y position of the
+  u8 tile_idx;  // Index into the sprite pattern table
+  u8 attr;      // Sprite attributes: lower 2 color bits, flipping,
+  u8 x_pos;     // X position of the left of the sprite
+} oam_sprite_t;
 
 typedef struct sprite {
-  struct {
-    u8 y_pos;     // Y position of the
-    u8 tile_idx;  // Index into the sprite pattern table
-    u8 attr;      // Sprite attributes: lower 2 color bits, flipping,
-    u8 x_pos;     // X position of the left of the sprite
-  } data;
+  oam_sprite_t data;
 
   bool sprite0;   // Set to true if this sprite triggers sprite zero hit
 } sprite_t;
 
+// ******** PPU render thread ********
+// With args->ppu_thread set, pixels are rasterized on a separate thread one frame behind emulation. The emulation
+// thread runs the PPU without drawing, which keeps everything the CPU can see exact: VBlank and NMI timing, v/t and
+// the PPUDATA read buffer. Sprite zero hit depends on pixels, so the dots where sprite 0 overlaps the current pixel are
+// still rendered there, just not stored.
+//
+// Everything that changes what gets drawn is logged with the dot it happened on: register writes, the PPUSTATUS and
+// PPUDATA reads that have side effects, OAM DMA and mapper (mirroring and CHR bank) changes. At the end of each frame
+// the log is handed to the render thread, which replays it through its own PPU, CHR memory and mapper.
+
+// With args->ppu_workers > 1, the render thread splits the visible scanlines across a pool of threads. A first pass
+// replays the frame up to the end of the visible lines without drawing, saving the PPU and mapper at the start of every
+// line. Each line then only depends on that state and the records logged during it, so the lines are rasterized in
+// parallel. This needs VRAM to stay the same while they're drawn: frames with PPUDATA writes during the visible lines
+// are rasterized in order as before.
+
+// Initial size of each frame's log. Logs grow as needed, a typical frame has a few hundred records
+#define PPU_LOG_INIT_SZ      1024
+#define PPU_LOG_INIT_DATA_SZ (4 * OAM_SZ)
+
+typedef enum ppu_log_kind {
+  PPU_LOG_REG_WRITE,  // addr = register, val
+  PPU_LOG_REG_READ,   // addr = register
+  PPU_LOG_OAM,        // addr = OAM address, val
+  PPU_LOG_OAM_PAGE,   // All of OAM, stored in the frame's data
+  PPU_LOG_MAPPER      // A copy of the mapper, stored in the frame's data
+} ppu_log_kind_t;
+
+typedef struct ppu_log_rec {
+  u32 dot;  // PPU cycles since the start of the frame
+  u8 kind;
+  u8 addr;
+  u8 val;
+} ppu_log_rec_t;
+
+typedef struct ppu_log {
+  ppu_log_rec_t *recs;
+  u32 n;
+  u32 cap;
+
+  // Payloads of PPU_LOG_OAM_PAGE and PPU_LOG_MAPPER records, in the order of the records
+  u8 *data;
+  u32 data_len;
+  u32 data_cap;
+
+  u32 dots;  // Length of the frame in PPU cycles, set when it is handed off
+  bool draw; // False if the frame is only replayed to keep the render thread's state, not rasterized
+} ppu_log_t;
+
+// A position in a frame's log: the PPU cycle reached, the next record and the next payload byte
+typedef struct ppu_replay_pos {
+  u32 dot;
+  u32 rec;
+  u32 data_pos;
+} ppu_replay_pos_t;
+
+typedef struct ppu_render ppu_render_t;
+
 typedef struct ppu {
   // PPU memory
   u8 reg[NUM_PPUREGS];         // PPU internal registers
-  sprite_t oam[OAM_NUM_SPR];    // PPU Object Attribute Memory. Stores 64 sprites for the whole frame
-  u32 palette[PALETTE_SZ];      // System-wide palette is 64 ARGB colors
+
+  // PPU Object Attribute Memory. Stores 64 sprites for the whole frame. OAMDATA and OAM DMA write the raw bytes,
+  // rendering reads them through the sprite view
+  union {
+    u8 oam[OAM_SZ];
+    oam_sprite_t oam_spr[OAM_NUM_SPR];
+  };
 
   // PPU secondary OAM. Stores 8 sprites for the current scanline
   sprite_t sec_oam[SEC_OAM_NUM_SPR];
@@ -89,8 +152,71 @@ typedef struct ppu {
   u8 scroll_x;                  // TODO: This shouldn't be necessary
 
   u64 ticks;                    // Number of PPU cycles
+
+  // Phase of the write-twice registers (PPUADDR & PPUSCROLL), and the PPUDATA read buffer
+  bool write_toggle;
+  u8 read_buf;
+
+  // Set in fill_sec_oam() when sprite 0 is on the current scanline
+  bool spr0_on_line;
+
+  // render is the render thread on the emulation side, NULL without one. replica is set on the render thread's own
+  // PPU, which never signals the CPU or logs
+  ppu_render_t *render;
+  bool replica;
 } ppu_t;
 
+// The render PPU and mapper at the first dot of a visible scanline, and where the line starts in the log
+typedef struct ppu_line_start {
+  ppu_replay_pos_t pos;
+  ppu_t ppu;
+  mapper_t mapper;
+} ppu_line_start_t;
+
+// A thread rasterizing scanlines, with its own PPU and mapper to replay them through
+typedef struct ppu_line_worker {
+  ppu_render_t *render;
+  nes_t nes;
+  ppu_t ppu;
+  mapper_t mapper;
+  SDL_Thread *thread;
+} ppu_line_worker_t;
+
+struct ppu_render {
+  // The render thread's view of the NES: its own PPU, CHR memory and mapper, and no CPU
+  nes_t nes;
+  ppu_t ppu;
+  cart_t cart;
+  mapper_t mapper;
+
+  // Frame n is logged into log[n & 1] and rasterized into fb[n & 1]. The emulation thread waits for frame n - 1 to be
+  // rasterized before it starts logging frame n + 1, so two of each are enough
+  ppu_log_t log[2];
+  ppu_log_t *log_cur;
+  u64 frame_start;              // ppu->ticks at the start of the frame being logged
+  frame_t fb[2];
+
+  // Last mapper state logged, mapper writes that don't change it aren't logged
+  mapper_t mapper_logged;
+
+  SDL_atomic_t frames;          // Frames handed to the render thread
+  SDL_sem *ready;               // Posted for every frame handed off
+  SDL_sem *done;                // Posted by the render thread for every frame it has rasterized
+  SDL_Thread *thread;
+
+  // Scanline workers. workers[0] is the render thread itself, the others have threads of their own. lines is NULL with
+  // a single worker
+  u32 n_workers;
+  ppu_line_worker_t *workers;
+  ppu_line_start_t *lines;
+  ppu_log_t *lines_log;         // The frame being rasterized and where to
+  frame_t *lines_fb;
+  SDL_atomic_t next_line;       // Next scanline to hand out
+  bool lines_quit;
+  SDL_sem *lines_go;            // Posted once per worker thread for every frame, and on exit
+  SDL_sem *lines_done;          // Posted by each worker thread when no lines are left
+};
+
 // PPU register access
 // These functions can be thought of as an interface between the CPU and PPU
 u8 ppu_reg_read(nes_t *nes, ppureg_t reg);
@@ -100,11 +226,28 @@ void ppu_reg_write(nes_t *nes, ppureg_t reg, u8 val);
 u8 ppu_read(nes_t *nes, u16 addr);
 void ppu_write(nes_t *nes, u16 addr, u8 val);
 
+// OAM DMA. ppu_oam_write() stores one byte, ppu_oam_page_written() is called after all of OAM was replaced at once
+void ppu_oam_write(nes_t *nes, u8 addr, u8 val);
+void ppu_oam_page_written(nes_t *nes);
+
+// Called after every mapper register write, so the render thread sees mirroring and CHR bank changes
+void ppu_mapper_written(nes_t *nes);
+
 void ppu_init(nes_t *nes);
-void ppu_tick(nes_t *nes, window_t *wnd, void *pixels);
+
+// Emulates one PPU cycle. frame is where the pixels and row hashes go, unused with a render thread
+void ppu_tick(nes_t *nes, window_t *wnd, frame_t *frame);
+
+// Hands the frame just emulated to the render thread, to be rasterized if draw is set. Returns the previous frame's
+// pixels once they're rasterized, or NULL if there isn't a previous frame or it wasn't drawn. Only used with a render
+// thread
+frame_t *ppu_end_frame(nes_t *nes, bool draw);
 void ppu_destroy(nes_t *nes);
 
 // PPU utility functions
 bool ppu_rendering_enabled(ppu_t *ppu);
 
+// Hashes a row of WINDOW_W pixels, as stored in frame_t.row_hash
+u64 ppu_row_hash(const pixel_t *row);
+
 #endif
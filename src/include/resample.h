@@ -0,0 +1,43 @@
+#ifndef CNES_RESAMPLE_H
+#define CNES_RESAMPLE_H
+
+#include "nes.h"
+
+// Converts a block of samples from the APU's internal rate to the audio device's rate with a polyphase FIR filter,
+// after running it through the NES's analog output filters (two high-passes at 90 Hz and 440 Hz and a low-pass at
+// 14 kHz). The conversion ratio can be changed between blocks, which is how the audio rate is steered.
+
+#define RS_PHASE_BITS  6                    // Sub-sample positions the kernel is tabulated for, as a power of two
+#define RS_PHASES      (1 << RS_PHASE_BITS)
+#define RS_TAPS        32                   // Kernel taps per output sample, a multiple of 16 for the SIMD paths
+#define RS_KERNEL_BITS 14                   // Kernel taps are fixed point with this many fractional bits
+#define RS_FRAC_BITS   32                   // Input positions are 32.32 fixed point
+#define RS_FILTER_BITS 8                    // Extra precision the output filters keep between samples
+
+typedef struct resampler {
+  i16 *buf;     // Filtered input samples that haven't been fully consumed
+  u32 buf_len;  // Capacity of buf
+  u32 avail;    // Samples in buf
+  u64 pos;      // Input position of the next output sample, relative to buf[0], 32.32 fixed point
+  u64 step;     // Input samples per output sample, 32.32 fixed point
+  bool avx2;    // Take the dot products with AVX2, checked once at init
+
+  // Output filter coefficients (16.16 fixed point) and state (samples with RS_FILTER_BITS extra fractional bits)
+  i32 hp90_a, hp440_a, lp14k_b;
+  i32 hp90_x, hp90_y;
+  i32 hp440_x, hp440_y;
+  i32 lp14k_y;
+} resampler_t;
+
+// max_in is the most samples one resample_process() call will be given, in_rate is used for the output filters
+void resample_init(resampler_t *rs, u32 max_in, u32 in_rate);
+void resample_destroy(resampler_t *rs);
+
+// Sets the conversion ratio. Rates only matter relative to each other so fractional rates can be scaled up
+void resample_set_ratio(resampler_t *rs, u64 in_rate, u64 out_rate);
+
+// Filters and consumes n_in input samples and writes up to max_out output samples. Returns how many were written.
+// Input that didn't produce output yet is kept for the next call
+u32 resample_process(resampler_t *rs, const i16 *in, u32 n_in, i16 *out, u32 max_out);
+
+#endif
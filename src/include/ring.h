@@ -0,0 +1,41 @@
+#ifndef CNES_RING_H
+#define CNES_RING_H
+
+#include "nes.h"
+
+// Lock-free single-producer/single-consumer ring of 16-bit samples. One thread may call ring_write() and one other
+// thread may call ring_read(); neither ever blocks. Everything else is safe to call from either side.
+typedef struct ring {
+  i16 *buf;
+  u32 mask;  // Capacity - 1, capacity is a power of two
+
+  // Free-running sample counts, masked when indexing buf. head is only written by the producer, tail only by the
+  // consumer
+  SDL_atomic_t head;
+  SDL_atomic_t tail;
+
+  // Times the consumer asked for more samples than there were, and samples the producer dropped because the ring
+  // was full
+  SDL_atomic_t underruns;
+  SDL_atomic_t overruns;
+} ring_t;
+
+void ring_init(ring_t *ring, u32 capacity);
+void ring_destroy(ring_t *ring);
+
+// Writes up to n samples and returns how many fit. Whatever didn't fit is counted as overrun
+u32 ring_write(ring_t *ring, const i16 *src, u32 n);
+
+// Reads up to n samples and returns how many were available. A short read is counted as an underrun
+u32 ring_read(ring_t *ring, i16 *dst, u32 n);
+
+// Number of samples waiting to be read
+static inline u32 ring_fill(ring_t *ring) {
+  return (u32) SDL_AtomicGet(&ring->head) - (u32) SDL_AtomicGet(&ring->tail);
+}
+
+static inline u32 ring_capacity(ring_t *ring) {
+  return ring->mask + 1;
+}
+
+#endif
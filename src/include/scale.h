@@ -0,0 +1,63 @@
+#ifndef CNES_SCALE_H
+#define CNES_SCALE_H
+
+#include "nes.h"
+
+// CPU upscaling filters, run on ARGB frames before they're uploaded. Each input row turns into scale output rows that
+// only depend on the input rows up to reach away from it, so a frame's changed rows can be filtered on their own and
+// split across worker threads.
+
+#define SCALE_MAX 4  // Largest scale factor
+
+typedef enum scale_filter {
+  SCALE_NEAREST,    // Done by the renderer when it stretches the texture to the window, no CPU pass
+  SCALE_SCANLINES,  // Nearest neighbour with every scale'th output row at half brightness
+  SCALE_SCALEX,     // AdvMAME Scale2x/Scale3x edge smoothing
+  SCALE_XBR,        // Hyllian's xBR (level 2): finds edges by colour distance over a 5x5 area and blends along them
+  SCALE_NUM_FILTERS
+} scale_filter_t;
+
+typedef struct scaler scaler_t;
+
+typedef struct scale_worker {
+  scaler_t *scaler;
+  SDL_Thread *thread;
+
+  // xBR: the input rows around the one being filtered, with the edge pixels repeated outwards, and their YUV
+  u32 *xbr_px;
+  u32 *xbr_yuv;
+} scale_worker_t;
+
+struct scaler {
+  scale_filter_t filter;
+  u32 scale;
+  u32 out_w;                    // WINDOW_W * scale
+  u32 reach;                    // Input rows above and below a row that its output depends on
+
+  // Workers. workers[0] is the calling thread, the others have threads of their own
+  u32 n_workers;
+  scale_worker_t *workers;
+  const u32 *job_in;            // The job being filtered
+  u32 *job_out;
+  const u16 *job_rows;
+  u32 job_n_rows;
+  SDL_atomic_t next_row;        // Index into job_rows of the next row to hand out
+  bool quit;
+  SDL_sem *go;                  // Posted once per worker thread for every job, and on exit
+  SDL_sem *done;                // Posted by each worker thread when no rows are left
+};
+
+// Sets up filter at scale output pixels per input pixel each way, filtering on n_threads threads (0 for one per CPU).
+// Not for SCALE_NEAREST, which needs no scaler
+void scale_init(scaler_t *scaler, scale_filter_t filter, u32 scale, u32 n_threads);
+void scale_destroy(scaler_t *scaler);
+
+// Filters the listed rows of an ARGB frame. Row y of in (WINDOW_W pixels) goes to rows y * scale on of out (out_w
+// pixels each). Rows within reach of the listed ones must be up to date in in
+void scale_frame(scaler_t *scaler, const u32 *in, u32 *out, const u16 *rows, u32 n_rows);
+
+// Filter names as used on the command line. scale_filter_from_str returns -1 if the name is unknown
+const char *scale_filter_name(scale_filter_t filter);
+int scale_filter_from_str(const char *str);
+
+#endif
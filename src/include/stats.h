@@ -0,0 +1,63 @@
+#ifndef CNES_STATS_H
+#define CNES_STATS_H
+
+#include "nes.h"
+
+// Hot-path counters, only compiled in when CNES_STATS is defined (cmake -DCNES_STATS=ON). Without it every STAT_*
+// macro expands to nothing and its arguments are never evaluated.
+//
+// The counters are dumped as JSON when the NES is destroyed, and on SIGUSR1 where that is available.
+
+typedef enum stats_ppu_region {
+  STATS_PPU_PATTERN,    // $0000-$1FFF
+  STATS_PPU_NAMETABLE,  // $2000-$3EFF
+  STATS_PPU_PALETTE,    // $3F00-$3FFF
+  STATS_PPU_NUM_REGIONS
+} stats_ppu_region_t;
+
+typedef struct stats {
+  // CPU
+  u64 opcodes[256];      // Instructions dispatched, per opcode
+  u64 oam_dma_cycles;    // Cycles the CPU was suspended for OAM DMA
+  u64 intr_cycles[3];    // Cycles spent in interrupt sequences, indexed by interrupt_t
+
+  // PPU
+  u64 ppu_reads[STATS_PPU_NUM_REGIONS];
+
+  // Mapper
+  u64 mapper_cpu_writes;
+  u64 mapper_bank_switches;
+
+  // APU samples synthesized at NTSC_CPU_SPEED / APU_SAMPLE_DIV, with or without an audio device
+  u64 apu_samples;
+} stats_t;
+
+#ifdef CNES_STATS
+
+extern stats_t stats;
+
+#define STAT_INC(counter) (stats.counter++)
+#define STAT_ADD(counter, n) (stats.counter += (n))
+#define STATS_PPU_REGION(addr) \
+  (((addr) & 0x3FFF) < 0x2000 ? STATS_PPU_PATTERN : ((addr) & 0x3FFF) < 0x3F00 ? STATS_PPU_NAMETABLE : STATS_PPU_PALETTE)
+
+// Installs the dump signal handler. Counters are written to fn, or stdout if fn is NULL
+void stats_init(char *fn);
+
+// Dumps the counters if a dump was requested by signal. Called once per frame
+void stats_poll(nes_t *nes);
+
+void stats_dump(nes_t *nes);
+
+#else
+
+#define STAT_INC(counter) ((void) 0)
+#define STAT_ADD(counter, n) ((void) 0)
+
+#define stats_init(fn) ((void) 0)
+#define stats_poll(nes) ((void) 0)
+#define stats_dump(nes) ((void) 0)
+
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef CNES_TRACE_H
+#define CNES_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "types.h"
+
+// Binary CPU trace. Each executed instruction is stored as a fixed-size record in a ring file that is memory mapped
+// while the emulator runs, so nothing gets formatted while emulating. tools/trace2log.c turns a trace file into
+// nestest-style text.
+//
+// File layout: one trace_header_t followed by `capacity` trace_rec_t records. Once more than `capacity` records have
+// been written the ring wraps around and the oldest record is at index count % capacity.
+#define TRACE_MAGIC           "CNESTRC"
+#define TRACE_VERSION         1
+#define TRACE_DEFAULT_RECORDS (1 << 20)
+
+// trace_rec_t flags
+#define TRACE_FLAG_NMI        0x01  // Instruction is the first one after an NMI
+#define TRACE_FLAG_OAM_DMA    0x02  // OAM DMA was pending when the instruction was fetched
+
+typedef struct trace_header {
+  char magic[8];    // Should be exactly TRACE_MAGIC
+  u32 version;      // TRACE_VERSION
+  u32 rec_sz;       // sizeof(trace_rec_t)
+  u64 capacity;     // Number of records in the ring, always a power of two
+  u64 count;        // Total number of records written
+  u8 padding[32];   // Extra padding so the header is 64 bytes
+} trace_header_t;
+
+typedef struct trace_rec {
+  u64 cycle;        // CPU cycle the instruction was fetched on
+  u16 pc;           // Address of the opcode
+  u16 scanline;     // PPU position
+  u16 dot;
+  u16 ind_addr;     // Pointer fetched by indirect addressing modes
+  u8 opcode;
+  u8 operand[2];    // The two bytes following the opcode, whether the instruction uses them or not
+  u8 a;
+  u8 x;
+  u8 y;
+  u8 p;
+  u8 sp;
+  u8 mode;          // addrmode_t of the opcode
+  u8 mem_val;       // Value at the effective address, if it could be read without side effects
+  u8 flags;         // TRACE_FLAG_xxx
+  u8 padding[5];    // Extra padding so records are 32 bytes
+} trace_rec_t;
+
+typedef struct trace {
+  trace_header_t *header;
+  trace_rec_t *recs;
+  u64 mask;         // capacity - 1
+
+  // Backing file
+  char *fn;
+  int fd;
+  size_t map_sz;
+} trace_t;
+
+void trace_open(trace_t *trace, char *fn, u32 n_records);
+void trace_close(trace_t *trace);
+
+// Returns the next record slot to fill in, overwriting the oldest record when the ring is full
+static inline trace_rec_t *trace_next(trace_t *trace) {
+  return &trace->recs[trace->header->count++ & trace->mask];
+}
+
+#endif
@@ -15,6 +15,13 @@
 #define SET_BYTE_HI(dest, byte) ((dest) = (((dest) & ~0xFF00) | ((byte) << 8)))
 
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+// Functions marked CNES_AVX2 are compiled for AVX2 whatever the build flags are, so the default build still has the
+// fast paths. They may only be called if SDL_HasAVX2()
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CNES_AVX2 __attribute__((target("avx2")))
+#endif
 
 // Math helper functions
 i32 ones_complement(i32 num);
@@ -23,6 +30,7 @@ i32 twos_complement(i32 num);
 // Memory helper functions
 void *nes_malloc(size_t sz);
 void *nes_calloc(size_t count, size_t sz);
+void *nes_realloc(void *ptr, size_t sz);
 
 // Filesystem helper functions
 FILE *nes_fopen(char *fn, char *mode);
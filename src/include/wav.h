@@ -0,0 +1,44 @@
+#ifndef CNES_WAV_H
+#define CNES_WAV_H
+
+#include "nes.h"
+#include "ring.h"
+
+// Audio capture to disk. Samples are queued on a ring and written out by a separate thread, so a slow disk never
+// holds up emulation. Files ending in .wav get a 16-bit mono RIFF header, anything else is written as raw little
+// endian PCM.
+
+// Capture ring size in samples (~22 seconds at 48 kHz). When emulation is paced by a real-time audio device and the
+// disk stalls for longer than that, samples are dropped and counted as overruns. Without one, wav_write() waits for the
+// disk instead
+#define WAV_RING_SZ (1 << 20)
+
+// Samples the writer thread converts and writes at a time
+#define WAV_CHUNK_SZ 4096
+
+typedef struct wav {
+  FILE *f;
+  bool riff;         // Write a RIFF header, patched with the final sizes on close
+  bool block;        // wav_write() waits for room instead of dropping samples
+  u32 sample_rate;
+  u64 n_written;     // Samples written to disk, only touched by the writer thread
+
+  ring_t ring;
+  SDL_sem *wake;     // Posted by wav_write() after queueing samples
+  SDL_sem *space;    // Posted by the writer thread after freeing room while wav_write() is waiting
+  SDL_atomic_t waiting;
+  SDL_atomic_t running;
+  SDL_Thread *thread;
+} wav_t;
+
+// Opens fn for capture. With block set, wav_write() waits for the disk rather than dropping samples, which is what
+// anything not running against a real-time audio device wants
+void wav_open(wav_t *wav, char *fn, u32 sample_rate, bool block);
+
+// Queues n samples for writing. Only blocks if the wav was opened with block set and the ring is full
+void wav_write(wav_t *wav, const i16 *samples, u32 n);
+
+// Writes out everything still queued and closes the file. Returns false if any samples were dropped
+bool wav_close(wav_t *wav);
+
+#endif
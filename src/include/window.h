@@ -2,21 +2,125 @@
 #define CNES_WINDOW_H
 
 #include "nes.h"
+#include "palette.h"
+#include "ntsc.h"
+#include "scale.h"
+#include "perf.h"
+#include "overlay.h"
 
 #define WINDOW_W 256
 #define WINDOW_H 240
 
+// NTSC NES frame rate in Hz
+#define NTSC_FRAME_RATE 60.0988
+
+// An indexed frame, with a hash of each row so the presenter only uploads rows that changed
+typedef struct frame {
+  pixel_t px[WINDOW_W * WINDOW_H];
+  u64 row_hash[WINDOW_H];
+} frame_t;
+
+// Emulation and presentation run on different threads, so vsync and driver stalls don't hold up emulation. Finished
+// frames go through three indexed framebuffers: the emulation thread draws into fb[back], the presenter converts and
+// shows fb[front], and the newest finished frame waits in the third until the presenter takes it. latest holds the
+// index of that third buffer, with WINDOW_FB_FRESH set until it's taken. Swapping is a single atomic exchange on
+// either side, neither thread ever waits for the other
+#define WINDOW_FB_FRESH 4
+
+// How long the presenter waits for a new frame, so events keep being handled when none comes. Nothing is presented
+// when it times out
+#define WINDOW_PRESENT_TIMEOUT_MS 20
+
+// Refreshes averaged into each measurement of the display's refresh period (~2 seconds)
+#define WINDOW_REFRESH_SAMPLES 120
+
 typedef struct window {
   SDL_Window *disp_window;
   SDL_Renderer *renderer;
   SDL_Texture *texture;
 
+  // System palette, and the indexed framebuffers
+  palette_t palette;
+  frame_t fb[3];
+  int back;                     // Only used by the emulation thread
+  int front;                    // Only used by the presenter
+  SDL_atomic_t latest;
+  SDL_sem *frame_posted;        // Posted for every finished frame
+
+  // Presenter side: the row hashes of what's in the texture, valid once a whole frame was uploaded, and rows converted
+  // to ARGB for uploading. redraw is set when the window has to be presented again even if nothing changed, e.g.
+  // after it was exposed or resized
+  u64 tex_hash[WINDOW_H];
+  bool tex_valid;
+  bool redraw;
+  u32 *argb;                    // tex_w * WINDOW_H
+
+  // The NTSC filter or an upscaling filter, NULL if not used. The upscaler turns argb into scaled, and the texture is
+  // tex_w by tex_h either way. time_filtered is the presenter's time spent converting and filtering frames
+  ntsc_t *ntsc;
+  scaler_t *scaler;
+  u32 *scaled;
+  u32 tex_w;
+  u32 tex_h;
+  const char *filter_name;
+  u64 time_filtered;
+
   // Set to true when the frame is done rendering
   bool frame_ready;
+
+  // Set before window_draw_frame() to emulate the next frame without drawing or displaying it. Everything the CPU can
+  // see, sprite zero hit included, stays exact
+  bool skip_render;
+
+  // Frames emulated and the time spent on them (in performance counter ticks), drawn or not
+  u64 frames_drawn;
+  u64 frames_skipped;
+  u64 time_drawn;
+  u64 time_skipped;
+
+  // Finished frames replaced by a newer one before the presenter got to them. Counted by the emulation thread
+  u64 frames_dropped;
+
+  // Counted by the presenter: new frames presented, new frames identical to the one shown (not presented), waits that
+  // ended without a new frame (timeouts), and rows uploaded to the texture
+  u64 frames_presented;
+  u64 frames_unchanged;
+  u64 present_timeouts;
+  u64 rows_uploaded;
+
+  // Display refresh rate from the display mode, 0 if unknown or presents aren't synced to it. The presenter measures
+  // the actual period from vsynced presents and publishes it in vsync_period, in performance counter ticks (0 until
+  // known), for the emulation thread to pace itself to
+  int refresh_hz;
+  u64 last_present;
+  u64 present_sum;
+  u32 present_n;
+  SDL_atomic_t vsync_period;
+
+  // Frame timings: emulating a frame, handing its audio over, presenting and the time between frame ends. The
+  // presenter records perf_present, the emulation thread the others
+  perf_hist_t perf_emu;
+  perf_hist_t perf_audio;
+  perf_hist_t perf_present;
+  perf_hist_t perf_frame;
+
+  // Drawn into every finished frame if show_overlay is set. Only used by the emulation thread
+  bool show_overlay;
+  overlay_t overlay;
 } window_t;
 
-void window_init(window_t *wnd);
+void window_init(window_t *wnd, args_t *args);
+
+// Emulates a frame and, unless it's skipped, hands it to the presenter. Called on the emulation thread
 void window_draw_frame(window_t *wnd, nes_t *nes);
+
+// Shows the newest finished frame, waiting up to WINDOW_PRESENT_TIMEOUT_MS for one. Only the rows that changed are
+// uploaded, and nothing is presented if none did. Called on the thread the window was created on, which can't log
+// while the emulation thread runs
+void window_present(window_t *wnd);
+
+// Makes the next window_present() upload and present the whole frame
+void window_redraw(window_t *wnd);
 void window_destroy(window_t *wnd);
 
 #endif
@@ -0,0 +1,472 @@
+#include "include/log.h"
+#include "include/util.h"
+
+#include <stddef.h>
+
+static const char *LOG_LEVEL_NAMES[] = {"debug", "info", "warn", "error"};
+static const char *LOG_CAT_NAMES[LOG_NUM_CATS] = {"main", "cpu", "ppu", "apu", "mapper", "input"};
+
+typedef union log_arg {
+  i64 i;
+  u64 u;
+  f64 f;
+  const void *p;
+  u32 str_off;  // Offset of a copied %s argument in log_rec_t.str
+} log_arg_t;
+
+// One queued message. The format string is stored by pointer, so it must outlive the logger (in practice, every
+// format string is a literal)
+typedef struct log_rec {
+  const char *fmt;
+  u32 ticks;
+  u32 suppressed;  // Messages from the same call site dropped by the rate limiter since the last one was logged
+  u8 level;
+  u8 cat;
+  log_arg_t args[LOG_MAX_ARGS];
+  char str[LOG_STR_SZ];
+} log_rec_t;
+
+// Rate limiter state for one call site
+typedef struct log_site {
+  const char *fmt;
+  u32 window_start;
+  u32 count;
+  u32 suppressed;
+} log_site_t;
+
+typedef struct logger {
+  log_rec_t recs[LOG_QUEUE_SZ];
+
+  // head is only written by the producer, tail only by the writer thread. Both count up forever and are masked
+  // when indexing recs
+  SDL_atomic_t head;
+  SDL_atomic_t tail;
+
+  // Set by the writer thread before it goes to sleep, so the producer only touches the semaphore when it has to
+  SDL_atomic_t sleeping;
+  SDL_atomic_t running;
+  SDL_sem *wake;
+  SDL_Thread *thread;
+
+  // Producer-side state
+  u32 dropped;
+  log_site_t sites[LOG_RATE_SLOTS];
+} logger_t;
+
+static logger_t *logger;
+static log_level_t log_min_level = LOG_INFO;
+static u32 log_cat_mask = LOG_CAT_ALL;
+
+// Length modifiers we care about. Everything is widened to 64 bits when the message is captured
+typedef enum log_len {
+  LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_Z, LEN_J, LEN_T, LEN_BIG_L
+} log_len_t;
+
+// Parses one conversion spec starting right after the '%'. Returns a pointer to the conversion character and
+// stores the length modifier in *len
+static const char *log_parse_spec(const char *p, log_len_t *len) {
+  while (*p && strchr("-+ #0", *p))
+    p++;
+  while (*p >= '0' && *p <= '9')
+    p++;
+  if (*p == '.') {
+    p++;
+    while (*p >= '0' && *p <= '9')
+      p++;
+  }
+
+  *len = LEN_NONE;
+  switch (*p) {
+    case 'h':
+      *len = p[1] == 'h' ? LEN_HH : LEN_H;
+      p += p[1] == 'h' ? 2 : 1;
+      break;
+    case 'l':
+      *len = p[1] == 'l' ? LEN_LL : LEN_L;
+      p += p[1] == 'l' ? 2 : 1;
+      break;
+    case 'z':
+      *len = LEN_Z;
+      p++;
+      break;
+    case 'j':
+      *len = LEN_J;
+      p++;
+      break;
+    case 't':
+      *len = LEN_T;
+      p++;
+      break;
+    case 'L':
+      *len = LEN_BIG_L;
+      p++;
+      break;
+  }
+
+  return p;
+}
+
+// Pulls the arguments described by fmt off the va_list and into rec
+static void log_capture(log_rec_t *rec, const char *fmt, va_list ap) {
+  u32 n_args = 0, str_used = 0;
+
+  for (const char *p = fmt; *p; p++) {
+    if (*p != '%')
+      continue;
+    if (p[1] == '%') {
+      p++;
+      continue;
+    }
+
+    log_len_t len;
+    p = log_parse_spec(p + 1, &len);
+    if (!*p)
+      break;
+    if (n_args == LOG_MAX_ARGS)
+      crash_and_burn("log_msg: too many arguments in \"%s\"\n", fmt);
+
+    log_arg_t *arg = &rec->args[n_args++];
+    switch (*p) {
+      case 'd':
+      case 'i':
+        switch (len) {
+          case LEN_HH: arg->i = (signed char) va_arg(ap, int); break;
+          case LEN_H: arg->i = (short) va_arg(ap, int); break;
+          case LEN_L: arg->i = va_arg(ap, long); break;
+          case LEN_LL: arg->i = va_arg(ap, long long); break;
+          case LEN_Z: arg->i = (i64) va_arg(ap, size_t); break;
+          case LEN_J: arg->i = va_arg(ap, intmax_t); break;
+          case LEN_T: arg->i = va_arg(ap, ptrdiff_t); break;
+          default: arg->i = va_arg(ap, int); break;
+        }
+        break;
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        switch (len) {
+          case LEN_HH: arg->u = (unsigned char) va_arg(ap, unsigned); break;
+          case LEN_H: arg->u = (unsigned short) va_arg(ap, unsigned); break;
+          case LEN_L: arg->u = va_arg(ap, unsigned long); break;
+          case LEN_LL: arg->u = va_arg(ap, unsigned long long); break;
+          case LEN_Z: arg->u = va_arg(ap, size_t); break;
+          case LEN_J: arg->u = va_arg(ap, uintmax_t); break;
+          case LEN_T: arg->u = (u64) va_arg(ap, ptrdiff_t); break;
+          default: arg->u = va_arg(ap, unsigned); break;
+        }
+        break;
+      case 'c':
+        arg->i = va_arg(ap, int);
+        break;
+      case 'f':
+      case 'F':
+      case 'e':
+      case 'E':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        arg->f = len == LEN_BIG_L ? (f64) va_arg(ap, long double) : va_arg(ap, double);
+        break;
+      case 'p':
+        arg->p = va_arg(ap, void *);
+        break;
+      case 's': {
+        // Strings are copied, the caller's buffer may be gone by the time the writer gets to the message
+        const char *s = va_arg(ap, const char *);
+        if (!s)
+          s = "(null)";
+
+        arg->str_off = str_used;
+        if (str_used < LOG_STR_SZ) {
+          size_t n = strlen(s), room = LOG_STR_SZ - str_used - 1;
+          if (n > room)
+            n = room;
+          memcpy(rec->str + str_used, s, n);
+          rec->str[str_used + n] = '\0';
+          str_used += n + 1;
+        }
+        break;
+      }
+      default:
+        crash_and_burn("log_msg: unsupported conversion %%%c in \"%s\"\n", *p, fmt);
+    }
+  }
+}
+
+// Formats a captured record into buf. Each conversion is handed to snprintf on its own with the length modifier
+// rewritten to match the widened argument
+static void log_format(const log_rec_t *rec, char *buf, size_t buf_sz) {
+  size_t pos = 0;
+  u32 n_args = 0;
+
+#define LOG_APPEND(...) \
+  do { \
+    if (pos < buf_sz) { \
+      int n = snprintf(buf + pos, buf_sz - pos, __VA_ARGS__); \
+      if (n > 0) \
+        pos += n; \
+    } \
+  } while (0)
+
+  for (const char *p = rec->fmt; *p; p++) {
+    if (*p != '%') {
+      if (pos + 1 < buf_sz)
+        buf[pos++] = *p;
+      continue;
+    }
+    if (p[1] == '%') {
+      if (pos + 1 < buf_sz)
+        buf[pos++] = '%';
+      p++;
+      continue;
+    }
+
+    // Copy the flags/width/precision part of the spec, drop the length modifier
+    const char *start = p;
+    log_len_t len;
+    const char *conv = log_parse_spec(p + 1, &len);
+    if (!*conv)
+      break;
+
+    char spec[32];
+    size_t spec_len = 0;
+    for (const char *q = start; q < conv && spec_len < sizeof spec - 4; q++) {
+      if (!strchr("hlzjtL", *q))
+        spec[spec_len++] = *q;
+    }
+
+    const log_arg_t *arg = &rec->args[n_args++];
+    switch (*conv) {
+      case 'd':
+      case 'i':
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        spec[spec_len++] = 'l';
+        spec[spec_len++] = 'l';
+        spec[spec_len++] = *conv;
+        spec[spec_len] = '\0';
+        if (*conv == 'd' || *conv == 'i')
+          LOG_APPEND(spec, (long long) arg->i);
+        else
+          LOG_APPEND(spec, (unsigned long long) arg->u);
+        break;
+      case 'c':
+        spec[spec_len++] = 'c';
+        spec[spec_len] = '\0';
+        LOG_APPEND(spec, (int) arg->i);
+        break;
+      case 'p':
+        spec[spec_len++] = 'p';
+        spec[spec_len] = '\0';
+        LOG_APPEND(spec, arg->p);
+        break;
+      case 's':
+        spec[spec_len++] = 's';
+        spec[spec_len] = '\0';
+        LOG_APPEND(spec, arg->str_off < LOG_STR_SZ ? rec->str + arg->str_off : "");
+        break;
+      default:
+        spec[spec_len++] = *conv;
+        spec[spec_len] = '\0';
+        LOG_APPEND(spec, arg->f);
+        break;
+    }
+    p = conv;
+  }
+#undef LOG_APPEND
+
+  if (pos >= buf_sz)
+    pos = buf_sz - 1;
+  buf[pos] = '\0';
+}
+
+static void log_write_rec(const log_rec_t *rec) {
+  char msg[512];
+  log_format(rec, msg, sizeof msg);
+
+  // Messages don't carry their own newline
+  size_t len = strlen(msg);
+  if (len && msg[len - 1] == '\n')
+    msg[len - 1] = '\0';
+
+  printf("[%7.3f] %s %s: %s", rec->ticks / 1000., LOG_LEVEL_NAMES[rec->level], LOG_CAT_NAMES[rec->cat], msg);
+  if (rec->suppressed)
+    printf(" (%u similar messages suppressed)", rec->suppressed);
+  putchar('\n');
+}
+
+static int log_thread(void *data) {
+  logger_t *l = data;
+
+  for (;;) {
+    u32 tail = SDL_AtomicGet(&l->tail);
+    if (tail != (u32) SDL_AtomicGet(&l->head)) {
+      log_write_rec(&l->recs[tail & (LOG_QUEUE_SZ - 1)]);
+      SDL_AtomicSet(&l->tail, tail + 1);
+      continue;
+    }
+
+    fflush(stdout);
+    if (!SDL_AtomicGet(&l->running))
+      break;
+
+    // Announce that we're going to sleep, then check the queue once more. Either the producer sees the flag and
+    // posts the semaphore, or we see its record here
+    SDL_AtomicSet(&l->sleeping, 1);
+    if (tail != (u32) SDL_AtomicGet(&l->head) || !SDL_AtomicGet(&l->running)) {
+      SDL_AtomicSet(&l->sleeping, 0);
+      continue;
+    }
+    SDL_SemWait(l->wake);
+  }
+
+  return 0;
+}
+
+static void log_wake(logger_t *l) {
+  if (SDL_AtomicGet(&l->sleeping) && SDL_AtomicCAS(&l->sleeping, 1, 0))
+    SDL_SemPost(l->wake);
+}
+
+void log_init(log_level_t level, u32 cat_mask) {
+  log_min_level = level;
+  log_cat_mask = cat_mask;
+
+  logger_t *l = nes_calloc(1, sizeof *l);
+  SDL_AtomicSet(&l->running, 1);
+  if ((l->wake = SDL_CreateSemaphore(0)) == NULL)
+    crash_and_burn("log_init: SDL_CreateSemaphore failed: %s\n", SDL_GetError());
+  if ((l->thread = SDL_CreateThread(log_thread, "cnes-log", l)) == NULL)
+    crash_and_burn("log_init: SDL_CreateThread failed: %s\n", SDL_GetError());
+  logger = l;
+
+  // Make sure queued messages make it out when we exit through crash_and_burn()
+  static bool registered = false;
+  if (!registered) {
+    atexit(log_destroy);
+    registered = true;
+  }
+}
+
+void log_flush(void) {
+  logger_t *l = logger;
+  if (!l)
+    return;
+
+  u32 head = SDL_AtomicGet(&l->head);
+  while ((u32) SDL_AtomicGet(&l->tail) != head) {
+    log_wake(l);
+    SDL_Delay(1);
+  }
+}
+
+void log_destroy(void) {
+  logger_t *l = logger;
+  if (!l)
+    return;
+
+  // Let the writer drain the queue and exit, then go back to printing synchronously
+  SDL_AtomicSet(&l->running, 0);
+  SDL_AtomicSet(&l->sleeping, 0);
+  SDL_SemPost(l->wake);
+  SDL_WaitThread(l->thread, NULL);
+  SDL_DestroySemaphore(l->wake);
+  logger = NULL;
+
+  for (u32 i = 0; i < LOG_RATE_SLOTS; i++) {
+    if (l->sites[i].suppressed)
+      printf("log_destroy: %u messages suppressed from \"%s\"\n", l->sites[i].suppressed, l->sites[i].fmt);
+  }
+  if (l->dropped)
+    printf("log_destroy: %u messages dropped, queue was full\n", l->dropped);
+  fflush(stdout);
+
+  free(l);
+}
+
+// Returns false if the call site has used up its budget for the current window
+static bool log_rate_check(logger_t *l, const char *fmt, u32 now, u32 *suppressed) {
+  log_site_t *site = &l->sites[((uintptr_t) fmt >> 2) & (LOG_RATE_SLOTS - 1)];
+
+  if (site->fmt != fmt) {
+    // Slot collision: the previous owner's suppressed count is folded into the drop counter
+    l->dropped += site->suppressed;
+    site->fmt = fmt;
+    site->window_start = now;
+    site->count = 0;
+    site->suppressed = 0;
+  } else if (now - site->window_start >= LOG_RATE_WINDOW_MS) {
+    site->window_start = now;
+    site->count = 0;
+  }
+
+  if (site->count >= LOG_RATE_BURST) {
+    site->suppressed++;
+    return false;
+  }
+
+  site->count++;
+  *suppressed = site->suppressed;
+  site->suppressed = 0;
+  return true;
+}
+
+void log_msg(log_level_t level, log_cat_t cat, const char *fmt, ...) {
+  if (level < log_min_level || !(log_cat_mask & (1 << cat)))
+    return;
+
+  va_list ap;
+  logger_t *l = logger;
+
+  if (!l) {
+    // Logger isn't running, print synchronously
+    log_rec_t rec = {.fmt = fmt, .ticks = SDL_GetTicks(), .level = level, .cat = cat};
+    va_start(ap, fmt);
+    log_capture(&rec, fmt, ap);
+    va_end(ap);
+    log_write_rec(&rec);
+    return;
+  }
+
+  u32 now = SDL_GetTicks(), suppressed;
+  if (!log_rate_check(l, fmt, now, &suppressed))
+    return;
+
+  u32 head = SDL_AtomicGet(&l->head);
+  if (head - (u32) SDL_AtomicGet(&l->tail) == LOG_QUEUE_SZ) {
+    l->dropped++;
+    return;
+  }
+
+  log_rec_t *rec = &l->recs[head & (LOG_QUEUE_SZ - 1)];
+  rec->fmt = fmt;
+  rec->ticks = now;
+  rec->suppressed = suppressed;
+  rec->level = level;
+  rec->cat = cat;
+  va_start(ap, fmt);
+  log_capture(rec, fmt, ap);
+  va_end(ap);
+
+  SDL_AtomicSet(&l->head, head + 1);
+  log_wake(l);
+}
+
+int log_level_from_str(const char *str) {
+  for (u32 i = 0; i < sizeof LOG_LEVEL_NAMES / sizeof *LOG_LEVEL_NAMES; i++) {
+    if (strcmp(str, LOG_LEVEL_NAMES[i]) == 0)
+      return i;
+  }
+  return -1;
+}
+
+int log_cat_from_str(const char *str) {
+  for (u32 i = 0; i < LOG_NUM_CATS; i++) {
+    if (strcmp(str, LOG_CAT_NAMES[i]) == 0)
+      return i;
+  }
+  return -1;
+}
@@ -4,6 +4,30 @@
 #include "include/ppu.h"
 #include "include/window.h"
 #include "include/args.h"
+#include "include/log.h"
+#include "include/apu.h"
+#include "include/nsf.h"
+#include "include/pace.h"
+
+// Key events are handed from the main thread to the emulation thread, which applies them between frames
+#define KEY_QUEUE_SZ 64  // Must be a power of two
+
+typedef struct key_event {
+  SDL_Keycode sym;
+  bool down;
+} key_event_t;
+
+// Everything the emulation thread needs. head is only written by the main thread, tail only by the emulation thread
+typedef struct emu {
+  nes_t *nes;
+  args_t *args;
+  window_t *wnd;
+
+  SDL_atomic_t running;
+  key_event_t keys[KEY_QUEUE_SZ];
+  SDL_atomic_t key_head;
+  SDL_atomic_t key_tail;
+} emu_t;
 
 static void keyboard_input(nes_t *nes, SDL_Keycode sc, bool keydown) {
   u8 n;
@@ -36,7 +60,7 @@ static void keyboard_input(nes_t *nes, SDL_Keycode sc, bool keydown) {
       nes_reset(nes);
       return;
     default:
-      printf("keyboard_input: invalid input on key%s=%d\n", keydown ? "down" : "up", sc);
+      log_msg(LOG_DEBUG, LOG_CAT_INPUT, "keyboard_input: unmapped key %d (%s)", sc, keydown ? "down" : "up");
       return;
   }
 
@@ -47,6 +71,42 @@ static void keyboard_input(nes_t *nes, SDL_Keycode sc, bool keydown) {
     SET_BIT(nes->ctrl1_sr_buf, n, 0);
 }
 
+// Queues a key event for the emulation thread. If it's that far behind, the event is lost
+static void emu_push_key(emu_t *emu, SDL_Keycode sym, bool down) {
+  int head = SDL_AtomicGet(&emu->key_head);
+  if (head - SDL_AtomicGet(&emu->key_tail) == KEY_QUEUE_SZ)
+    return;
+
+  emu->keys[head & (KEY_QUEUE_SZ - 1)] = (key_event_t) {.sym = sym, .down = down};
+  SDL_AtomicSet(&emu->key_head, head + 1);
+}
+
+static int emu_thread(void *data) {
+  emu_t *emu = data;
+  nes_t *nes = emu->nes;
+
+  // The audio device or the schedule paces emulation, at the display's refresh rate if it's close to the NES's
+  pace_t pace;
+  pace_init(&pace);
+  for (u64 frame = 0; SDL_AtomicGet(&emu->running); frame++) {
+    // Apply the input that came in since the last frame
+    int tail = SDL_AtomicGet(&emu->key_tail);
+    for (int head = SDL_AtomicGet(&emu->key_head); tail != head; tail++) {
+      key_event_t *key = &emu->keys[tail & (KEY_QUEUE_SZ - 1)];
+      keyboard_input(nes, key->sym, key->down);
+    }
+    SDL_AtomicSet(&emu->key_tail, tail);
+
+    // Generate a frame and hand it to the presenter, unless it's skipped
+    emu->wnd->skip_render = frame % (emu->args->frameskip + 1) != 0;
+    window_draw_frame(emu->wnd, nes);
+    pace_frame(&pace, nes, emu->wnd);
+  }
+
+  pace_destroy(&pace);
+  return 0;
+}
+
 int main(int argc, char **argv) {
   printf("cnes by Alex Restifo\n");
 
@@ -54,64 +114,72 @@ int main(int argc, char **argv) {
   if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
     crash_and_burn("SDL_Init() failed: %s\n", SDL_GetError());
 
-  // Read command line arguments
-  // TODO: Usage string
-  if (argc != 2)
-    crash_and_burn("Invalid command line arguments.\n");
-
   // Initialize the NES and display window
   nes_t nes;
   args_t args;
   window_t window;
 
-  // Use default starting values
+  // Use default starting values, then read command line arguments
   args_init(&args);
-  args.cart_fn = argv[1];
+  args_parse(&args, argc, argv);
+  log_init(args.log_level, args.log_cats);
+
+  // NSF tunes are rendered straight to a file, without a window
+  if (args.nsf) {
+    nsf_init(&nes, &args);
+    nsf_render(&nes, args.nsf_song, args.nsf_seconds);
+    bool ok = nsf_destroy(&nes);
+    args_destroy(&args);
+    log_destroy();
+    SDL_Quit();
+    return ok ? 0 : EXIT_FAILURE;
+  }
 
   nes_init(&nes, &args);
-  window_init(&window);
+  window_init(&window, &args);
 
-  // TODO: Make this configurable
-  SDL_SetWindowSize(window.disp_window, 2 * WINDOW_W, 2 * WINDOW_H);
+  // Emulation runs on its own thread from here on. The main thread only handles events and presents frames, and
+  // doesn't log until the emulation thread is gone
+  emu_t emu = {.nes = &nes, .args = &args, .wnd = &window};
+  SDL_AtomicSet(&emu.running, 1);
+  SDL_Thread *emu_thr = SDL_CreateThread(emu_thread, "cnes-emu", &emu);
+  if (!emu_thr)
+    crash_and_burn("SDL_CreateThread() failed: %s\n", SDL_GetError());
 
-  bool is_running = true;
-  u32 last_ticks = SDL_GetTicks();
   SDL_Event event;
-  while (is_running) {
+  while (SDL_AtomicGet(&emu.running)) {
     // Main event polling loop
-    // Also update the keyboard array so we can get input
-    if (SDL_GetTicks() - last_ticks > 1000 / 60.) {
-      last_ticks = SDL_GetTicks();
-
-      while (SDL_PollEvent(&event)) {
-        switch (event.type) {
-          case SDL_QUIT:
-            is_running = false;
-            break;
-          case SDL_KEYDOWN:
-            keyboard_input(&nes, event.key.keysym.sym, true);
-            break;
-          case SDL_KEYUP:
-            keyboard_input(&nes, event.key.keysym.sym, false);
-            break;
-        }
+    // Key events are passed on to the emulation thread
+    while (SDL_PollEvent(&event)) {
+      switch (event.type) {
+        case SDL_QUIT:
+          SDL_AtomicSet(&emu.running, 0);
+          break;
+        case SDL_WINDOWEVENT:
+          // Exposed, resized, ...: show the current frame again even if nothing in it changed
+          window_redraw(&window);
+          break;
+        case SDL_KEYDOWN:
+          emu_push_key(&emu, event.key.keysym.sym, true);
+          break;
+        case SDL_KEYUP:
+          emu_push_key(&emu, event.key.keysym.sym, false);
+          break;
       }
-
-      // Generate a frame and display it
-      window_draw_frame(&window, &nes);
-    } else {
-      SDL_Delay(1);
     }
+
+    window_present(&window);
   }
 
   // Clean up
-  nes_fclose(nes.args->cpu_logf);
-
+  SDL_WaitThread(emu_thr, NULL);
   window_destroy(&window);
-  nes_destroy(&nes);
+  bool ok = nes_destroy(&nes);
+  args_destroy(&args);
+  log_destroy();
   SDL_Quit();
 
-  return 0;
+  return ok ? 0 : EXIT_FAILURE;
 }
 
 #ifdef WIN32
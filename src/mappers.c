@@ -2,6 +2,7 @@
 #include "include/ppu.h"
 #include "include/cart.h"
 #include "include/util.h"
+#include "include/log.h"
 
 u8 (*const mapper_cpu_read_fns[8])(nes_t *, u16) = {
         nrom_cpu_read, mmc1_cpu_read, NULL, NULL, NULL, NULL, NULL, axrom_cpu_read
@@ -41,12 +42,15 @@ void mapper_init(mapper_t *mapper, cart_t *cart) {
   // Set fixed mirroring type for mappers that don't control it. This gets overwritten by mappers that control
   // mirroring themselves (MMC1, MMC3, etc.)
   mapper->mirror_type = cart->fixed_mirror ? MT_VERTICAL : MT_HORIZONTAL;
+  mapper->chr_bank0 = 0;
+  mapper->chr_bank1 = 0;
+  mapper->chr_banksz = 0x1000;
 
   char *mapstr;
   if ((mapstr = map_str(cart->mapno)) == NULL) {
     crash_and_burn("mapper_init: fatal: unsupported mapper %d!\n", cart->mapno);
   }
-  printf("mapper_init: using %s mapper (%d)", mapstr, cart->mapno);
+  log_msg(LOG_INFO, LOG_CAT_MAPPER, "mapper_init: using %s mapper (%d)", mapstr, cart->mapno);
 
   // Set up the correct mapper function pointers
   mapper->cpu_read = mapper_cpu_read_fns[cart->mapno];
@@ -2,6 +2,8 @@
 #include "../include/cart.h"
 #include "../include/ppu.h"
 #include "../include/util.h"
+#include "../include/log.h"
+#include "../include/stats.h"
 
 u8 axrom_prg_bank = 0;
 
@@ -10,7 +12,8 @@ u8 axrom_cpu_read(nes_t *nes, u16 addr) {
     u16 offset = addr - 0x8000;
     return nes->cart->prg[0x8000 * axrom_prg_bank + offset];
   }
-  printf("axrom_cpu_read: ??\n");
+  log_msg(LOG_WARN, LOG_CAT_MAPPER, "axrom_cpu_read: invalid mapper read at $%04X", addr);
+  return 0;
 }
 
 u8 axrom_ppu_read(nes_t *nes, u16 addr) {
@@ -21,6 +24,7 @@ void axrom_cpu_write(nes_t *nes, u16 addr, u8 val) {
   // Single register: $8000-$FFFF 32K PRG ROM select
   if (addr >= 0x8000 && addr <= 0xFFFF) {
     axrom_prg_bank = val & 0x7;
+    STAT_INC(mapper_bank_switches);
 //    nes->mapper->mirror_type = GET_BIT(val, 4) ? MT_1SCR_A : MT_1SCR_B;
     nes->mapper->mirror_type = MT_1SCR_A;
   }
@@ -2,9 +2,8 @@
 #include "../include/cart.h"
 #include "../include/ppu.h"
 #include "../include/util.h"
-
-// DEBUG INCLUDE
-#include "../include/args.h"
+#include "../include/log.h"
+#include "../include/stats.h"
 
 u8 mmc1_sr_write_num = 0;
 u8 mmc1_sr = 0;
@@ -12,11 +11,9 @@ u8 mmc1_sr = 0;
 // These are offsets (each of size _banksz) into the CART PRG and CHR rom, used for switching banks
 //u8 mmc1_prg_bank = 0xF;  // Init value for PRG bank seems to be 15, I got crashes with any other value
 u8 mmc1_prg_bank = 0;
-u8 mmc1_chr_bank0 = 0;
-u8 mmc1_chr_bank1 = 0;
 
+// The CHR banks and the 4K/8K CHR window size live in the mapper, where the PPU render thread can copy them
 u16 mmc1_prg_banksz = 0x4000;  // 16K PRG ROM window, can be changed to 32K
-u16 mmc1_chr_banksz = 0x1000;  // 4K CHR ROM window, can be changed to 8K
 
 //u8 mmc1_prg_bankmode = 0;
 u8 mmc1_prg_bankmode = 3;
@@ -27,6 +24,8 @@ u8 mmc1_wram_enable = 0;
 // Divide cart->prg into 16K chunks
 // arr[0] = first chunk, arr[1] = second chunk, etc
 static void mmc1_reg_write_helper(nes_t *nes, u8 reg_n, u8 val) {
+  mapper_t *mapper = nes->mapper;
+
   switch (reg_n) {
     case 0:
       // ******** Control register ********
@@ -35,7 +34,7 @@ static void mmc1_reg_write_helper(nes_t *nes, u8 reg_n, u8 val) {
       switch (val & 3) {
         case 0:
         case 1:
-          printf("mmc1_reg_write_helper: single-screen mirorring might not work yet\n");
+          log_msg(LOG_WARN, LOG_CAT_MAPPER, "mmc1_reg_write_helper: single-screen mirroring might not work yet");
 //          nes->mapper->mirror_type = MT_1SCR_B;
           nes->mapper->mirror_type = MT_1SCR_A;
           break;
@@ -55,21 +54,23 @@ static void mmc1_reg_write_helper(nes_t *nes, u8 reg_n, u8 val) {
         mmc1_prg_banksz = 0x4000;
 
       // ******** CHR ROM bank mode (bit 4) ********
-      mmc1_chr_banksz = GET_BIT(val, 4) ? 0x1000 : 0x2000;
+      mapper->chr_banksz = GET_BIT(val, 4) ? 0x1000 : 0x2000;
       break;
     case 1:
       // ******** CHR ROM first bank select register ********
-      if (mmc1_chr_banksz == 0x1000) {
-        mmc1_chr_bank0 = val & 0x1F;  // Lower 5 bits select the 4K bank
+      if (mapper->chr_banksz == 0x1000) {
+        mapper->chr_bank0 = val & 0x1F;  // Lower 5 bits select the 4K bank
       } else {
-        mmc1_chr_bank0 = (val & 0x1F) >> 1;  // Select 8K bank, ignore lowest bit
+        mapper->chr_bank0 = (val & 0x1F) >> 1;  // Select 8K bank, ignore lowest bit
       }
+      STAT_INC(mapper_bank_switches);
       break;
     case 2:
       // ******** CHR ROM second bank select register ********
       // This register is irrelevant in 8K CHR mode
-      if (mmc1_chr_banksz == 0x1000) {
-        mmc1_chr_bank1 = val & 0x1F;
+      if (mapper->chr_banksz == 0x1000) {
+        mapper->chr_bank1 = val & 0x1F;
+        STAT_INC(mapper_bank_switches);
       }
       break;
     case 3:
@@ -80,10 +81,14 @@ static void mmc1_reg_write_helper(nes_t *nes, u8 reg_n, u8 val) {
         // Ignore lower bit in 32K mode
         mmc1_prg_bank = (val & 0xE) >> 1;
       }
+      STAT_INC(mapper_bank_switches);
       break;
     default:
-      printf("mmc1_reg_write_helper: invalid write to mmc1 reg_n $%d", reg_n);
+      log_msg(LOG_WARN, LOG_CAT_MAPPER, "mmc1_reg_write_helper: invalid write to mmc1 reg_n $%d", reg_n);
   }
+
+  log_msg(LOG_DEBUG, LOG_CAT_MAPPER, "mmc1_reg_write_helper: reg%d=$%02X prg_bank=%d chr_bank0=%d chr_bank1=%d",
+          reg_n, val, mmc1_prg_bank, mapper->chr_bank0, mapper->chr_bank1);
 }
 
 u8 mmc1_cpu_read(nes_t *nes, u16 addr) {
@@ -122,26 +127,28 @@ u8 mmc1_cpu_read(nes_t *nes, u16 addr) {
     default:
       crash_and_burn("mmc1_cpu_read: mmc1_prg_bankmode is invalid=%d\n", mmc1_prg_bankmode);
   }
-  printf("mmc1_cpu_read: something went really wrong\n");
+  log_msg(LOG_WARN, LOG_CAT_MAPPER, "mmc1_cpu_read: invalid mapper read at $%04X", addr);
+  return 0;
 }
 
 u8 mmc1_ppu_read(nes_t *nes, u16 addr) {
   cart_t *crt = nes->cart;
+  mapper_t *mapper = nes->mapper;
 
-  u16 d_addr = mapper_ppu_addr(addr, nes->mapper->mirror_type);
+  u16 d_addr = mapper_ppu_addr(addr, mapper->mirror_type);
   if (addr <= 0x3EFF) {
-    switch (mmc1_chr_banksz) {
+    switch (mapper->chr_banksz) {
       case 0x1000:
         if (d_addr <= 0x0FFF) {
-          return crt->chr[mmc1_chr_bank0 * 0x1000 + d_addr];
+          return crt->chr[mapper->chr_bank0 * 0x1000 + d_addr];
         } else if (d_addr >= 0x1000 && d_addr <= 0x1FFF) {
           u32 offset = d_addr - 0x1000;
-          return crt->chr[mmc1_chr_bank1 * 0x1000 + offset];
+          return crt->chr[mapper->chr_bank1 * 0x1000 + offset];
         }
         break;
       case 0x2000:
         if (d_addr <= 0x1FFF) {
-          return crt->chr[mmc1_chr_bank0 * 0x2000 + d_addr];
+          return crt->chr[mapper->chr_bank0 * 0x2000 + d_addr];
         }
         break;
       default:
@@ -171,10 +178,6 @@ void mmc1_cpu_write(nes_t *nes, u16 addr, u8 val) {
 
         mmc1_reg_write_helper(nes, reg_n, reg_val);
         mmc1_sr = 0;  // Reset shift register after writing
-        if (nes->args->cpu_log_output) {
-          fprintf(nes->args->cpu_logf, "mmc1_cpu_write: writing mmc1 reg, reg_val=$%02X, reg_n=%d\n", reg_val, reg_n);
-          fprintf(nes->args->cpu_logf, "mmc1_cpu_write: prg_bank=%d chr0_bank=%d chr1_bank=%d\n", mmc1_prg_bank, mmc1_chr_bank0, mmc1_chr_bank1);
-        }
       } else {
         // Shift bit 0 of val into the shift register
         SET_BIT(mmc1_sr, 5, val & 1);
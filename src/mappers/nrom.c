@@ -1,6 +1,7 @@
 #include "../include/mappers.h"
 #include "../include/cart.h"
 #include "../include/ppu.h"
+#include "../include/log.h"
 
 u8 nrom_cpu_read(nes_t *nes, u16 addr) {
   cart_t *cart = nes->cart;
@@ -11,7 +12,8 @@ u8 nrom_cpu_read(nes_t *nes, u16 addr) {
     else
       return cart->prg[addr - 0x8000];  // NROM-256
   } else {
-    printf("nrom_cpu_read: invalid mapper read at $%04X\n", addr);
+    log_msg(LOG_WARN, LOG_CAT_MAPPER, "nrom_cpu_read: invalid mapper read at $%04X", addr);
+    return 0;
   }
 }
 
@@ -20,7 +22,7 @@ u8 nrom_ppu_read(nes_t *nes, u16 addr) {
 }
 
 void nrom_cpu_write(nes_t *nes, u16 addr, u8 val) {
-  printf("nrom_cpu_write: caught junk write to $%04X=$%02X\n", addr, val);
+  log_msg(LOG_DEBUG, LOG_CAT_MAPPER, "nrom_cpu_write: caught junk write to $%04X=$%02X", addr, val);
 }
 
 void nrom_ppu_write(nes_t *nes, u16 addr, u8 val) {
@@ -5,12 +5,15 @@
 #include "include/apu.h"
 #include "include/mappers.h"
 #include "include/util.h"
+#include "include/stats.h"
 
 void cpu_write8(nes_t *nes, u16 addr, u8 val) {
   if (addr <= 0x1FFF) {
     nes->cpu->mem[addr % 0x0800] = val;
   } else if (addr >= 0x2000 && addr <= 0x3FFF) {
-    ppu_reg_write(nes, addr % 8, val);
+    // NSF playback has no PPU
+    if (nes->ppu)
+      ppu_reg_write(nes, addr % 8, val);
   } else if (addr == CONTROLLER1_PORT) {
     if (val & 1) {
       // Continuously reload the controller shift registers with the current buttons being held
@@ -18,13 +21,18 @@ void cpu_write8(nes_t *nes, u16 addr, u8 val) {
       nes->ctrl2_sr = nes->ctrl2_sr_buf;
     }
   } else if (addr == OAM_DMA_ADDR) {
-    // Performs CPU -> PPU OAM DMA. Suspends the CPU for 513 or 514 cycles
-    nes->cpu->do_oam_dma = true;
-    nes->cpu->oam_dma_base = val << 8;
+    // Performs CPU -> PPU OAM DMA. Suspends the CPU for 513 or 514 cycles. NSF playback has no PPU to copy to
+    if (nes->ppu) {
+      nes->cpu->do_oam_dma = true;
+      nes->cpu->oam_dma_base = val << 8;
+    }
   } else if (addr >= 0x4000 && addr <= 0x4017) {
     apu_write(nes, addr, val);
   } else if (addr >= 0x4020 && addr <= 0xFFFF) {
+    STAT_INC(mapper_cpu_writes);
     nes->mapper->cpu_write(nes, addr, val);
+    if (nes->ppu)
+      ppu_mapper_written(nes);
   }
 }
 
@@ -34,7 +42,7 @@ u8 cpu_read8(nes_t *nes, u16 addr) {
     return nes->cpu->mem[addr % 0x0800];
   } else if (addr >= 0x2000 && addr <= 0x3FFF) {
     // PPU registers ($2000-$2007) are mirrored from $2008-$3FFF
-    return ppu_reg_read(nes, addr & 7);
+    return nes->ppu ? ppu_reg_read(nes, addr & 7) : 0;
   } else if (addr == CONTROLLER1_PORT) {
     u8 retval = nes->ctrl1_sr & 1;
 
@@ -57,8 +65,7 @@ u8 cpu_read8(nes_t *nes, u16 addr) {
     // Cartridge space; read value from mapper
     return nes->mapper->cpu_read(nes, addr);
   } else {
-    printf("cpu_read8: invalid read from $%04X\n", addr);
-    exit(EXIT_FAILURE);
+    crash_and_burn("cpu_read8: invalid read from $%04X\n", addr);
   }
   return 0;
 }
@@ -79,27 +86,3 @@ u16 cpu_read16(nes_t *nes, u16 addr) {
 
   return lo | (hi << 8);
 }
-
-void cpu_push8(nes_t *nes, u8 val) {
-//  printf("cpu_push8: push pc=$%04X val=$%02X base=$%04X\n", nes->cpu->pc, val, STACK_BASE + nes->cpu->sp);
-  cpu_write8(nes, STACK_BASE + nes->cpu->sp--, val);
-}
-
-void cpu_push16(nes_t *nes, u16 val) {
-  u8 lo = val & 0x00FF;
-  u8 hi = (val & 0xFF00) >> 8;
-
-  cpu_write8(nes, STACK_BASE + nes->cpu->sp--, hi);
-  cpu_write8(nes, STACK_BASE + nes->cpu->sp--, lo);
-}
-
-u8 cpu_pop8(nes_t *nes) {
-  return cpu_read8(nes, STACK_BASE + ++nes->cpu->sp);
-}
-
-u16 cpu_pop16(nes_t *nes) {
-  u8 lo = cpu_read8(nes, STACK_BASE + ++nes->cpu->sp);
-  u8 hi = cpu_read8(nes, STACK_BASE + ++nes->cpu->sp);
-
-  return lo | (hi << 8);
-}
\ No newline at end of file
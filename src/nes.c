@@ -5,6 +5,9 @@
 #include "include/args.h"
 #include "include/mappers.h"
 #include "include/apu.h"
+#include "include/trace.h"
+#include "include/stats.h"
+#include "include/wav.h"
 
 void nes_init(nes_t *nes, args_t *args) {
   memset(nes, 0, sizeof *nes);
@@ -20,20 +23,47 @@ void nes_init(nes_t *nes, args_t *args) {
   mapper_init(nes->mapper, nes->cart);
   cpu_init(nes);
   ppu_init(nes);
-  apu_init(nes, args->sample_rate, args->apu_buf_len);
+
+  // Opened before the APU, which only synthesizes sound if something is listening. It stays open across resets. An
+  // audio device paces emulation in real time and can't wait for the disk, without one the capture can
+  if (args->apu_capture_fn) {
+    nes->audio_out = nes_malloc(sizeof *nes->audio_out);
+    wav_open(nes->audio_out, args->apu_capture_fn, APU_CAPTURE_RATE, !args->apu_audio);
+  }
+  apu_init(nes, args->apu_audio, args->sample_rate, args->apu_buf_len, args->apu_latency_ms);
+
+  stats_init(args->stats_fn);
+
+  if (args->cpu_log_output) {
+    nes->trace = nes_malloc(sizeof *nes->trace);
+    trace_open(nes->trace, args->cpu_trace_fn, args->cpu_trace_records);
+  }
 }
 
 void nes_reset(nes_t *nes) {
   // Reset the nes and restart ROM execution
   cpu_init(nes);
+  ppu_destroy(nes);
   ppu_init(nes);
 
   apu_destroy(nes);
-  apu_init(nes, nes->args->sample_rate, nes->args->apu_buf_len);
+  apu_init(nes, nes->args->apu_audio, nes->args->sample_rate, nes->args->apu_buf_len, nes->args->apu_latency_ms);
 }
 
-void nes_destroy(nes_t *nes) {
+bool nes_destroy(nes_t *nes) {
+  bool ok = true;
+  stats_dump(nes);
+
+  if (nes->trace) {
+    trace_close(nes->trace);
+    free(nes->trace);
+  }
+
   apu_destroy(nes);
+  if (nes->audio_out) {
+    ok = wav_close(nes->audio_out);
+    free(nes->audio_out);
+  }
   ppu_destroy(nes);
   cpu_destroy(nes);
   mapper_destroy(nes->mapper);
@@ -44,4 +74,5 @@ void nes_destroy(nes_t *nes) {
   free(nes->cart);
   free(nes->mapper);
   free(nes->apu);
+  return ok;
 }
@@ -0,0 +1,215 @@
+#include "include/nsf.h"
+#include "include/cpu.h"
+#include "include/apu.h"
+#include "include/mem.h"
+#include "include/mappers.h"
+#include "include/args.h"
+#include "include/wav.h"
+#include "include/stats.h"
+#include "include/util.h"
+#include "include/log.h"
+
+// Reads a little endian u16 out of the header
+static u16 nsf_u16(const u8 *p) {
+  return p[0] | p[1] << 8;
+}
+
+static u8 nsf_cpu_read(nes_t *nes, u16 addr) {
+  nsf_t *nsf = nes->nsf;
+
+  if (addr >= 0x8000) {
+    u32 off = nsf->banks[(addr - 0x8000) / NSF_BANK_SZ] * NSF_BANK_SZ + addr % NSF_BANK_SZ;
+    return off < nsf->image_len ? nsf->image[off] : 0;
+  } else if (addr >= 0x6000) {
+    return nsf->wram[addr - 0x6000];
+  }
+  return 0;
+}
+
+static void nsf_cpu_write(nes_t *nes, u16 addr, u8 val) {
+  nsf_t *nsf = nes->nsf;
+
+  if (addr >= 0x6000 && addr <= 0x7FFF) {
+    nsf->wram[addr - 0x6000] = val;
+  } else if (addr >= 0x5FF8 && addr <= 0x5FFF && nsf->banked) {
+    nsf->banks[addr - 0x5FF8] = val;
+  } else {
+    log_msg(LOG_DEBUG, LOG_CAT_MAPPER, "nsf_cpu_write: caught junk write to $%04X=$%02X", addr, val);
+  }
+}
+
+static void nsf_load(nsf_t *nsf, char *fn) {
+  FILE *f = nes_fopen(fn, "rb");
+
+  u8 hdr[NSF_HEADER_SZ];
+  nes_fread(hdr, 1, NSF_HEADER_SZ, f);
+  if (memcmp(hdr, NSF_MAGIC, strlen(NSF_MAGIC)) != 0)
+    crash_and_burn("nsf_load: %s is not an NSF file.\n", fn);
+
+  nsf->n_songs = hdr[0x06];
+  nsf->start_song = hdr[0x07];
+  nsf->load_addr = nsf_u16(hdr + 0x08);
+  nsf->init_addr = nsf_u16(hdr + 0x0A);
+  nsf->play_addr = nsf_u16(hdr + 0x0C);
+  nsf->speed_us = nsf_u16(hdr + 0x6E);
+  memcpy(nsf->init_banks, hdr + 0x70, sizeof nsf->init_banks);
+
+  // Some rippers leave the speed empty, assume the NTSC frame rate
+  if (nsf->speed_us == 0)
+    nsf->speed_us = 16639;
+
+  for (int i = 0; i < 8; i++)
+    nsf->banked |= nsf->init_banks[i] != 0;
+
+  if (nsf->load_addr < 0x8000 && !nsf->banked)
+    crash_and_burn("nsf_load: unsupported load address $%04X\n", nsf->load_addr);
+  if (hdr[0x7B])
+    log_msg(LOG_WARN, LOG_CAT_APU, "nsf_load: expansion audio ($%02X) isn't supported, only the 2A03 is played",
+            hdr[0x7B]);
+
+  // Banked tunes are padded to the load address within their first bank, others to the load address within
+  // $8000-$FFFF. Either way the image is indexed as 4K banks from there on
+  fseek(f, 0, SEEK_END);
+  u32 data_len = ftell(f) - NSF_HEADER_SZ;
+  fseek(f, NSF_HEADER_SZ, SEEK_SET);
+
+  u32 pad = nsf->banked ? nsf->load_addr % NSF_BANK_SZ : nsf->load_addr - 0x8000;
+  nsf->image_len = (pad + data_len + NSF_BANK_SZ - 1) / NSF_BANK_SZ * NSF_BANK_SZ;
+  nsf->image = nes_calloc(nsf->image_len, 1);
+  nes_fread(nsf->image + pad, 1, data_len, f);
+  nes_fclose(f);
+
+  // Strings are 32 bytes and not always terminated
+  log_msg(LOG_INFO, LOG_CAT_MAIN, "nsf_load: \"%.32s\" by %.32s (%.32s), %d songs, %s, PLAY every %dus",
+          (char *) hdr + 0x0E, (char *) hdr + 0x2E, (char *) hdr + 0x4E, nsf->n_songs,
+          nsf->banked ? "bankswitched" : "not bankswitched", nsf->speed_us);
+}
+
+void nsf_init(nes_t *nes, args_t *args) {
+  memset(nes, 0, sizeof *nes);
+
+  // No cartridge or PPU, the mapper functions serve the NSF image instead
+  nes->args   = args;
+  nes->cpu    = nes_malloc(sizeof *nes->cpu);
+  nes->mapper = nes_calloc(1, sizeof *nes->mapper);
+  nes->apu    = nes_malloc(sizeof *nes->apu);
+  nes->nsf    = nes_calloc(1, sizeof *nes->nsf);
+
+  nsf_load(nes->nsf, args->cart_fn);
+  nes->mapper->cpu_read = nsf_cpu_read;
+  nes->mapper->cpu_write = nsf_cpu_write;
+
+  nes->audio_out = nes_malloc(sizeof *nes->audio_out);
+  wav_open(nes->audio_out, args->apu_capture_fn, APU_CAPTURE_RATE, true);
+  apu_init(nes, false, args->sample_rate, args->apu_buf_len, args->apu_latency_ms);
+
+  stats_init(args->stats_fn);
+}
+
+// Runs the CPU and APU for the given number of CPU cycles. The CPU sits idle once the routine it was given returns
+static void nsf_run(nes_t *nes, u32 cycles) {
+  cpu_t *cpu = nes->cpu;
+  nsf_t *nsf = nes->nsf;
+
+  for (u32 i = 0; i < cycles; i++) {
+    if (!nsf->idle) {
+      cpu_tick(nes);
+      if (cpu->fetch_op && cpu->pc == NSF_RETURN_ADDR)
+        nsf->idle = true;
+    } else {
+      cpu->ticks++;
+    }
+
+    // APU tick every two CPU cycles
+    if (cpu->ticks & 1)
+      apu_tick(nes);
+  }
+}
+
+// Starts a subroutine call to addr. Returning from it lands on NSF_RETURN_ADDR
+static void nsf_call(nes_t *nes, u16 addr, u8 a, u8 x) {
+  cpu_t *cpu = nes->cpu;
+
+  cpu_push16(nes, NSF_RETURN_ADDR - 1);
+  cpu->pc = addr;
+  cpu->a = a;
+  cpu->x = x;
+  cpu->y = 0;
+  nes->nsf->idle = false;
+}
+
+void nsf_render(nes_t *nes, u32 song, u32 seconds) {
+  nsf_t *nsf = nes->nsf;
+
+  if (song == 0)
+    song = nsf->start_song;
+  if (song < 1 || song > nsf->n_songs)
+    crash_and_burn("nsf_render: song %u out of range, the tune has %d songs\n", song, nsf->n_songs);
+
+  // Power up state: RAM and WRAM cleared, initial banks, silent APU with the frame IRQ off
+  cpu_init(nes);
+  memset(nsf->wram, 0, sizeof nsf->wram);
+  memcpy(nsf->banks, nsf->init_banks, sizeof nsf->banks);
+  if (!nsf->banked) {
+    for (int i = 0; i < 8; i++)
+      nsf->banks[i] = i;
+  }
+  for (u16 addr = 0x4000; addr <= 0x4013; addr++) {
+    if (addr != 0x4009 && addr != 0x400D)
+      apu_write(nes, addr, 0);
+  }
+  apu_write(nes, 0x4015, 0x0F);
+  apu_write(nes, 0x4017, 0x40);
+
+  u64 t0 = SDL_GetPerformanceCounter();
+
+  // INIT gets the song number in A and the region in X (0 = NTSC)
+  nsf_call(nes, nsf->init_addr, song - 1, 0);
+  for (u32 c = 0; !nsf->idle && c < NSF_INIT_MAX_CYCLES; c++)
+    nsf_run(nes, 1);
+  if (!nsf->idle)
+    crash_and_burn("nsf_render: INIT at $%04X didn't return\n", nsf->init_addr);
+  apu_end_frame(nes);
+
+  // Call PLAY every speed_us microseconds. The cycle count per call is carried in millionths of a cycle so the
+  // average rate is exact. If PLAY is still running when the next call is due, that call is skipped
+  u64 total = (u64) seconds * NTSC_CPU_SPEED;
+  u64 frac = 0;
+  u32 skipped = 0;
+  for (u64 done = 0; done < total;) {
+    frac += (u64) nsf->speed_us * NTSC_CPU_SPEED;
+    u32 cycles = frac / 1000000;
+    frac %= 1000000;
+
+    if (nsf->idle)
+      nsf_call(nes, nsf->play_addr, 0, 0);
+    else
+      skipped++;
+
+    nsf_run(nes, cycles);
+    apu_end_frame(nes);
+    done += cycles;
+  }
+
+  double elapsed = (double) (SDL_GetPerformanceCounter() - t0) / SDL_GetPerformanceFrequency();
+  log_msg(LOG_INFO, LOG_CAT_MAIN, "nsf_render: rendered song %u/%d, %us of audio in %.3fs (%.0fx real time)", song,
+          nsf->n_songs, seconds, elapsed, seconds / MAX(elapsed, 1e-9));
+  if (skipped)
+    log_msg(LOG_WARN, LOG_CAT_MAIN, "nsf_render: PLAY ran long, %u calls skipped", skipped);
+}
+
+bool nsf_destroy(nes_t *nes) {
+  stats_dump(nes);
+
+  apu_destroy(nes);
+  bool ok = wav_close(nes->audio_out);
+  cpu_destroy(nes);
+
+  free(nes->nsf->image);
+  free(nes->nsf);
+  free(nes->audio_out);
+  free(nes->cpu);
+  free(nes->mapper);
+  free(nes->apu);
+  return ok;
+}
@@ -0,0 +1,264 @@
+#include "include/ntsc.h"
+#include "include/window.h"
+#include "include/util.h"
+
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NTSC_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef CNES_AVX2
+#include <immintrin.h>
+#endif
+
+// Signal levels relative to sync, low and high for each of the four luma levels. The rest of the model is from the same
+// place: https://wiki.nesdev.com/w/index.php/NTSC_video
+static const double NTSC_LEVELS[2][4] = {{0.350, 0.518, 0.962, 1.550},
+                                         {1.094, 1.506, 1.962, 1.962}};
+#define NTSC_BLACK 0.518
+#define NTSC_WHITE 1.962
+#define NTSC_ATTEN 0.746  // Emphasized parts of the cycle are attenuated by this much
+#define NTSC_PI    3.14159265358979323846
+
+// Whether the square wave for hue color is high at the given subcarrier phase (0-11)
+static bool ntsc_in_phase(int color, int phase) {
+  return (color + phase) % 12 < 6;
+}
+
+// The signal for a pixel at the given subcarrier phase, scaled so black is 0 and white is 1
+static double ntsc_signal(pixel_t px, int phase) {
+  int color = px & 0x0F;
+  int level = (px >> 4) & 3;
+  int emph = px >> PALETTE_EMPH_SHIFT;
+
+  // $xE and $xF are black, $x0 is a flat gray at the high level and $xD at the low level
+  if (color > 13)
+    level = 1;
+  double low = NTSC_LEVELS[0][level], high = NTSC_LEVELS[1][level];
+  if (color == 0)
+    low = high;
+  if (color > 12)
+    high = low;
+
+  double v = ntsc_in_phase(color, phase) ? high : low;
+  if (((emph & 1) && ntsc_in_phase(0, phase)) || ((emph & 2) && ntsc_in_phase(4, phase)) ||
+      ((emph & 4) && ntsc_in_phase(8, phase)))
+    v *= NTSC_ATTEN;
+
+  return (v - NTSC_BLACK) / (NTSC_WHITE - NTSC_BLACK);
+}
+
+// Byte of an output pixel a channel lands in, from the pixel format's value for that channel at full intensity
+static u32 ntsc_lane(u32 val) {
+  u32 lane = 0;
+  while (val > 0xFF) {
+    val >>= 8;
+    lane++;
+  }
+  return lane;
+}
+
+// Decodes each pixel's signal on its own into the output pixels it reaches. A TV averages the signal over one
+// subcarrier cycle (12 samples) around each output position for luma, and demodulates chroma over the same window
+static void ntsc_init_kernels(ntsc_t *ntsc) {
+  SDL_PixelFormat *fmt = SDL_AllocFormat(SDL_PIXELFORMAT_ARGB32);
+  u32 lanes[3] = {ntsc_lane(SDL_MapRGBA(fmt, 0xFF, 0, 0, 0)), ntsc_lane(SDL_MapRGBA(fmt, 0, 0xFF, 0, 0)),
+                  ntsc_lane(SDL_MapRGBA(fmt, 0, 0, 0xFF, 0))};
+  ntsc->alpha = SDL_MapRGBA(fmt, 0, 0, 0, 0xFF);
+  SDL_FreeFormat(fmt);
+
+  for (u32 c = 0; c < PALETTE_N_COLORS; c++) {
+    for (u32 ph = 0; ph < NTSC_PHASES; ph++) {
+      double sig[NTSC_SAMPLES];
+      for (int t = 0; t < NTSC_SAMPLES; t++)
+        sig[t] = ntsc_signal(c, (4 * ph + t) % 12);
+
+      i16 *k = ntsc->kernel + (c * NTSC_PHASES + ph) * ntsc->kernel_len;
+      for (u32 o = 0; o < NTSC_KERNEL_PIXELS * ntsc->scale; o++) {
+        // Output pixel o sits this many samples from the start of the pixel
+        int s = (int) (o * NTSC_SAMPLES / ntsc->scale) - NTSC_KERNEL_LEFT * NTSC_SAMPLES;
+
+        double y = 0, i = 0, q = 0;
+        for (int t = 0; t < NTSC_SAMPLES; t++) {
+          if (t < s - 6 || t >= s + 6)
+            continue;
+          double a = NTSC_PI * (4 * ph + t + NTSC_HUE_OFFSET) / 6;
+          y += sig[t] / 12;
+          i += sig[t] / 12 * cos(a);
+          q += sig[t] / 12 * sin(a);
+        }
+
+        // FCC YIQ to RGB, in 1/16ths of a color step
+        double rgb[3] = {y + 0.946882 * i + 0.623557 * q,
+                         y - 0.274788 * i - 0.635691 * q,
+                         y - 1.108545 * i + 1.709007 * q};
+        for (int ch = 0; ch < 3; ch++)
+          k[o * 4 + lanes[ch]] = (i16) lround(rgb[ch] * 255 * 16);
+      }
+    }
+  }
+}
+
+static int ntsc_worker_thread(void *data);
+
+void ntsc_init(ntsc_t *ntsc, u32 scale, u32 n_threads) {
+  memset(ntsc, 0, sizeof *ntsc);
+  ntsc->scale = scale;
+  ntsc->out_w = WINDOW_W * scale;
+  ntsc->avx2 = SDL_HasAVX2();
+
+  // Kernels and the accumulator are padded to whole AVX2 vectors
+  ntsc->kernel_len = (NTSC_KERNEL_PIXELS * scale * 4 + 15) & ~15;
+  ntsc->acc_len = (WINDOW_W - 1) * scale * 4 + ntsc->kernel_len;
+  ntsc->kernel = nes_calloc((size_t) PALETTE_N_COLORS * NTSC_PHASES * ntsc->kernel_len, sizeof *ntsc->kernel);
+  ntsc_init_kernels(ntsc);
+
+  u32 n = n_threads ? n_threads : (u32) SDL_GetCPUCount();
+  ntsc->n_workers = MAX(MIN(n, WINDOW_H), 1);
+  ntsc->workers = nes_calloc(ntsc->n_workers, sizeof *ntsc->workers);
+  for (u32 i = 0; i < ntsc->n_workers; i++) {
+    ntsc->workers[i].ntsc = ntsc;
+    ntsc->workers[i].acc = nes_malloc(ntsc->acc_len * sizeof *ntsc->workers[i].acc);
+  }
+  if (ntsc->n_workers == 1)
+    return;
+
+  if ((ntsc->go = SDL_CreateSemaphore(0)) == NULL || (ntsc->done = SDL_CreateSemaphore(0)) == NULL)
+    crash_and_burn("ntsc_init: SDL_CreateSemaphore failed: %s\n", SDL_GetError());
+  for (u32 i = 1; i < ntsc->n_workers; i++) {
+    ntsc->workers[i].thread = SDL_CreateThread(ntsc_worker_thread, "cnes-ntsc", &ntsc->workers[i]);
+    if (ntsc->workers[i].thread == NULL)
+      crash_and_burn("ntsc_init: SDL_CreateThread failed: %s\n", SDL_GetError());
+  }
+}
+
+#ifdef CNES_AVX2
+// ntsc_add() 16 lanes at a time
+CNES_AVX2 static void ntsc_add_avx2(i16 *acc, const i16 *k, u32 n) {
+  for (u32 i = 0; i < n; i += 16) {
+    __m256i a = _mm256_loadu_si256((const __m256i *) (acc + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *) (k + i));
+    _mm256_storeu_si256((__m256i *) (acc + i), _mm256_adds_epi16(a, b));
+  }
+}
+#endif
+
+// acc[0..n) += k[0..n), saturating. n is a multiple of 16
+static void ntsc_add(const ntsc_t *ntsc, i16 *acc, const i16 *k, u32 n) {
+#ifdef CNES_AVX2
+  if (ntsc->avx2) {
+    ntsc_add_avx2(acc, k, n);
+    return;
+  }
+#endif
+
+#if defined(NTSC_SSE2)
+  for (u32 i = 0; i < n; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *) (acc + i));
+    __m128i b = _mm_loadu_si128((const __m128i *) (k + i));
+    _mm_storeu_si128((__m128i *) (acc + i), _mm_adds_epi16(a, b));
+  }
+#else
+  for (u32 i = 0; i < n; i++) {
+    i32 v = acc[i] + k[i];
+    acc[i] = (i16) (v < INT16_MIN ? INT16_MIN : v > INT16_MAX ? INT16_MAX : v);
+  }
+#endif
+}
+
+// Turns a row of accumulated channels into output pixels, clamping each channel to 0-255
+static void ntsc_pack(const ntsc_t *ntsc, const i16 *acc, u32 *out) {
+#if defined(NTSC_SSE2)
+  // Four pixels at a time, packus does the clamping. Its byte order is the pixel's byte order on x86
+  __m128i alpha = _mm_set1_epi32((int) ntsc->alpha);
+  for (u32 i = 0; i < ntsc->out_w; i += 4) {
+    __m128i lo = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) (acc + 4 * i)), 4);
+    __m128i hi = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) (acc + 4 * i + 8)), 4);
+    _mm_storeu_si128((__m128i *) (out + i), _mm_or_si128(_mm_packus_epi16(lo, hi), alpha));
+  }
+#else
+  for (u32 i = 0; i < ntsc->out_w; i++) {
+    u32 px = ntsc->alpha;
+    for (u32 lane = 0; lane < 4; lane++) {
+      i32 v = acc[4 * i + lane] >> 4;
+      px |= (u32) (v < 0 ? 0 : v > 0xFF ? 0xFF : v) << 8 * lane;
+    }
+    out[i] = px;
+  }
+#endif
+}
+
+static void ntsc_filter_row(ntsc_t *ntsc, i16 *acc, const pixel_t *in, u32 *out, u32 y) {
+  u32 stride = ntsc->scale * 4;
+
+  // Lines are 341 * 8 samples long, so each starts 4 samples (a third of a cycle) later in the cycle than the one
+  // before. Pixels are 8 samples apart
+  memset(acc, 0, ntsc->acc_len * sizeof *acc);
+  for (u32 x = 0; x < WINDOW_W; x++) {
+    u32 phase = (y + 2 * x) % NTSC_PHASES;
+    ntsc_add(ntsc, acc + x * stride, ntsc->kernel + (in[x] * NTSC_PHASES + phase) * ntsc->kernel_len, ntsc->kernel_len);
+  }
+
+  // The accumulator starts NTSC_KERNEL_LEFT pixels left of the screen
+  ntsc_pack(ntsc, acc + NTSC_KERNEL_LEFT * stride, out);
+}
+
+// Filters rows of the current job until none are left
+static void ntsc_filter_rows(ntsc_worker_t *w) {
+  ntsc_t *ntsc = w->ntsc;
+
+  for (int i; (i = SDL_AtomicAdd(&ntsc->next_row, 1)) < (int) ntsc->job_n_rows;) {
+    u32 y = ntsc->job_rows[i];
+    ntsc_filter_row(ntsc, w->acc, ntsc->job_in + y * WINDOW_W, ntsc->job_out + y * ntsc->out_w, y);
+  }
+}
+
+static int ntsc_worker_thread(void *data) {
+  ntsc_worker_t *w = data;
+  ntsc_t *ntsc = w->ntsc;
+
+  for (;;) {
+    SDL_SemWait(ntsc->go);
+    if (ntsc->quit)
+      break;
+
+    ntsc_filter_rows(w);
+    SDL_SemPost(ntsc->done);
+  }
+  return 0;
+}
+
+void ntsc_filter(ntsc_t *ntsc, const pixel_t *in, u32 *out, const u16 *rows, u32 n_rows) {
+  ntsc->job_in = in;
+  ntsc->job_out = out;
+  ntsc->job_rows = rows;
+  ntsc->job_n_rows = n_rows;
+  SDL_AtomicSet(&ntsc->next_row, 0);
+
+  // Only wake the workers when there's enough for them to do
+  u32 helpers = MIN(ntsc->n_workers - 1, n_rows / 8);
+  for (u32 i = 0; i < helpers; i++)
+    SDL_SemPost(ntsc->go);
+  ntsc_filter_rows(&ntsc->workers[0]);
+  for (u32 i = 0; i < helpers; i++)
+    SDL_SemWait(ntsc->done);
+}
+
+void ntsc_destroy(ntsc_t *ntsc) {
+  if (ntsc->n_workers > 1) {
+    ntsc->quit = true;
+    for (u32 i = 1; i < ntsc->n_workers; i++)
+      SDL_SemPost(ntsc->go);
+    for (u32 i = 1; i < ntsc->n_workers; i++)
+      SDL_WaitThread(ntsc->workers[i].thread, NULL);
+    SDL_DestroySemaphore(ntsc->go);
+    SDL_DestroySemaphore(ntsc->done);
+  }
+
+  for (u32 i = 0; i < ntsc->n_workers; i++)
+    free(ntsc->workers[i].acc);
+  free(ntsc->workers);
+  free(ntsc->kernel);
+  memset(ntsc, 0, sizeof *ntsc);
+}
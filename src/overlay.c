@@ -0,0 +1,97 @@
+#include "include/overlay.h"
+#include "include/window.h"
+#include "include/ppu.h"
+#include "include/apu.h"
+#include "include/util.h"
+
+#include <ctype.h>
+
+// Glyphs for ' ' to 'Z', 5 rows of 3 pixels from the top left, most significant bit first. Characters without one
+// are drawn blank
+static const u16 OVERLAY_FONT['Z' - ' ' + 1] = {
+  ['%' - ' '] = 0x52A5, ['-' - ' '] = 0x01C0, ['.' - ' '] = 0x0002, ['/' - ' '] = 0x12A4, ['0' - ' '] = 0x7B6F,
+  ['1' - ' '] = 0x2C97, ['2' - ' '] = 0x73E7, ['3' - ' '] = 0x73CF, ['4' - ' '] = 0x5BC9, ['5' - ' '] = 0x79CF,
+  ['6' - ' '] = 0x79EF, ['7' - ' '] = 0x7249, ['8' - ' '] = 0x7BEF, ['9' - ' '] = 0x7BCF, [':' - ' '] = 0x0410,
+  ['A' - ' '] = 0x2BED, ['B' - ' '] = 0x6BAE, ['C' - ' '] = 0x3923, ['D' - ' '] = 0x6B6E, ['E' - ' '] = 0x79A7,
+  ['F' - ' '] = 0x79A4, ['G' - ' '] = 0x396B, ['H' - ' '] = 0x5BED, ['I' - ' '] = 0x7497, ['J' - ' '] = 0x126A,
+  ['K' - ' '] = 0x5BAD, ['L' - ' '] = 0x4927, ['M' - ' '] = 0x5FED, ['N' - ' '] = 0x6B6D, ['O' - ' '] = 0x2B6A,
+  ['P' - ' '] = 0x6BA4, ['Q' - ' '] = 0x2B73, ['R' - ' '] = 0x6BAD, ['S' - ' '] = 0x388E, ['T' - ' '] = 0x7492,
+  ['U' - ' '] = 0x5B6F, ['V' - ' '] = 0x5B6A, ['W' - ' '] = 0x5BFD, ['X' - ' '] = 0x5AAD, ['Y' - ' '] = 0x5A92,
+  ['Z' - ' '] = 0x72A7
+};
+
+void overlay_init(overlay_t *ov) {
+  memset(ov, 0, sizeof *ov);
+  ov->t0 = SDL_GetPerformanceCounter();
+  snprintf(ov->lines[0], OVERLAY_LINE_LEN, "FPS --");
+}
+
+// Formats a histogram's rolling median and 99th percentile in milliseconds
+static void overlay_hist(char *line, const char *label, perf_hist_t *hist) {
+  snprintf(line, OVERLAY_LINE_LEN, "%s %.2f/%.2f MS", label, SDL_AtomicGet(&hist->p50) / 1000.,
+           SDL_AtomicGet(&hist->p99) / 1000.);
+}
+
+void overlay_update(overlay_t *ov, nes_t *nes, window_t *wnd) {
+  if (++ov->frames < OVERLAY_UPDATE_FRAMES)
+    return;
+
+  u64 now = SDL_GetPerformanceCounter();
+  double fps = ov->frames * (double) SDL_GetPerformanceFrequency() / MAX(now - ov->t0, 1);
+  ov->frames = 0;
+  ov->t0 = now;
+
+  double audio_ms = apu_buffered_ms(nes);
+  snprintf(ov->lines[0], OVERLAY_LINE_LEN, "FPS %.1f", fps);
+  overlay_hist(ov->lines[1], "EMU", &wnd->perf_emu);
+  overlay_hist(ov->lines[2], "HOST", &wnd->perf_frame);
+  overlay_hist(ov->lines[3], "PRESENT", &wnd->perf_present);
+  if (audio_ms < 0)
+    snprintf(ov->lines[4], OVERLAY_LINE_LEN, "AUDIO OFF");
+  else
+    snprintf(ov->lines[4], OVERLAY_LINE_LEN, "AUDIO %.1f MS", audio_ms);
+}
+
+static void overlay_glyph(pixel_t *px, int c) {
+  c = toupper(c);
+  u16 glyph = c >= ' ' && c <= 'Z' ? OVERLAY_FONT[c - ' '] : 0;
+
+  for (u32 y = 0; y < OVERLAY_GLYPH_H; y++) {
+    for (u32 x = 0; x < OVERLAY_GLYPH_W; x++) {
+      if (glyph >> (14 - y * OVERLAY_GLYPH_W - x) & 1)
+        px[y * WINDOW_W + x] = OVERLAY_FG;
+    }
+  }
+}
+
+void overlay_draw(const overlay_t *ov, window_t *wnd) {
+  frame_t *frame = &wnd->fb[wnd->back];
+
+  // One pixel of background around each glyph
+  u32 cols = 0, rows = 0;
+  for (u32 i = 0; i < OVERLAY_LINES; i++) {
+    if (ov->lines[i][0]) {
+      cols = MAX(cols, strlen(ov->lines[i]));
+      rows = i + 1;
+    }
+  }
+  if (!rows)
+    return;
+  u32 w = cols * (OVERLAY_GLYPH_W + 1) + 1;
+  u32 h = rows * (OVERLAY_GLYPH_H + 1) + 1;
+
+  for (u32 y = 0; y < h; y++) {
+    pixel_t *px = frame->px + (OVERLAY_Y + y) * WINDOW_W + OVERLAY_X;
+    for (u32 x = 0; x < w; x++)
+      px[x] = OVERLAY_BG;
+  }
+
+  for (u32 i = 0; i < rows; i++) {
+    pixel_t *px = frame->px + (OVERLAY_Y + 1 + i * (OVERLAY_GLYPH_H + 1)) * WINDOW_W + OVERLAY_X + 1;
+    for (const char *c = ov->lines[i]; *c; c++, px += OVERLAY_GLYPH_W + 1)
+      overlay_glyph(px, *c);
+  }
+
+  for (u32 y = OVERLAY_Y; y < OVERLAY_Y + h; y++)
+    frame->row_hash[y] = ppu_row_hash(frame->px + y * WINDOW_W);
+}
@@ -0,0 +1,141 @@
+#include "include/pace.h"
+#include "include/apu.h"
+#include "include/log.h"
+#include "include/util.h"
+
+#include <math.h>
+
+#ifndef WIN32
+  #include <errno.h>
+  #include <time.h>
+#endif
+
+static const char *PACE_CLOCK_NAMES[] = {"timer", "audio"};
+
+static void pace_reset_stats(pace_stats_t *stats) {
+  memset(stats, 0, sizeof *stats);
+  stats->min = UINT64_MAX;
+}
+
+static void pace_add_stats(pace_stats_t *stats, u64 dt) {
+  stats->frames++;
+  stats->sum += (double) dt;
+  stats->sum_sq += (double) dt * dt;
+  stats->min = MIN(stats->min, dt);
+  stats->max = MAX(stats->max, dt);
+}
+
+// Restarts the schedule with the next frame due one period from now
+static void pace_restart(pace_t *pace) {
+  pace->base = SDL_GetPerformanceCounter();
+  pace->n = 0;
+}
+
+static void pace_set_rate(pace_t *pace, nes_t *nes, double hz, bool vsync) {
+  pace->hz = hz;
+  pace->period = pace->freq / hz;
+  pace->vsync = vsync;
+  pace_restart(pace);
+  apu_set_speed(nes, hz / NTSC_FRAME_RATE);
+}
+
+void pace_init(pace_t *pace) {
+  memset(pace, 0, sizeof *pace);
+  pace->freq = SDL_GetPerformanceFrequency();
+  pace->hz = NTSC_FRAME_RATE;
+  pace->period = pace->freq / NTSC_FRAME_RATE;
+  pace->clock = PACE_CLOCK_TIMER;
+  pace_restart(pace);
+  pace->last_frame = pace->base;
+  pace_reset_stats(&pace->total);
+  pace_reset_stats(&pace->recent);
+}
+
+// Sleeps for the given number of performance counter ticks. SDL_Delay() only has millisecond resolution, which is
+// most of a frame's worth of jitter at 60 Hz, so nanosleep() is used where there is one
+static void pace_sleep(pace_t *pace, u64 ticks) {
+#ifndef WIN32
+  u64 ns = (u64) ((double) ticks * 1e9 / pace->freq);
+  struct timespec ts = {.tv_sec = (time_t) (ns / 1000000000), .tv_nsec = (long) (ns % 1000000000)};
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    ;
+#else
+  SDL_Delay((u32) (ticks * 1000 / pace->freq));
+#endif
+}
+
+// Follows the display's refresh rate if it's close enough to the NES's
+static void pace_follow_vsync(pace_t *pace, nes_t *nes, window_t *wnd) {
+  int period = SDL_AtomicGet(&wnd->vsync_period);
+  if (period == pace->vsync_period)
+    return;
+  pace->vsync_period = period;
+
+  double hz = (double) pace->freq / period;
+  double ppm = (hz - NTSC_FRAME_RATE) * 1e6 / NTSC_FRAME_RATE;
+  bool vsync = fabs(ppm) <= PACE_VSYNC_MAX_PPM;
+  if (vsync) {
+    if (pace->vsync && fabs(hz - pace->hz) * 1e6 / pace->hz < PACE_RETUNE_PPM)
+      return;
+    if (!pace->vsync)
+      log_msg(LOG_INFO, LOG_CAT_MAIN, "pace: display refreshes at %.4f Hz, following it", hz);
+    pace_set_rate(pace, nes, hz, true);
+  } else if (pace->vsync) {
+    log_msg(LOG_INFO, LOG_CAT_MAIN, "pace: display refreshes at %.4f Hz, back to %.4f Hz", hz, NTSC_FRAME_RATE);
+    pace_set_rate(pace, nes, NTSC_FRAME_RATE, false);
+  }
+}
+
+static void pace_log_stats(const pace_t *pace, const pace_stats_t *stats, log_level_t level, const char *what) {
+  if (!stats->frames)
+    return;
+
+  double ms = 1000. / pace->freq;
+  double mean = stats->sum / stats->frames;
+  double var = stats->sum_sq / stats->frames - mean * mean;
+  log_msg(level, LOG_CAT_MAIN, "pace: %s: %lu frames at %.4f Hz, %s clock%s", what, (unsigned long) stats->frames,
+          pace->hz, PACE_CLOCK_NAMES[pace->clock], pace->vsync ? ", following vsync" : "");
+  log_msg(level, LOG_CAT_MAIN, "pace: %s: frame time %.3f ms, jitter %.3f ms, %.3f to %.3f ms, %lu late wakeups", what,
+          mean * ms, sqrt(MAX(var, 0)) * ms, stats->min * ms, stats->max * ms, (unsigned long) stats->late);
+}
+
+void pace_frame(pace_t *pace, nes_t *nes, window_t *wnd) {
+  pace_follow_vsync(pace, nes, wnd);
+
+  bool late = false;
+  if (apu_wait(nes)) {
+    // Audio did the pacing, so the schedule restarts from here
+    pace->clock = PACE_CLOCK_AUDIO;
+    pace_restart(pace);
+  } else {
+    pace->clock = PACE_CLOCK_TIMER;
+    u64 deadline = pace->base + (u64) (++pace->n * pace->period);
+    u64 now = SDL_GetPerformanceCounter();
+    if (now < deadline) {
+      pace_sleep(pace, deadline - now);
+      u64 woke = SDL_GetPerformanceCounter();
+      late = woke > deadline && woke - deadline > pace->freq * PACE_LATE_US / 1000000;
+    } else {
+      pace_restart(pace);  // Don't try to catch up after a stall (window drag, debugger, ...)
+    }
+  }
+
+  u64 now = SDL_GetPerformanceCounter();
+  u64 dt = now - pace->last_frame;
+  pace->last_frame = now;
+  perf_add(&wnd->perf_frame, dt);
+  pace_add_stats(&pace->total, dt);
+  pace_add_stats(&pace->recent, dt);
+  pace->total.late += late;
+  pace->recent.late += late;
+
+  if (pace->recent.frames == PACE_REPORT_FRAMES) {
+    pace_log_stats(pace, &pace->recent, LOG_DEBUG, "last frames");
+    pace_reset_stats(&pace->recent);
+  }
+}
+
+void pace_destroy(pace_t *pace) {
+  pace_log_stats(pace, &pace->total, LOG_INFO, "total");
+  memset(pace, 0, sizeof *pace);
+}
@@ -0,0 +1,66 @@
+#include "include/palette.h"
+#include "include/util.h"
+
+#ifdef CNES_AVX2
+#include <immintrin.h>
+#endif
+
+// Each emphasis bit darkens the two other channels by about this much
+// (https://wiki.nesdev.com/w/index.php/NTSC_video)
+#define PALETTE_EMPH_ATTEN 0.816328
+
+// Palette from http://www.firebrandx.com/nespalette.html
+void palette_load(palette_t *pal, const char *fn) {
+  // Palletes are stored as 64 sets of three integers for r, g, and b intensities
+  color_t colors[PALETTE_SZ];
+
+  // Since we're directly reading palette data into struct, we need to make sure that each palette struct is three
+  // bytes long. (R,G,B)
+  assert(sizeof *colors == 3);
+  FILE *palette_f = nes_fopen((char *) fn, "rb");
+  nes_fread(colors, sizeof *colors, PALETTE_SZ, palette_f);
+  nes_fclose(palette_f);
+
+  // Emphasis bits are red, green and blue from the lowest up
+  SDL_PixelFormat *pixel_fmt = SDL_AllocFormat(SDL_PIXELFORMAT_ARGB32);
+  for (int emph = 0; emph < 8; emph++) {
+    double r = emph & 6 ? PALETTE_EMPH_ATTEN : 1;
+    double g = emph & 5 ? PALETTE_EMPH_ATTEN : 1;
+    double b = emph & 3 ? PALETTE_EMPH_ATTEN : 1;
+
+    for (int i = 0; i < PALETTE_SZ; i++) {
+      color_t c = colors[i];
+      pal->argb[emph << PALETTE_EMPH_SHIFT | i] = SDL_MapRGBA(pixel_fmt, (u8) (c.r * r), (u8) (c.g * g),
+                                                              (u8) (c.b * b), 0xFF);
+    }
+  }
+
+  SDL_FreeFormat(pixel_fmt);
+
+  pal->avx2 = SDL_HasAVX2();
+}
+
+#ifdef CNES_AVX2
+// Widens 8 pixels at a time to 32 bits and gathers their colors. Returns the number of pixels converted
+CNES_AVX2 static u32 palette_to_argb_avx2(const palette_t *pal, const pixel_t *in, u32 *out, u32 n) {
+  u32 i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i idx = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (in + i)));
+    __m256i argb = _mm256_i32gather_epi32((const int *) pal->argb, idx, 4);
+    _mm256_storeu_si256((__m256i *) (out + i), argb);
+  }
+  return i;
+}
+#endif
+
+void palette_to_argb(const palette_t *pal, const pixel_t *in, u32 *out, u32 n) {
+  u32 i = 0;
+
+#ifdef CNES_AVX2
+  if (pal->avx2)
+    i = palette_to_argb_avx2(pal, in, out, n);
+#endif
+
+  for (; i < n; i++)
+    out[i] = pal->argb[in[i]];
+}
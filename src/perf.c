@@ -0,0 +1,96 @@
+#include "include/perf.h"
+#include "include/log.h"
+#include "include/util.h"
+
+// Performance counter ticks per second, the same for every histogram
+static u64 perf_freq;
+
+// The bucket a sample of us microseconds falls into. Below PERF_SUB_BUCKETS µs every microsecond has a bucket, above
+// that each power of two is split in PERF_SUB_BUCKETS
+static u32 perf_bucket(u32 us) {
+  if (us < PERF_SUB_BUCKETS)
+    return us;
+
+  u32 e = 4;  // log2(PERF_SUB_BUCKETS)
+  while (us >> (e + 1))
+    e++;
+  return MIN(PERF_SUB_BUCKETS * (e - 3) + ((us >> (e - 4)) & (PERF_SUB_BUCKETS - 1)), PERF_BUCKETS - 1);
+}
+
+// The smallest duration that falls into bucket b, i.e. its lower bound
+static u32 perf_bucket_start(u32 b) {
+  if (b < PERF_SUB_BUCKETS)
+    return b;
+  return (PERF_SUB_BUCKETS + (b & (PERF_SUB_BUCKETS - 1))) << (b / PERF_SUB_BUCKETS - 1);
+}
+
+// The value under which at least q of the n samples in buckets fall, assuming the samples in a bucket are spread
+// evenly across it. Bucket counts are u32 for the rolling window and u64 for the total, so they're passed in as u64
+static u32 perf_percentile(const u64 *buckets, u64 n, double q, u32 max) {
+  u64 rank = (u64) (q * n + 0.999999);
+  u64 sum = 0;
+
+  for (u32 b = 0; b < PERF_BUCKETS; b++) {
+    if (sum + buckets[b] >= rank) {
+      double lo = perf_bucket_start(b);
+      double hi = b + 1 < PERF_BUCKETS ? perf_bucket_start(b + 1) : max;
+      double us = lo + (hi - lo) * ((double) (rank - sum) - 0.5) / buckets[b];
+      return MIN((u32) us, max);
+    }
+    sum += buckets[b];
+  }
+  return max;
+}
+
+void perf_init(perf_hist_t *hist, const char *name) {
+  memset(hist, 0, sizeof *hist);
+  hist->name = name;
+  perf_freq = SDL_GetPerformanceFrequency();
+}
+
+// Publishes the percentiles over the rolling window and starts filling the oldest slot again
+static void perf_publish(perf_hist_t *hist) {
+  u64 buckets[PERF_BUCKETS] = {0};
+  u64 n = 0;
+  u32 max = 0;
+
+  for (u32 s = 0; s < PERF_SLOTS; s++) {
+    for (u32 b = 0; b < PERF_BUCKETS; b++) {
+      buckets[b] += hist->slots[s][b];
+      n += hist->slots[s][b];
+    }
+    max = MAX(max, hist->slot_max[s]);
+  }
+
+  SDL_AtomicSet(&hist->p50, (int) perf_percentile(buckets, n, 0.5, max));
+  SDL_AtomicSet(&hist->p99, (int) perf_percentile(buckets, n, 0.99, max));
+  SDL_AtomicSet(&hist->max, (int) max);
+
+  hist->slot = (hist->slot + 1) % PERF_SLOTS;
+  hist->slot_n = 0;
+  hist->slot_max[hist->slot] = 0;
+  memset(hist->slots[hist->slot], 0, sizeof hist->slots[hist->slot]);
+}
+
+void perf_add(perf_hist_t *hist, u64 ticks) {
+  u32 us = (u32) MIN(ticks * 1000000 / perf_freq, UINT32_MAX);
+  u32 b = perf_bucket(us);
+
+  hist->slots[hist->slot][b]++;
+  hist->slot_max[hist->slot] = MAX(hist->slot_max[hist->slot], us);
+  hist->total[b]++;
+  hist->total_n++;
+  hist->total_max = MAX(hist->total_max, us);
+
+  if (++hist->slot_n == PERF_SLOT_SAMPLES)
+    perf_publish(hist);
+}
+
+void perf_log_total(const perf_hist_t *hist) {
+  if (!hist->total_n)
+    return;
+
+  log_msg(LOG_INFO, LOG_CAT_MAIN, "perf: %s: %lu samples, p50 %.3f ms, p99 %.3f ms, max %.3f ms", hist->name,
+          (unsigned long) hist->total_n, perf_percentile(hist->total, hist->total_n, 0.5, hist->total_max) / 1000.,
+          perf_percentile(hist->total, hist->total_n, 0.99, hist->total_max) / 1000., hist->total_max / 1000.);
+}
@@ -5,50 +5,99 @@
 #include "include/cart.h"
 #include "include/args.h"
 #include "include/mappers.h"
+#include "include/log.h"
+#include "include/stats.h"
 
-// This variable stores the "phase" of the write-twice registers (PPUADDR & PPUSCROLL)
-static bool write_toggle = false;
 const u16 PRERENDER_LINE = 261;
 
-// Reads in a .pal file as the NES system palette
-static void ppu_palette_init(nes_t *nes, char *palette_fn) {
-  // Palletes are stored as 64 sets of three integers for r, g, and b intensities
-  color_t pal[PALETTE_SZ];
-
-  // Read in the palette
-  // Since we're directly reading palette data into struct, we need to make sure that each palette struct is three
-  // bytes long. (R,G,B)
-  assert(sizeof *pal == 3);
-  FILE *palette_f = nes_fopen(palette_fn, "rb");
-  nes_fread(pal, sizeof *pal, PALETTE_SZ, palette_f);
-  nes_fclose(palette_f);
-
-  // Initialize internal palette from read palette data
-  SDL_PixelFormat *pixel_fmt = SDL_AllocFormat(SDL_PIXELFORMAT_ARGB32);
-  for (int i = 0; i < PALETTE_SZ; i++)
-    nes->ppu->palette[i] = SDL_MapRGBA(pixel_fmt, pal[i].r, pal[i].g, pal[i].b, 0xFF);
-
-  SDL_FreeFormat(pixel_fmt);
-}
-
 bool ppu_rendering_enabled(ppu_t *ppu) {
   return GET_BIT(ppu->reg[PPUMASK], PPUMASK_SHOW_BGR_BIT) ||
          GET_BIT(ppu->reg[PPUMASK], PPUMASK_SHOW_SPR_BIT);
 }
 
-// Palette from http://www.firebrandx.com/nespalette.html
+static int ppu_render_thread(void *data);
+static int ppu_line_worker_thread(void *data);
+
+// Sets up the scanline workers. Every worker replays lines through its own PPU and mapper, CHR memory is shared
+static void ppu_line_workers_init(nes_t *nes, ppu_render_t *render) {
+  u32 n = nes->args->ppu_workers ? nes->args->ppu_workers : (u32) SDL_GetCPUCount();
+  render->n_workers = MAX(MIN(n, WINDOW_H), 1);
+  render->workers = nes_calloc(render->n_workers, sizeof *render->workers);
+
+  for (u32 i = 0; i < render->n_workers; i++) {
+    ppu_line_worker_t *w = &render->workers[i];
+    w->render = render;
+    w->nes.args = nes->args;
+    w->nes.ppu = &w->ppu;
+    w->nes.cart = &render->cart;
+    w->nes.mapper = &w->mapper;
+  }
+  if (render->n_workers == 1)
+    return;
+
+  render->lines = nes_malloc(WINDOW_H * sizeof *render->lines);
+  if ((render->lines_go = SDL_CreateSemaphore(0)) == NULL || (render->lines_done = SDL_CreateSemaphore(0)) == NULL)
+    crash_and_burn("ppu_line_workers_init: SDL_CreateSemaphore failed: %s\n", SDL_GetError());
+  for (u32 i = 1; i < render->n_workers; i++) {
+    render->workers[i].thread = SDL_CreateThread(ppu_line_worker_thread, "cnes-ppu-lines", &render->workers[i]);
+    if (render->workers[i].thread == NULL)
+      crash_and_burn("ppu_line_workers_init: SDL_CreateThread failed: %s\n", SDL_GetError());
+  }
+}
+
+// Starts the render thread from copies of the PPU, CHR memory and mapper as they are now
+static void ppu_render_init(nes_t *nes) {
+  ppu_t *ppu = nes->ppu;
+  ppu_render_t *render = ppu->render = nes_calloc(1, sizeof *render);
+
+  render->ppu = *ppu;
+  render->ppu.render = NULL;
+  render->ppu.replica = true;
+  render->cart = *nes->cart;
+  render->cart.chr = nes_malloc(nes->cart->chr_sz);
+  memcpy(render->cart.chr, nes->cart->chr, nes->cart->chr_sz);
+  render->mapper = *nes->mapper;
+  memcpy(&render->mapper_logged, nes->mapper, sizeof *nes->mapper);
+
+  render->nes.args = nes->args;
+  render->nes.ppu = &render->ppu;
+  render->nes.cart = &render->cart;
+  render->nes.mapper = &render->mapper;
+
+  for (int i = 0; i < 2; i++) {
+    render->log[i].cap = PPU_LOG_INIT_SZ;
+    render->log[i].recs = nes_malloc(PPU_LOG_INIT_SZ * sizeof *render->log[i].recs);
+    render->log[i].data_cap = PPU_LOG_INIT_DATA_SZ;
+    render->log[i].data = nes_malloc(PPU_LOG_INIT_DATA_SZ);
+  }
+  render->log_cur = &render->log[0];
+  render->frame_start = ppu->ticks;
+  ppu_line_workers_init(nes, render);
+
+  if ((render->ready = SDL_CreateSemaphore(0)) == NULL || (render->done = SDL_CreateSemaphore(0)) == NULL)
+    crash_and_burn("ppu_render_init: SDL_CreateSemaphore failed: %s\n", SDL_GetError());
+  if ((render->thread = SDL_CreateThread(ppu_render_thread, "cnes-ppu", render)) == NULL)
+    crash_and_burn("ppu_render_init: SDL_CreateThread failed: %s\n", SDL_GetError());
+
+  log_msg(LOG_INFO, LOG_CAT_PPU, "ppu_init: rendering on a separate thread, %u scanline worker%s", render->n_workers,
+          render->n_workers == 1 ? "" : "s");
+}
+
 void ppu_init(nes_t *nes) {
   ppu_t *ppu = nes->ppu;
 
   // Initialize all PPU fields to zero
   memset(ppu, 0, sizeof *ppu);
 
-  // Set up system palette
-  ppu_palette_init(nes, "../palette/palette.pal");
+  // The sprite view of OAM relies on each sprite being exactly four bytes long
+  assert(sizeof *ppu->oam_spr == 4);
+
+  if (nes->args->ppu_thread)
+    ppu_render_init(nes);
 }
 
-// Palette mirroring
-static u32 ppu_get_palette_color(ppu_t *ppu, u8 color_i) {
+// Palette mirroring. Returns the pixel for a system palette index, with the current color emphasis
+static pixel_t ppu_get_palette_color(ppu_t *ppu, u8 color_i) {
   // $3F10, $3F14, $3F18, $3F1C are mirrors of $3F00, $3F04, $3F08, $3F0C
   u8 adj_i = color_i;
   if (color_i >= 0x10) {
@@ -56,7 +105,7 @@ static u32 ppu_get_palette_color(ppu_t *ppu, u8 color_i) {
       adj_i &= ~0x10;  // Clear bit 4, mirroring the address down by 0x10
   }
 
-  return ppu->palette[adj_i];
+  return (adj_i & (PALETTE_SZ - 1)) | (ppu->reg[PPUMASK] >> 5) << PALETTE_EMPH_SHIFT;
 }
 
 // Info from https://wiki.nesdev.com/w/index.php/PPU_scrolling
@@ -104,10 +153,9 @@ static void ppu_increment_scroll_x(ppu_t *ppu) {
   }
 }
 
-// Renders a single pixel and returns it as an ARGB32 value. Runs during every PPU cycle.
-// pixels is an array of ARGB32 values representing the SDL framebuffer we are drawing to
+// Renders a single pixel and returns it as an indexed pixel (see palette.h). Runs during every PPU cycle.
 // Information from https://wiki.nesdev.com/w/index.php/PPU_scrolling
-static u32 ppu_render_pixel(nes_t *nes) {
+static pixel_t ppu_render_pixel(nes_t *nes) {
   // Rendering a pixel consists of rendering both background and sprites
   ppu_t *ppu = nes->ppu;
 
@@ -266,7 +314,7 @@ static u32 ppu_render_pixel(nes_t *nes) {
   // **************** End sprite rendering ****************
 
   // **************** Pixel multiplexer/display ****************
-  u32 final_pixel;
+  pixel_t final_pixel;
   u8 uni_bgr_color_idx = ppu_read(nes, PALETTE_BASE);
 
   if (!bgr_color_idx && !spr_color_idx)
@@ -297,20 +345,49 @@ static void ppu_fill_sec_oam(ppu_t *ppu, u16 scanline) {
   // Search through OAM to find sprites that are in range
   const u8 SPR_HEIGHT = GET_BIT(ppu->reg[PPUCTRL], PPUCTRL_SPRITE_SZ_BIT) ? 16 : 8;
   for (u8 i = 0, sec_oam_i = 0; i < OAM_NUM_SPR && sec_oam_i < SEC_OAM_NUM_SPR; i++) {
-    sprite_t cur_spr = ppu->oam[i];
+    sprite_t cur_spr = {.data = ppu->oam_spr[i], .sprite0 = i == 0};
 
     // Is the sprite in range, and does it already exist in the secondary OAM?
     if (scanline >= cur_spr.data.y_pos && scanline < cur_spr.data.y_pos + SPR_HEIGHT) {
       ppu->sec_oam[sec_oam_i++] = cur_spr;
     }
   }
+  ppu->spr0_on_line = ppu->sec_oam[0].sprite0;
 }
 
-// Emulates one PPU tick/cycle. Renders a single pixel at the current PPU position
-// Also controls timing and issues NMIs to the CPU on VBlank
-void ppu_tick(nes_t *nes, window_t *wnd, void *pixels) {
+// Whether the pixel at the current dot could set sprite zero hit, i.e. sprite 0 is under it and both layers are shown.
+// These are the only pixels that have to be rendered when nobody looks at the framebuffer
+static bool ppu_spr0_hit_possible(ppu_t *ppu) {
+  if (!ppu->spr0_on_line || GET_BIT(ppu->reg[PPUSTATUS], PPUSTATUS_ZEROHIT_BIT))
+    return false;
+  if (!GET_BIT(ppu->reg[PPUMASK], PPUMASK_SHOW_BGR_BIT) || !GET_BIT(ppu->reg[PPUMASK], PPUMASK_SHOW_SPR_BIT))
+    return false;
+
+  // Sprite 0 is always the first sprite in secondary OAM
+  u8 cur_x = ppu->dot - 1;
+  u8 spr_x = ppu->sec_oam[0].data.x_pos;
+  return cur_x > 7 && cur_x >= spr_x && cur_x < spr_x + 8;
+}
+
+// Hashes a finished row of pixels, 8 bytes at a time
+u64 ppu_row_hash(const pixel_t *row) {
+  u64 h = 0;
+
+  for (u32 i = 0; i < WINDOW_W * sizeof *row; i += sizeof h) {
+    u64 v;
+    memcpy(&v, (const u8 *) row + i, sizeof v);
+    h = (h ^ v) * 0x9E3779B97F4A7C15ull;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+// Emulates one PPU tick/cycle. Renders a single pixel at the current PPU position into frame_buf, if there is one,
+// and hashes each row when it's done. Also controls timing and issues NMIs to the CPU on VBlank. Returns true when
+// the frame is done
+static bool ppu_step(nes_t *nes, frame_t *frame_buf) {
   ppu_t *ppu = nes->ppu;
-  u32 *frame_buf = (u32 *) pixels;
+  bool frame_done = false;
 
   const u16 SCANLINE = ppu->scanline;
   const u16 DOT = ppu->dot;
@@ -324,11 +401,18 @@ void ppu_tick(nes_t *nes, window_t *wnd, void *pixels) {
 
       // TODO: Even and odd frames have slightly different behavior with idle cycles
     } else if (DOT >= 1 && DOT <= 256) {
-      // We're in the visible section of rendering, so render a pixel
-      u32 pixel = ppu_render_pixel(nes);
-
-      // ... then put it in the framebuffer
-      frame_buf[SCANLINE * WINDOW_W + DOT - 1] = pixel;
+      if (frame_buf) {
+        // We're in the visible section of rendering, so render a pixel
+        pixel_t pixel = ppu_render_pixel(nes);
+
+        // ... then put it in the framebuffer
+        frame_buf->px[SCANLINE * WINDOW_W + DOT - 1] = pixel;
+        if (DOT == 256)
+          frame_buf->row_hash[SCANLINE] = ppu_row_hash(frame_buf->px + SCANLINE * WINDOW_W);
+      } else if (ppu_spr0_hit_possible(ppu)) {
+        // Nothing is drawn, but sprite zero hit still has to happen on the exact dot
+        ppu_render_pixel(nes);
+      }
     } else if (DOT >= 258 && DOT <= 320) {
       // Set OAMADDR to 0
       ppu->reg[OAMADDR] = 0x00;
@@ -340,7 +424,7 @@ void ppu_tick(nes_t *nes, window_t *wnd, void *pixels) {
 //      ppu->nmi_occurred = true;
       SET_BIT(ppu->reg[PPUSTATUS], PPUSTATUS_VBLANK_BIT, 1);
 
-      if (GET_BIT(ppu->reg[PPUCTRL], PPUCTRL_NMI_ENABLE_BIT))
+      if (GET_BIT(ppu->reg[PPUCTRL], PPUCTRL_NMI_ENABLE_BIT) && !ppu->replica)
         nes->cpu->nmi = true;
     }
   } else if (SCANLINE == PRERENDER_LINE) {
@@ -348,7 +432,7 @@ void ppu_tick(nes_t *nes, window_t *wnd, void *pixels) {
     // Clear NMI flag on the second dot of the pre-render scanline
     if (DOT == 1) {
       // All visible scanlines have been rendered, frame is ready to be displayed
-      wnd->frame_ready = true;
+      frame_done = true;
       ppu->frameno++;
 //      ppu->nmi_occurred = false;
       SET_BIT(ppu->reg[PPUSTATUS], PPUSTATUS_VBLANK_BIT, 0);
@@ -400,34 +484,261 @@ void ppu_tick(nes_t *nes, window_t *wnd, void *pixels) {
       if (++ppu->scanline >= NUM_SCANLINES)
           ppu->scanline = 0;
   }
+
+  return frame_done;
+}
+
+void ppu_tick(nes_t *nes, window_t *wnd, frame_t *frame) {
+  // With a render thread the pixels are drawn there
+  if (ppu_step(nes, nes->ppu->render ? NULL : frame))
+    wnd->frame_ready = true;
+}
+
+// Appends a record to the render thread's log for the current frame
+static void ppu_log(ppu_t *ppu, ppu_log_kind_t kind, u8 addr, u8 val) {
+  ppu_render_t *render = ppu->render;
+  ppu_log_t *log = render->log_cur;
+
+  if (log->n == log->cap) {
+    log->cap *= 2;
+    log->recs = nes_realloc(log->recs, log->cap * sizeof *log->recs);
+  }
+  log->recs[log->n++] = (ppu_log_rec_t) {
+      .dot = (u32) (ppu->ticks - render->frame_start), .kind = kind, .addr = addr, .val = val};
+}
+
+// Appends a record whose payload is stored in the frame's data
+static void ppu_log_data(ppu_t *ppu, ppu_log_kind_t kind, const void *data, u32 len) {
+  ppu_log_t *log = ppu->render->log_cur;
+
+  ppu_log(ppu, kind, 0, 0);
+  if (log->data_len + len > log->data_cap) {
+    log->data_cap = MAX(2 * log->data_cap, log->data_len + len);
+    log->data = nes_realloc(log->data, log->data_cap);
+  }
+  memcpy(log->data + log->data_len, data, len);
+  log->data_len += len;
+}
+
+void ppu_oam_write(nes_t *nes, u8 addr, u8 val) {
+  ppu_t *ppu = nes->ppu;
+
+  ppu->oam[addr] = val;
+  if (ppu->render)
+    ppu_log(ppu, PPU_LOG_OAM, addr, val);
+}
+
+void ppu_oam_page_written(nes_t *nes) {
+  ppu_t *ppu = nes->ppu;
+
+  if (ppu->render)
+    ppu_log_data(ppu, PPU_LOG_OAM_PAGE, ppu->oam, OAM_SZ);
+}
+
+void ppu_mapper_written(nes_t *nes) {
+  ppu_render_t *render = nes->ppu->render;
+
+  // Most mapper writes are PRG bank switches, which the render thread doesn't care about
+  if (!render || memcmp(nes->mapper, &render->mapper_logged, sizeof *nes->mapper) == 0)
+    return;
+
+  memcpy(&render->mapper_logged, nes->mapper, sizeof *nes->mapper);
+  ppu_log_data(nes->ppu, PPU_LOG_MAPPER, nes->mapper, sizeof *nes->mapper);
+}
+
+// Applies the log record at pos to nes' PPU and mapper, and moves pos past it
+static void ppu_replay_rec(nes_t *nes, ppu_log_t *log, ppu_replay_pos_t *pos) {
+  ppu_log_rec_t *rec = &log->recs[pos->rec++];
+
+  switch (rec->kind) {
+    case PPU_LOG_REG_WRITE:
+      ppu_reg_write(nes, rec->addr, rec->val);
+      break;
+    case PPU_LOG_REG_READ:
+      ppu_reg_read(nes, rec->addr);
+      break;
+    case PPU_LOG_OAM:
+      nes->ppu->oam[rec->addr] = rec->val;
+      break;
+    case PPU_LOG_OAM_PAGE:
+      memcpy(nes->ppu->oam, log->data + pos->data_pos, OAM_SZ);
+      pos->data_pos += OAM_SZ;
+      break;
+    case PPU_LOG_MAPPER:
+      memcpy(nes->mapper, log->data + pos->data_pos, sizeof *nes->mapper);
+      pos->data_pos += sizeof *nes->mapper;
+      break;
+  }
+}
+
+// Replays a frame's log from pos up to the given dot through nes, rasterizing into frame_buf if there is one. Records
+// are applied before the PPU cycle they were logged on. If lines isn't NULL, the state at the start of each visible
+// scanline is saved in it
+static void ppu_replay(nes_t *nes, ppu_log_t *log, ppu_replay_pos_t *pos, u32 end, frame_t *frame_buf,
+                       ppu_line_start_t *lines) {
+  ppu_t *ppu = nes->ppu;
+
+  for (;;) {
+    if (pos->rec < log->n && log->recs[pos->rec].dot == pos->dot) {
+      ppu_replay_rec(nes, log, pos);
+      continue;
+    }
+    if (pos->dot == end)
+      break;
+
+    if (lines && ppu->scanline < WINDOW_H && ppu->dot == 0)
+      lines[ppu->scanline] = (ppu_line_start_t) {.pos = *pos, .ppu = *ppu, .mapper = *nes->mapper};
+    ppu_step(nes, frame_buf);
+    pos->dot++;
+  }
+}
+
+// Rasterizes scanlines until none are left in the frame. Each line is replayed from its saved start, records logged
+// after its last dot are applied too but the worker's state is thrown away with the next line
+static void ppu_render_lines(ppu_line_worker_t *w) {
+  ppu_render_t *render = w->render;
+
+  for (int line; (line = SDL_AtomicAdd(&render->next_line, 1)) < WINDOW_H;) {
+    ppu_line_start_t *start = &render->lines[line];
+    ppu_replay_pos_t pos = start->pos;
+
+    w->ppu = start->ppu;
+    w->mapper = start->mapper;
+    ppu_replay(&w->nes, render->lines_log, &pos, pos.dot + DOTS_PER_SCANLINE, render->lines_fb, NULL);
+  }
+}
+
+static int ppu_line_worker_thread(void *data) {
+  ppu_line_worker_t *w = data;
+  ppu_render_t *render = w->render;
+
+  for (;;) {
+    SDL_SemWait(render->lines_go);
+    if (render->lines_quit)
+      break;
+
+    ppu_render_lines(w);
+    SDL_SemPost(render->lines_done);
+  }
+  return 0;
+}
+
+// Whether a PPUDATA write was logged between the given dots. Those are the only records that change memory the other
+// scanlines read
+static bool ppu_log_vram_written(ppu_log_t *log, u32 from, u32 to) {
+  for (u32 i = 0; i < log->n; i++) {
+    ppu_log_rec_t *rec = &log->recs[i];
+    if (rec->dot > to)
+      break;
+    if (rec->dot >= from && rec->kind == PPU_LOG_REG_WRITE && rec->addr == PPUDATA)
+      return true;
+  }
+  return false;
+}
+
+// Replays a frame's log through the render thread's PPU, rasterizing it into frame_buf
+static void ppu_render_frame(ppu_render_t *render, ppu_log_t *log, frame_t *frame_buf) {
+  nes_t *nes = &render->nes;
+  ppu_t *ppu = &render->ppu;
+  ppu_replay_pos_t pos = {0};
+
+  // Skipped frames are replayed without drawing, only to keep the state for the next one
+  if (!log->draw)
+    frame_buf = NULL;
+
+  if (frame_buf && render->n_workers > 1) {
+    // Frames start on the pre-render line, the visible lines are the next WINDOW_H lines from there
+    u32 vis_start = (NUM_SCANLINES - ppu->scanline) % NUM_SCANLINES * DOTS_PER_SCANLINE - ppu->dot;
+    u32 vis_end = vis_start + WINDOW_H * DOTS_PER_SCANLINE;
+
+    if (!ppu_log_vram_written(log, vis_start, vis_end)) {
+      ppu_replay(nes, log, &pos, vis_end, NULL, render->lines);
+
+      render->lines_log = log;
+      render->lines_fb = frame_buf;
+      SDL_AtomicSet(&render->next_line, 0);
+      for (u32 i = 1; i < render->n_workers; i++)
+        SDL_SemPost(render->lines_go);
+      ppu_render_lines(&render->workers[0]);
+      for (u32 i = 1; i < render->n_workers; i++)
+        SDL_SemWait(render->lines_done);
+    }
+  }
+
+  // Everything left, or the whole frame in order
+  ppu_replay(nes, log, &pos, log->dots, frame_buf, NULL);
+}
+
+static int ppu_render_thread(void *data) {
+  ppu_render_t *render = data;
+
+  for (u32 frame = 0;; frame++) {
+    SDL_SemWait(render->ready);
+
+    // ppu_destroy() posts once more without handing off a frame
+    if (frame == (u32) SDL_AtomicGet(&render->frames))
+      break;
+
+    ppu_render_frame(render, &render->log[frame & 1], &render->fb[frame & 1]);
+    SDL_SemPost(render->done);
+  }
+  return 0;
+}
+
+frame_t *ppu_end_frame(nes_t *nes, bool draw) {
+  ppu_t *ppu = nes->ppu;
+  ppu_render_t *render = ppu->render;
+
+  render->log_cur->dots = (u32) (ppu->ticks - render->frame_start);
+  render->log_cur->draw = draw;
+  render->frame_start = ppu->ticks;
+  u32 frames = SDL_AtomicAdd(&render->frames, 1) + 1;
+  SDL_SemPost(render->ready);
+
+  // The frame before the one just handed off was rasterized while this one was emulated. Once it's done, its log and
+  // framebuffer are free: the log for the next frame, the framebuffer for the caller until then
+  frame_t *prev = NULL;
+  if (frames >= 2) {
+    SDL_SemWait(render->done);
+    if (render->log[frames & 1].draw)
+      prev = &render->fb[frames & 1];
+  }
+
+  render->log_cur = &render->log[frames & 1];
+  render->log_cur->n = 0;
+  render->log_cur->data_len = 0;
+  return prev;
 }
 
 u8 ppu_reg_read(nes_t *nes, ppureg_t reg) {
   ppu_t *ppu = nes->ppu;
 
+  // Only these reads change PPU state
+  if (ppu->render && (reg == PPUSTATUS || reg == PPUDATA))
+    ppu_log(ppu, PPU_LOG_REG_READ, reg, 0);
+
   u8 vram_inc, retval;
   switch (reg) {
     case PPUSTATUS:
       // Clear vblank bit every PPUSTATUS read
       retval = ppu->reg[PPUSTATUS];
-      write_toggle = false;
+      ppu->write_toggle = false;
       SET_BIT(ppu->reg[PPUSTATUS], PPUSTATUS_VBLANK_BIT, 0);
       return retval;
     case PPUDATA:
       // Increment VRAM addr by value specified in bit 2 of PPUCTRL
       vram_inc = GET_BIT(ppu->reg[PPUCTRL], PPUCTRL_VRAM_INC_BIT) ? 32 : 1;
-      static u8 read_buf;
 
       u16 temp_addr = ppu->vram_addr;
       ppu->vram_addr += vram_inc;
 
       // PPUDATA read buffer
-      retval = read_buf;
-      read_buf = ppu_read(nes, temp_addr);
+      retval = ppu->read_buf;
+      ppu->read_buf = ppu_read(nes, temp_addr);
 
       return retval;
     default:
-      printf("ppu_reg_read: cannot read from ppu reg $%02d\n", reg);
+      log_msg(LOG_WARN, LOG_CAT_PPU, "ppu_reg_read: cannot read from ppu reg $%02d", reg);
   }
 }
 
@@ -436,9 +747,12 @@ void ppu_reg_write(nes_t *nes, ppureg_t reg, u8 val) {
   ppu_t *ppu = nes->ppu;
   u8 vram_inc;
 
+  if (ppu->render)
+    ppu_log(ppu, PPU_LOG_REG_WRITE, reg, val);
+
   switch (reg) {
     case PPUSCROLL:  // $2005
-      if (!write_toggle) {
+      if (!ppu->write_toggle) {
         // First write, copy coarse/fine x to temp addr
         ppu->temp_addr &= ~0x1F;
         ppu->temp_addr |= val >> 3;
@@ -451,13 +765,13 @@ void ppu_reg_write(nes_t *nes, ppureg_t reg, u8 val) {
         ppu->temp_addr &= ~(7 << 12);
         ppu->temp_addr |= (val & 7) << 12;
       }
-      write_toggle ^= true;
+      ppu->write_toggle ^= true;
       break;
     case PPUADDR:  // $2006
       // The first PPUADDR write is the high byte of VRAM to be accessed, and the second byte
       // is the low byte
       // Clear the vram address if we're writing a new one in
-      if (!write_toggle) {
+      if (!ppu->write_toggle) {
         // First write, copy upper two coarse y bits, both NT bits, and lower two bits of fine y
         ppu->temp_addr &= ~(0x3F << 8);
         ppu->temp_addr |= (val & 0x3F) << 8;
@@ -468,7 +782,7 @@ void ppu_reg_write(nes_t *nes, ppureg_t reg, u8 val) {
         ppu->vram_addr = ppu->temp_addr;
       }
 
-      write_toggle ^= true;  // Toggle ppuaddr_written
+      ppu->write_toggle ^= true;  // Toggle ppuaddr_written
       break;
     case PPUCTRL:  // $2000
       ppu->reg[PPUCTRL] = val;
@@ -492,40 +806,31 @@ void ppu_reg_write(nes_t *nes, ppureg_t reg, u8 val) {
       ppu->reg[OAMADDR] = val;
       break;
     case OAMDATA:  // $2004
-      if (ppu_rendering_enabled(ppu)) {
+      if (ppu_rendering_enabled(ppu) && !ppu->replica) {
         if (ppu->scanline == PRERENDER_LINE || (ppu->scanline >= 0 && ppu->scanline <= 239)) {
           // TODO: Implement the glitchy OAMADDR increment here
-          printf(
-              "ppu_reg_write: WARNING: OAMDATA write emulation during rendering is not implemented, continuing without glitchy increment");
+          log_msg(LOG_WARN, LOG_CAT_PPU, "ppu_reg_write: OAMDATA write during rendering is not implemented, "
+                                         "continuing without glitchy increment");
         }
       }
 
-      // Get index into our OAM abstraction from OAMADDR
-      // Basically, turn OAMADDR (0x00-0xFF) into a 0-63 index into our sprite_t[64] OAM
-      // We do this by masking out the lower two bits (these two bits select the sprite attribute
-      // we will change)
-      u8 oam_idx = (ppu->reg[OAMADDR] & 0xFC) >> 2;
-      u8 attr_idx = ppu->reg[OAMADDR] & 3;  // Extract lower two bits
-
-      // Write the value to OAM
-      if (attr_idx == 0)
-        ppu->oam[oam_idx].data.y_pos = val;
-      else if (attr_idx == 1)
-        ppu->oam[oam_idx].data.tile_idx = val;
-      else if (attr_idx == 2)
-        ppu->oam[oam_idx].data.attr = val;
-      else if (attr_idx == 3)
-        ppu->oam[oam_idx].data.x_pos = val;
+      // OAM is stored as raw bytes, so OAMADDR indexes it directly
+      ppu->oam[ppu->reg[OAMADDR]] = val;
 
       break;
     default:
-      printf("ppu_reg_write: cannot write to ppu reg $%02d\n", reg);
+      // The emulation thread already warned about it, replicas can't log
+      if (!ppu->replica)
+        log_msg(LOG_WARN, LOG_CAT_PPU, "ppu_reg_write: cannot write to ppu reg $%02d", reg);
 //      exit(EXIT_FAILURE);
   }
 }
 
 // Read from CHR ROM/RAM
 u8 ppu_read(nes_t *nes, u16 addr) {
+  // The counters belong to the emulation thread
+  if (!nes->ppu->replica)
+    STAT_INC(ppu_reads[STATS_PPU_REGION(addr)]);
   return nes->mapper->ppu_read(nes, addr);
 }
 
@@ -535,6 +840,34 @@ void ppu_write(nes_t *nes, u16 addr, u8 val) {
 }
 
 void ppu_destroy(nes_t *nes) {
+  ppu_render_t *render = nes->ppu->render;
+
+  if (render) {
+    // Let the render thread finish the frames it was handed and exit
+    SDL_SemPost(render->ready);
+    SDL_WaitThread(render->thread, NULL);
+    SDL_DestroySemaphore(render->ready);
+    SDL_DestroySemaphore(render->done);
+
+    for (int i = 0; i < 2; i++) {
+      free(render->log[i].recs);
+      free(render->log[i].data);
+    }
+    if (render->n_workers > 1) {
+      render->lines_quit = true;
+      for (u32 i = 1; i < render->n_workers; i++)
+        SDL_SemPost(render->lines_go);
+      for (u32 i = 1; i < render->n_workers; i++)
+        SDL_WaitThread(render->workers[i].thread, NULL);
+      SDL_DestroySemaphore(render->lines_go);
+      SDL_DestroySemaphore(render->lines_done);
+    }
+    free(render->lines);
+    free(render->workers);
+    free(render->cart.chr);
+    free(render);
+  }
+
   memset(nes->ppu, 0, sizeof *nes->ppu);
 }
 
@@ -0,0 +1,268 @@
+#include "include/resample.h"
+#include "include/util.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RS_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef CNES_AVX2
+#include <immintrin.h>
+#endif
+
+// Interpolation kernel for each sub-sample phase: a windowed sinc with a cutoff of 19 kHz at the APU's ~55.9 kHz
+// internal rate and a Kaiser window (beta = 6), tap i of phase p sitting at x = i - (RS_TAPS / 2 - 1) - p / RS_PHASES
+// input samples from the output position. It passes everything under the 14 kHz output filter and is down more than
+// 40 dB at 22 kHz, so nothing that could alias back into the audible range survives at 44.1 kHz and up. The extra
+// last phase is phase 0 shifted by one sample so the phases can be interpolated between. Every phase sums to exactly
+// 1 << RS_KERNEL_BITS. The table is precomputed so the output doesn't depend on the host's libm
+static const i16 RS_KERNEL[RS_PHASES + 1][RS_TAPS] = {
+    {7, -25, 22, 33, -108, 96, 80, -308, 299, 139, -752, 850, 189, -2256, 4361, 11128,
+     4361, -2256, 189, 850, -752, 139, 299, -308, 80, 96, -108, 33, 22, -25, 7, 2},
+    {7, -25, 21, 35, -108, 91, 87, -309, 287, 157, -757, 822, 240, -2271, 4200, 11127,
+     4523, -2238, 138, 877, -747, 121, 310, -308, 73, 101, -109, 31, 24, -25, 7, 2},
+    {8, -24, 19, 36, -107, 86, 93, -309, 275, 175, -760, 793, 289, -2284, 4039, 11122,
+     4685, -2217, 85, 903, -741, 102, 322, -306, 66, 106, -109, 29, 25, -26, 7, 2},
+    {8, -24, 18, 38, -107, 81, 99, -308, 262, 192, -763, 764, 338, -2293, 3878, 11116,
+     4846, -2194, 32, 929, -734, 83, 333, -305, 59, 110, -109, 27, 26, -26, 6, 2},
+    {8, -24, 16, 40, -106, 77, 105, -308, 250, 209, -764, 734, 386, -2300, 3718, 11097,
+     5008, -2167, -21, 954, -726, 63, 344, -303, 52, 115, -109, 25, 28, -26, 6, 3},
+    {8, -23, 15, 41, -105, 72, 111, -307, 237, 226, -765, 704, 433, -2305, 3558, 11079,
+     5170, -2137, -76, 978, -717, 44, 354, -301, 45, 119, -109, 23, 29, -26, 6, 3},
+    {8, -23, 13, 43, -104, 67, 117, -306, 224, 242, -765, 673, 479, -2306, 3400, 11055,
+     5331, -2105, -131, 1002, -708, 24, 365, -298, 37, 124, -108, 21, 31, -26, 5, 3},
+    {9, -23, 12, 44, -103, 62, 122, -304, 212, 258, -764, 642, 523, -2305, 3242, 11027,
+     5492, -2069, -186, 1024, -697, 4, 375, -295, 30, 128, -108, 18, 32, -26, 5, 3},
+    {9, -22, 11, 46, -102, 56, 127, -302, 199, 273, -762, 611, 567, -2301, 3085, 10996,
+     5652, -2031, -242, 1046, -686, -16, 384, -292, 22, 132, -107, 16, 33, -26, 5, 3},
+    {9, -22, 9, 47, -100, 51, 133, -300, 185, 288, -759, 579, 609, -2295, 2928, 10961,
+     5812, -1989, -299, 1066, -673, -36, 394, -288, 14, 136, -107, 14, 35, -26, 4, 4},
+    {9, -21, 8, 48, -99, 46, 137, -297, 172, 302, -756, 547, 650, -2287, 2773, 10924,
+     5972, -1944, -356, 1086, -660, -57, 402, -284, 6, 140, -106, 11, 36, -26, 4, 4},
+    {9, -21, 6, 49, -97, 41, 142, -294, 159, 316, -751, 514, 690, -2276, 2620, 10882,
+     6130, -1897, -413, 1104, -646, -78, 411, -280, -2, 144, -105, 9, 37, -26, 3, 4},
+    {9, -20, 5, 50, -96, 36, 147, -291, 146, 330, -746, 481, 729, -2262, 2467, 10831,
+     6288, -1846, -471, 1122, -631, -98, 419, -275, -10, 148, -104, 6, 39, -26, 3, 4},
+    {9, -20, 4, 51, -94, 31, 151, -287, 132, 342, -740, 449, 766, -2247, 2316, 10780,
+     6444, -1792, -528, 1138, -615, -119, 427, -270, -18, 151, -102, 4, 40, -26, 2, 5},
+    {9, -19, 2, 52, -92, 26, 155, -283, 119, 355, -734, 415, 802, -2229, 2166, 10725,
+     6600, -1736, -586, 1154, -598, -140, 434, -264, -26, 155, -101, 1, 41, -26, 2, 5},
+    {9, -19, 1, 53, -90, 21, 159, -279, 105, 367, -726, 382, 837, -2208, 2018, 10666,
+     6754, -1676, -644, 1168, -580, -161, 441, -259, -34, 158, -100, -2, 42, -26, 2, 5},
+    {9, -18, 0, 54, -88, 16, 162, -275, 92, 378, -718, 349, 871, -2186, 1871, 10600,
+     6908, -1613, -702, 1181, -562, -182, 448, -252, -42, 161, -98, -4, 44, -26, 1, 5},
+    {9, -17, -2, 55, -86, 12, 166, -270, 79, 389, -709, 316, 903, -2161, 1726, 10532,
+     7059, -1547, -760, 1192, -543, -203, 454, -246, -51, 164, -96, -7, 45, -25, 1, 5},
+    {9, -17, -3, 55, -84, 7, 169, -265, 65, 399, -699, 282, 933, -2135, 1582, 10465,
+     7210, -1478, -818, 1203, -523, -224, 459, -239, -59, 167, -94, -10, 46, -25, 0, 6},
+    {9, -16, -4, 56, -82, 2, 172, -260, 52, 409, -689, 249, 963, -2106, 1441, 10388,
+     7359, -1406, -876, 1212, -502, -245, 465, -232, -68, 170, -92, -12, 47, -25, -1, 6},
+    {9, -16, -5, 56, -80, -3, 174, -255, 39, 418, -678, 216, 990, -2076, 1301, 10312,
+     7506, -1331, -933, 1220, -480, -266, 469, -224, -76, 173, -90, -15, 48, -24, -1, 6},
+    {9, -15, -6, 57, -78, -8, 177, -249, 26, 427, -666, 182, 1017, -2044, 1163, 10231,
+     7651, -1253, -991, 1227, -458, -286, 473, -216, -84, 175, -88, -18, 49, -24, -2, 6},
+    {9, -14, -8, 57, -75, -12, 179, -243, 13, 435, -654, 149, 1042, -2009, 1028, 10144,
+     7795, -1172, -1048, 1232, -434, -307, 477, -208, -93, 177, -85, -21, 50, -24, -2, 6},
+    {9, -14, -9, 57, -73, -17, 181, -237, 0, 442, -641, 116, 1065, -1974, 894, 10058,
+     7936, -1088, -1104, 1237, -411, -327, 480, -199, -101, 179, -83, -24, 51, -23, -3, 7},
+    {9, -13, -10, 57, -70, -21, 183, -231, -13, 449, -628, 84, 1087, -1936, 763, 9964,
+     8076, -1002, -1160, 1239, -386, -348, 483, -190, -109, 181, -80, -26, 51, -23, -3, 7},
+    {9, -13, -11, 57, -68, -26, 184, -224, -26, 456, -613, 51, 1108, -1897, 634, 9870,
+     8213, -912, -1216, 1241, -361, -368, 485, -181, -118, 183, -77, -29, 52, -22, -4, 7},
+    {9, -12, -12, 57, -65, -30, 186, -217, -38, 462, -599, 19, 1127, -1856, 507, 9766,
+     8349, -819, -1270, 1241, -335, -387, 486, -172, -126, 184, -74, -32, 53, -21, -4, 7},
+    {9, -11, -13, 57, -63, -34, 187, -211, -50, 467, -584, -13, 1145, -1814, 382, 9666,
+     8482, -723, -1325, 1239, -308, -407, 487, -162, -134, 186, -71, -35, 54, -21, -5, 7},
+    {9, -11, -14, 57, -60, -38, 188, -204, -62, 471, -568, -44, 1161, -1770, 260, 9560,
+     8612, -625, -1378, 1236, -281, -426, 488, -152, -142, 187, -68, -38, 54, -20, -6, 8},
+    {9, -10, -15, 57, -57, -42, 188, -196, -74, 475, -552, -76, 1175, -1725, 140, 9454,
+     8740, -524, -1431, 1232, -253, -445, 488, -142, -150, 187, -65, -41, 55, -20, -6, 8},
+    {8, -9, -16, 57, -54, -46, 189, -189, -86, 479, -535, -106, 1188, -1679, 23, 9340,
+     8866, -420, -1482, 1226, -225, -464, 487, -131, -158, 188, -61, -43, 55, -19, -7, 8},
+    {8, -9, -16, 57, -52, -50, 189, -181, -98, 482, -518, -137, 1200, -1632, -92, 9226,
+     8989, -313, -1533, 1219, -196, -482, 486, -120, -166, 189, -58, -46, 56, -18, -8, 8},
+    {8, -8, -17, 56, -49, -54, 189, -174, -109, 484, -500, -167, 1210, -1583, -204, 9111,
+     9109, -204, -1583, 1210, -167, -500, 484, -109, -174, 189, -54, -49, 56, -17, -8, 8},
+    {8, -8, -18, 56, -46, -58, 189, -166, -120, 486, -482, -196, 1219, -1533, -313, 8989,
+     9226, -92, -1632, 1200, -137, -518, 482, -98, -181, 189, -50, -52, 57, -16, -9, 8},
+    {8, -7, -19, 55, -43, -61, 188, -158, -131, 487, -464, -225, 1226, -1482, -420, 8866,
+     9340, 23, -1679, 1188, -106, -535, 479, -86, -189, 189, -46, -54, 57, -16, -9, 8},
+    {8, -6, -20, 55, -41, -65, 187, -150, -142, 488, -445, -253, 1232, -1431, -524, 8740,
+     9454, 140, -1725, 1175, -76, -552, 475, -74, -196, 188, -42, -57, 57, -15, -10, 9},
+    {8, -6, -20, 54, -38, -68, 187, -142, -152, 488, -426, -281, 1236, -1378, -625, 8612,
+     9560, 260, -1770, 1161, -44, -568, 471, -62, -204, 188, -38, -60, 57, -14, -11, 9},
+    {7, -5, -21, 54, -35, -71, 186, -134, -162, 487, -407, -308, 1239, -1325, -723, 8482,
+     9666, 382, -1814, 1145, -13, -584, 467, -50, -211, 187, -34, -63, 57, -13, -11, 9},
+    {7, -4, -21, 53, -32, -74, 184, -126, -172, 486, -387, -335, 1241, -1270, -819, 8349,
+     9766, 507, -1856, 1127, 19, -599, 462, -38, -217, 186, -30, -65, 57, -12, -12, 9},
+    {7, -4, -22, 52, -29, -77, 183, -118, -181, 485, -368, -361, 1241, -1216, -912, 8213,
+     9870, 634, -1897, 1108, 51, -613, 456, -26, -224, 184, -26, -68, 57, -11, -13, 9},
+    {7, -3, -23, 51, -26, -80, 181, -109, -190, 483, -348, -386, 1239, -1160, -1002, 8076,
+     9964, 763, -1936, 1087, 84, -628, 449, -13, -231, 183, -21, -70, 57, -10, -13, 9},
+    {7, -3, -23, 51, -24, -83, 179, -101, -199, 480, -327, -411, 1237, -1104, -1088, 7936,
+     10058, 894, -1974, 1065, 116, -641, 442, 0, -237, 181, -17, -73, 57, -9, -14, 9},
+    {6, -2, -24, 50, -21, -85, 177, -93, -208, 477, -307, -434, 1232, -1048, -1172, 7795,
+     10144, 1028, -2009, 1042, 149, -654, 435, 13, -243, 179, -12, -75, 57, -8, -14, 9},
+    {6, -2, -24, 49, -18, -88, 175, -84, -216, 473, -286, -458, 1227, -991, -1253, 7651,
+     10231, 1163, -2044, 1017, 182, -666, 427, 26, -249, 177, -8, -78, 57, -6, -15, 9},
+    {6, -1, -24, 48, -15, -90, 173, -76, -224, 469, -266, -480, 1220, -933, -1331, 7506,
+     10312, 1301, -2076, 990, 216, -678, 418, 39, -255, 174, -3, -80, 56, -5, -16, 9},
+    {6, -1, -25, 47, -12, -92, 170, -68, -232, 465, -245, -502, 1212, -876, -1406, 7359,
+     10388, 1441, -2106, 963, 249, -689, 409, 52, -260, 172, 2, -82, 56, -4, -16, 9},
+    {6, 0, -25, 46, -10, -94, 167, -59, -239, 459, -224, -523, 1203, -818, -1478, 7210,
+     10465, 1582, -2135, 933, 282, -699, 399, 65, -265, 169, 7, -84, 55, -3, -17, 9},
+    {5, 1, -25, 45, -7, -96, 164, -51, -246, 454, -203, -543, 1192, -760, -1547, 7059,
+     10532, 1726, -2161, 903, 316, -709, 389, 79, -270, 166, 12, -86, 55, -2, -17, 9},
+    {5, 1, -26, 44, -4, -98, 161, -42, -252, 448, -182, -562, 1181, -702, -1613, 6908,
+     10600, 1871, -2186, 871, 349, -718, 378, 92, -275, 162, 16, -88, 54, 0, -18, 9},
+    {5, 2, -26, 42, -2, -100, 158, -34, -259, 441, -161, -580, 1168, -644, -1676, 6754,
+     10666, 2018, -2208, 837, 382, -726, 367, 105, -279, 159, 21, -90, 53, 1, -19, 9},
+    {5, 2, -26, 41, 1, -101, 155, -26, -264, 434, -140, -598, 1154, -586, -1736, 6600,
+     10725, 2166, -2229, 802, 415, -734, 355, 119, -283, 155, 26, -92, 52, 2, -19, 9},
+    {5, 2, -26, 40, 4, -102, 151, -18, -270, 427, -119, -615, 1138, -528, -1792, 6444,
+     10780, 2316, -2247, 766, 449, -740, 342, 132, -287, 151, 31, -94, 51, 4, -20, 9},
+    {4, 3, -26, 39, 6, -104, 148, -10, -275, 419, -98, -631, 1122, -471, -1846, 6288,
+     10831, 2467, -2262, 729, 481, -746, 330, 146, -291, 147, 36, -96, 50, 5, -20, 9},
+    {4, 3, -26, 37, 9, -105, 144, -2, -280, 411, -78, -646, 1104, -413, -1897, 6130,
+     10882, 2620, -2276, 690, 514, -751, 316, 159, -294, 142, 41, -97, 49, 6, -21, 9},
+    {4, 4, -26, 36, 11, -106, 140, 6, -284, 402, -57, -660, 1086, -356, -1944, 5972,
+     10924, 2773, -2287, 650, 547, -756, 302, 172, -297, 137, 46, -99, 48, 8, -21, 9},
+    {4, 4, -26, 35, 14, -107, 136, 14, -288, 394, -36, -673, 1066, -299, -1989, 5812,
+     10961, 2928, -2295, 609, 579, -759, 288, 185, -300, 133, 51, -100, 47, 9, -22, 9},
+    {3, 5, -26, 33, 16, -107, 132, 22, -292, 384, -16, -686, 1046, -242, -2031, 5652,
+     10996, 3085, -2301, 567, 611, -762, 273, 199, -302, 127, 56, -102, 46, 11, -22, 9},
+    {3, 5, -26, 32, 18, -108, 128, 30, -295, 375, 4, -697, 1024, -186, -2069, 5492,
+     11027, 3242, -2305, 523, 642, -764, 258, 212, -304, 122, 62, -103, 44, 12, -23, 9},
+    {3, 5, -26, 31, 21, -108, 124, 37, -298, 365, 24, -708, 1002, -131, -2105, 5331,
+     11055, 3400, -2306, 479, 673, -765, 242, 224, -306, 117, 67, -104, 43, 13, -23, 8},
+    {3, 6, -26, 29, 23, -109, 119, 45, -301, 354, 44, -717, 978, -76, -2137, 5170,
+     11079, 3558, -2305, 433, 704, -765, 226, 237, -307, 111, 72, -105, 41, 15, -23, 8},
+    {3, 6, -26, 28, 25, -109, 115, 52, -303, 344, 63, -726, 954, -21, -2167, 5008,
+     11097, 3718, -2300, 386, 734, -764, 209, 250, -308, 105, 77, -106, 40, 16, -24, 8},
+    {2, 6, -26, 26, 27, -109, 110, 59, -305, 333, 83, -734, 929, 32, -2194, 4846,
+     11116, 3878, -2293, 338, 764, -763, 192, 262, -308, 99, 81, -107, 38, 18, -24, 8},
+    {2, 7, -26, 25, 29, -109, 106, 66, -306, 322, 102, -741, 903, 85, -2217, 4685,
+     11122, 4039, -2284, 289, 793, -760, 175, 275, -309, 93, 86, -107, 36, 19, -24, 8},
+    {2, 7, -25, 24, 31, -109, 101, 73, -308, 310, 121, -747, 877, 138, -2238, 4523,
+     11127, 4200, -2271, 240, 822, -757, 157, 287, -309, 87, 91, -108, 35, 21, -25, 7},
+    {2, 7, -25, 22, 33, -108, 96, 80, -308, 299, 139, -752, 850, 189, -2256, 4361,
+     11128, 4361, -2256, 189, 850, -752, 139, 299, -308, 80, 96, -108, 33, 22, -25, 7}
+};
+
+void resample_init(resampler_t *rs, u32 max_in, u32 in_rate) {
+  memset(rs, 0, sizeof *rs);
+
+  // The filter buffer keeps up to a kernel's worth of samples between calls
+  rs->buf_len = max_in + RS_TAPS + 1;
+  rs->buf = nes_calloc(rs->buf_len, sizeof *rs->buf);
+  rs->step = (u64) 1 << RS_FRAC_BITS;
+  rs->avx2 = SDL_HasAVX2();
+
+  // First order RC filters, w = 2 * pi * cutoff / in_rate. A high-pass has a = 1 / (1 + w) and a low-pass has
+  // b = w / (1 + w). Pi is approximated as 355 / 113 to keep this integer
+  u64 fs = 113ull * in_rate;
+  rs->hp90_a = (i32) (((u64) fs << 16) / (fs + 710 * 90));
+  rs->hp440_a = (i32) (((u64) fs << 16) / (fs + 710 * 440));
+  rs->lp14k_b = (i32) (((u64) 710 * 14000 << 16) / (fs + 710 * 14000));
+}
+
+void resample_destroy(resampler_t *rs) {
+  free(rs->buf);
+  memset(rs, 0, sizeof *rs);
+}
+
+void resample_set_ratio(resampler_t *rs, u64 in_rate, u64 out_rate) {
+  rs->step = (in_rate << RS_FRAC_BITS) / out_rate;
+}
+
+// Runs one sample through the NES's output filter chain
+static i16 resample_filter(resampler_t *rs, i16 in) {
+  i32 x = in * (1 << RS_FILTER_BITS);
+
+  i32 y = (i32) (((i64) rs->hp90_a * (rs->hp90_y + x - rs->hp90_x)) >> 16);
+  rs->hp90_x = x;
+  rs->hp90_y = y;
+
+  x = y;
+  y = (i32) (((i64) rs->hp440_a * (rs->hp440_y + x - rs->hp440_x)) >> 16);
+  rs->hp440_x = x;
+  rs->hp440_y = y;
+
+  rs->lp14k_y += (i32) (((i64) rs->lp14k_b * (y - rs->lp14k_y)) >> 16);
+
+  i32 s = rs->lp14k_y >> RS_FILTER_BITS;
+  return (i16) (s > INT16_MAX ? INT16_MAX : s < INT16_MIN ? INT16_MIN : s);
+}
+
+#ifdef CNES_AVX2
+// resample_dot() 16 taps at a time
+CNES_AVX2 static i32 resample_dot_avx2(const i16 *x, const i16 *k) {
+  __m256i acc = _mm256_setzero_si256();
+  for (int i = 0; i < RS_TAPS; i += 16) {
+    __m256i xv = _mm256_loadu_si256((const __m256i *) (x + i));
+    __m256i kv = _mm256_loadu_si256((const __m256i *) (k + i));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(xv, kv));
+  }
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
+}
+#endif
+
+// Dot product of RS_TAPS samples with a kernel phase
+static i32 resample_dot(const resampler_t *rs, const i16 *x, const i16 *k) {
+#ifdef CNES_AVX2
+  if (rs->avx2)
+    return resample_dot_avx2(x, k);
+#endif
+
+#if defined(RS_SSE2)
+  __m128i acc = _mm_setzero_si128();
+  for (int i = 0; i < RS_TAPS; i += 8) {
+    __m128i xv = _mm_loadu_si128((const __m128i *) (x + i));
+    __m128i kv = _mm_loadu_si128((const __m128i *) (k + i));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(xv, kv));
+  }
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(acc);
+#else
+  i32 acc = 0;
+  for (int i = 0; i < RS_TAPS; i++)
+    acc += x[i] * k[i];
+  return acc;
+#endif
+}
+
+u32 resample_process(resampler_t *rs, const i16 *in, u32 n_in, i16 *out, u32 max_out) {
+  assert(rs->avail + n_in <= rs->buf_len);
+  for (u32 i = 0; i < n_in; i++)
+    rs->buf[rs->avail++] = resample_filter(rs, in[i]);
+
+  u32 n_out = 0;
+  while (n_out < max_out) {
+    u32 idx = rs->pos >> RS_FRAC_BITS;
+    if (idx + RS_TAPS > rs->avail)
+      break;
+
+    // Evaluate the two phases around the output position and interpolate between them. Both dot products are done
+    // with the same integer math on every path, so the output is identical with or without SIMD
+    u32 frac = (u32) rs->pos;
+    u32 phase = frac >> (RS_FRAC_BITS - RS_PHASE_BITS);
+    i64 t = (frac >> (RS_FRAC_BITS - RS_PHASE_BITS - 16)) & 0xFFFF;
+    i64 a = resample_dot(rs, rs->buf + idx, RS_KERNEL[phase]);
+    i64 b = resample_dot(rs, rs->buf + idx, RS_KERNEL[phase + 1]);
+    i32 s = (i32) ((a * (0x10000 - t) + b * t) >> (16 + RS_KERNEL_BITS));
+    out[n_out++] = (i16) (s > INT16_MAX ? INT16_MAX : s < INT16_MIN ? INT16_MIN : s);
+
+    rs->pos += rs->step;
+  }
+
+  // Drop the input that no remaining output sample needs
+  u32 consumed = MIN((u32) (rs->pos >> RS_FRAC_BITS), rs->avail);
+  memmove(rs->buf, rs->buf + consumed, (rs->avail - consumed) * sizeof *rs->buf);
+  rs->avail -= consumed;
+  rs->pos -= (u64) consumed << RS_FRAC_BITS;
+
+  return n_out;
+}
@@ -0,0 +1,66 @@
+#include "include/ring.h"
+#include "include/util.h"
+
+void ring_init(ring_t *ring, u32 capacity) {
+  memset(ring, 0, sizeof *ring);
+
+  // Round up to a power of two so the indices can be masked
+  u32 sz = 1;
+  while (sz < capacity)
+    sz <<= 1;
+
+  ring->buf = nes_calloc(sz, sizeof *ring->buf);
+  ring->mask = sz - 1;
+}
+
+void ring_destroy(ring_t *ring) {
+  free(ring->buf);
+  memset(ring, 0, sizeof *ring);
+}
+
+// Copies n samples between src and the ring starting at index idx, wrapping around the end of the buffer
+static void ring_copy_in(ring_t *ring, u32 idx, const i16 *src, u32 n) {
+  u32 start = idx & ring->mask;
+  u32 first = MIN(n, ring_capacity(ring) - start);
+
+  memcpy(ring->buf + start, src, first * sizeof *src);
+  memcpy(ring->buf, src + first, (n - first) * sizeof *src);
+}
+
+static void ring_copy_out(ring_t *ring, u32 idx, i16 *dst, u32 n) {
+  u32 start = idx & ring->mask;
+  u32 first = MIN(n, ring_capacity(ring) - start);
+
+  memcpy(dst, ring->buf + start, first * sizeof *dst);
+  memcpy(dst + first, ring->buf, (n - first) * sizeof *dst);
+}
+
+u32 ring_write(ring_t *ring, const i16 *src, u32 n) {
+  u32 head = SDL_AtomicGet(&ring->head);
+  u32 space = ring_capacity(ring) - (head - (u32) SDL_AtomicGet(&ring->tail));
+
+  if (n > space) {
+    SDL_AtomicAdd(&ring->overruns, (int) (n - space));
+    n = space;
+  }
+
+  ring_copy_in(ring, head, src, n);
+
+  // Publish the samples only after they've been copied in
+  SDL_AtomicSet(&ring->head, (int) (head + n));
+  return n;
+}
+
+u32 ring_read(ring_t *ring, i16 *dst, u32 n) {
+  u32 tail = SDL_AtomicGet(&ring->tail);
+  u32 avail = (u32) SDL_AtomicGet(&ring->head) - tail;
+
+  if (n > avail) {
+    SDL_AtomicIncRef(&ring->underruns);
+    n = avail;
+  }
+
+  ring_copy_out(ring, tail, dst, n);
+  SDL_AtomicSet(&ring->tail, (int) (tail + n));
+  return n;
+}
@@ -0,0 +1,501 @@
+#include "include/scale.h"
+#include "include/window.h"
+#include "include/util.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCALE_SSE2
+#include <emmintrin.h>
+#endif
+
+static const char *SCALE_FILTER_NAMES[SCALE_NUM_FILTERS] = {"nearest", "scanlines", "scalex", "xbr"};
+
+// Alpha bits of an opaque pixel, to put back after darkening one
+static u32 scale_alpha;
+
+// xBR looks at the 5x5 pixels around each one, without the corners
+#define XBR_REACH  2
+#define XBR_STRIDE (WINDOW_W + 2 * XBR_REACH)
+#define XBR_ROWS   (2 * XBR_REACH + 1)
+#define XBR_EQ_MAX 155  // Colour distance under which two pixels count as alike
+
+// The neighbours xBR uses, named for the bottom right corner of E the way the algorithm is usually written: D and F
+// are left and right of it, B and H above and below, A C G I diagonal, F4 I4 two to the right and H5 I5 two below. The
+// other corners use the same positions rotated. A isn't needed at level 2
+enum { XBR_E, XBR_I, XBR_H, XBR_F, XBR_G, XBR_C, XBR_D, XBR_B, XBR_H5, XBR_F4, XBR_I5, XBR_I4, XBR_NUM_POS };
+static const i32 XBR_POS[XBR_NUM_POS][2] = {{0, 0},  {1, 1},  {0, 1}, {1, 0}, {-1, 1}, {1, -1},
+                                            {-1, 0}, {0, -1}, {0, 2}, {2, 0}, {1, 2},  {2, 1}};
+
+// How a corner is blended towards the colour across its edge, from a gentle diagonal to edges that run at 2:1
+enum { XBR_SOFT, XBR_DIAG, XBR_LEFT, XBR_UP, XBR_LEFT_UP, XBR_NUM_SHAPES };
+
+// Blend weights in eighths for each output pixel of the bottom right corner, per scale and shape
+static const u8 XBR_WEIGHTS[SCALE_MAX - 1][XBR_NUM_SHAPES][SCALE_MAX][SCALE_MAX] = {
+  {
+    {{0, 0}, {0, 4}},  // 2x
+    {{0, 0}, {0, 4}},
+    {{0, 0}, {2, 6}},
+    {{0, 2}, {0, 6}},
+    {{0, 2}, {2, 7}},
+  },
+  {
+    {{0, 0, 0}, {0, 0, 0}, {0, 0, 4}},  // 3x
+    {{0, 0, 0}, {0, 0, 2}, {0, 2, 7}},
+    {{0, 0, 0}, {0, 0, 2}, {2, 6, 8}},
+    {{0, 0, 2}, {0, 0, 6}, {0, 2, 8}},
+    {{0, 0, 2}, {0, 0, 6}, {2, 6, 8}},
+  },
+  {
+    {{0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 4}},  // 4x
+    {{0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 4}, {0, 0, 4, 8}},
+    {{0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 2, 6}, {2, 6, 8, 8}},
+    {{0, 0, 0, 2}, {0, 0, 0, 6}, {0, 0, 2, 8}, {0, 0, 6, 8}},
+    {{0, 0, 0, 2}, {0, 0, 0, 6}, {0, 0, 2, 8}, {2, 6, 8, 8}},
+  },
+};
+
+// For each corner, clockwise from the bottom right: the offsets of the neighbours in the padded rows and where each
+// output pixel of the bottom right corner ends up. Set up by scale_init()
+static i32 xbr_offset[4][XBR_NUM_POS];
+static u8 xbr_out[4][SCALE_MAX * SCALE_MAX];
+
+// Byte offsets of the colour channels in a pixel
+static u32 xbr_rshift, xbr_gshift, xbr_bshift;
+
+const char *scale_filter_name(scale_filter_t filter) {
+  return SCALE_FILTER_NAMES[filter];
+}
+
+int scale_filter_from_str(const char *str) {
+  for (u32 i = 0; i < SCALE_NUM_FILTERS; i++) {
+    if (strcmp(str, SCALE_FILTER_NAMES[i]) == 0)
+      return i;
+  }
+  return -1;
+}
+
+static int scale_worker_thread(void *data);
+
+void scale_init(scaler_t *scaler, scale_filter_t filter, u32 scale, u32 n_threads) {
+  memset(scaler, 0, sizeof *scaler);
+  if (filter == SCALE_NEAREST || filter >= SCALE_NUM_FILTERS)
+    crash_and_burn("scale_init: no scaler for filter %d\n", filter);
+  if (scale < 2 || scale > SCALE_MAX || (filter == SCALE_SCALEX && scale > 3))
+    crash_and_burn("scale_init: %s can't scale by %u\n", scale_filter_name(filter), scale);
+
+  scaler->filter = filter;
+  scaler->scale = scale;
+  scaler->out_w = WINDOW_W * scale;
+  scaler->reach = filter == SCALE_XBR ? XBR_REACH : filter == SCALE_SCALEX ? 1 : 0;
+
+  SDL_PixelFormat *fmt = SDL_AllocFormat(SDL_PIXELFORMAT_ARGB32);
+  scale_alpha = SDL_MapRGBA(fmt, 0, 0, 0, 0xFF);
+  xbr_rshift = fmt->Rshift;
+  xbr_gshift = fmt->Gshift;
+  xbr_bshift = fmt->Bshift;
+  SDL_FreeFormat(fmt);
+
+  // Each corner is the one before it turned a quarter clockwise: (x, y) becomes (-y, x)
+  for (u32 r = 0; r < 4; r++) {
+    for (u32 i = 0; i < XBR_NUM_POS; i++) {
+      i32 x = XBR_POS[i][0], y = XBR_POS[i][1];
+      for (u32 k = 0; k < r; k++) {
+        i32 t = x;
+        x = -y;
+        y = t;
+      }
+      xbr_offset[r][i] = y * XBR_STRIDE + x;
+    }
+    for (u32 sy = 0; sy < scale; sy++) {
+      for (u32 sx = 0; sx < scale; sx++) {
+        u32 x = sx, y = sy;
+        for (u32 k = 0; k < r; k++) {
+          u32 t = x;
+          x = scale - 1 - y;
+          y = t;
+        }
+        xbr_out[r][sy * scale + sx] = (u8) (y * scale + x);
+      }
+    }
+  }
+
+  u32 n = n_threads ? n_threads : (u32) SDL_GetCPUCount();
+  scaler->n_workers = MAX(MIN(n, WINDOW_H), 1);
+  scaler->workers = nes_calloc(scaler->n_workers, sizeof *scaler->workers);
+  for (u32 i = 0; i < scaler->n_workers; i++) {
+    scaler->workers[i].scaler = scaler;
+    if (filter == SCALE_XBR) {
+      scaler->workers[i].xbr_px = nes_malloc(XBR_ROWS * XBR_STRIDE * sizeof *scaler->workers[i].xbr_px);
+      scaler->workers[i].xbr_yuv = nes_malloc(XBR_ROWS * XBR_STRIDE * sizeof *scaler->workers[i].xbr_yuv);
+    }
+  }
+  if (scaler->n_workers == 1)
+    return;
+
+  if ((scaler->go = SDL_CreateSemaphore(0)) == NULL || (scaler->done = SDL_CreateSemaphore(0)) == NULL)
+    crash_and_burn("scale_init: SDL_CreateSemaphore failed: %s\n", SDL_GetError());
+  for (u32 i = 1; i < scaler->n_workers; i++) {
+    scaler->workers[i].thread = SDL_CreateThread(scale_worker_thread, "cnes-scale", &scaler->workers[i]);
+    if (scaler->workers[i].thread == NULL)
+      crash_and_burn("scale_init: SDL_CreateThread failed: %s\n", SDL_GetError());
+  }
+}
+
+// Repeats each of the n pixels of in scale times into out
+static void scale_widen(const u32 *in, u32 *out, u32 n, u32 scale) {
+  u32 x = 0;
+
+#ifdef SCALE_SSE2
+  if (scale == 2) {
+    for (; x + 4 <= n; x += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i *) (in + x));
+      _mm_storeu_si128((__m128i *) (out + 2 * x), _mm_unpacklo_epi32(v, v));
+      _mm_storeu_si128((__m128i *) (out + 2 * x + 4), _mm_unpackhi_epi32(v, v));
+    }
+  } else if (scale == 4) {
+    for (; x + 4 <= n; x += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i *) (in + x));
+      _mm_storeu_si128((__m128i *) (out + 4 * x), _mm_shuffle_epi32(v, 0x00));
+      _mm_storeu_si128((__m128i *) (out + 4 * x + 4), _mm_shuffle_epi32(v, 0x55));
+      _mm_storeu_si128((__m128i *) (out + 4 * x + 8), _mm_shuffle_epi32(v, 0xAA));
+      _mm_storeu_si128((__m128i *) (out + 4 * x + 12), _mm_shuffle_epi32(v, 0xFF));
+    }
+  }
+#endif
+
+  for (; x < n; x++) {
+    for (u32 i = 0; i < scale; i++)
+      out[scale * x + i] = in[x];
+  }
+}
+
+// Copies n pixels at half brightness
+static void scale_darken(const u32 *in, u32 *out, u32 n) {
+  u32 x = 0;
+
+#ifdef SCALE_SSE2
+  __m128i mask = _mm_set1_epi32(0x7F7F7F7F), alpha = _mm_set1_epi32((int) scale_alpha);
+  for (; x + 4 <= n; x += 4) {
+    __m128i v = _mm_srli_epi32(_mm_loadu_si128((const __m128i *) (in + x)), 1);
+    _mm_storeu_si128((__m128i *) (out + x), _mm_or_si128(_mm_and_si128(v, mask), alpha));
+  }
+#endif
+
+  for (; x < n; x++)
+    out[x] = (in[x] >> 1 & 0x7F7F7F7F) | scale_alpha;
+}
+
+static void scale_scanlines_row(const scaler_t *scaler, const u32 *in, u32 *out) {
+  scale_widen(in, out, WINDOW_W, scaler->scale);
+  for (u32 i = 1; i < scaler->scale - 1; i++)
+    memcpy(out + i * scaler->out_w, out, scaler->out_w * sizeof *out);
+  scale_darken(out, out + (scaler->scale - 1) * scaler->out_w, scaler->out_w);
+}
+
+// Scale2x for the pixel at x with the rows above and below it. E is the pixel, B and H are above and below, D and F to
+// the left and right. Each corner takes the color of the two neighbours next to it if they match and the other two
+// don't, which rounds off staircases without blurring anything
+static void scale2x_px(const u32 *up, const u32 *mid, const u32 *down, u32 *out0, u32 *out1, u32 x) {
+  u32 b = up[x], h = down[x], e = mid[x];
+  u32 d = mid[x ? x - 1 : x], f = mid[x < WINDOW_W - 1 ? x + 1 : x];
+
+  out0[2 * x] = d == b && b != f && d != h ? d : e;
+  out0[2 * x + 1] = b == f && b != d && f != h ? f : e;
+  out1[2 * x] = d == h && d != b && h != f ? d : e;
+  out1[2 * x + 1] = h == f && d != h && b != f ? f : e;
+}
+
+#ifdef SCALE_SSE2
+static inline __m128i scale_select(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+#endif
+
+static void scale2x_row(const u32 *up, const u32 *mid, const u32 *down, u32 *out0, u32 *out1) {
+  u32 x = 1;
+
+  scale2x_px(up, mid, down, out0, out1, 0);
+
+#ifdef SCALE_SSE2
+  // Four pixels at a time, as long as the one to the right of them is in the row
+  for (; x + 5 <= WINDOW_W; x += 4) {
+    __m128i b = _mm_loadu_si128((const __m128i *) (up + x));
+    __m128i h = _mm_loadu_si128((const __m128i *) (down + x));
+    __m128i d = _mm_loadu_si128((const __m128i *) (mid + x - 1));
+    __m128i e = _mm_loadu_si128((const __m128i *) (mid + x));
+    __m128i f = _mm_loadu_si128((const __m128i *) (mid + x + 1));
+
+    __m128i db = _mm_cmpeq_epi32(d, b), bf = _mm_cmpeq_epi32(b, f);
+    __m128i dh = _mm_cmpeq_epi32(d, h), hf = _mm_cmpeq_epi32(h, f);
+    __m128i e0 = scale_select(_mm_andnot_si128(_mm_or_si128(bf, dh), db), d, e);
+    __m128i e1 = scale_select(_mm_andnot_si128(_mm_or_si128(db, hf), bf), f, e);
+    __m128i e2 = scale_select(_mm_andnot_si128(_mm_or_si128(db, hf), dh), d, e);
+    __m128i e3 = scale_select(_mm_andnot_si128(_mm_or_si128(dh, bf), hf), f, e);
+
+    _mm_storeu_si128((__m128i *) (out0 + 2 * x), _mm_unpacklo_epi32(e0, e1));
+    _mm_storeu_si128((__m128i *) (out0 + 2 * x + 4), _mm_unpackhi_epi32(e0, e1));
+    _mm_storeu_si128((__m128i *) (out1 + 2 * x), _mm_unpacklo_epi32(e2, e3));
+    _mm_storeu_si128((__m128i *) (out1 + 2 * x + 4), _mm_unpackhi_epi32(e2, e3));
+  }
+#endif
+
+  for (; x < WINDOW_W; x++)
+    scale2x_px(up, mid, down, out0, out1, x);
+}
+
+// Scale3x for the pixel at x, the same idea with the corners of the 3x3 neighbourhood (A C above, G I below) deciding
+// the edge pixels
+static void scale3x_px(const u32 *up, const u32 *mid, const u32 *down, u32 *out0, u32 *out1, u32 *out2, u32 x) {
+  u32 l = x ? x - 1 : x, r = x < WINDOW_W - 1 ? x + 1 : x;
+  u32 a = up[l], b = up[x], c = up[r];
+  u32 d = mid[l], e = mid[x], f = mid[r];
+  u32 g = down[l], h = down[x], i = down[r];
+  u32 *o0 = out0 + 3 * x, *o1 = out1 + 3 * x, *o2 = out2 + 3 * x;
+
+  if (b == h || d == f) {
+    o0[0] = o0[1] = o0[2] = o1[0] = o1[1] = o1[2] = o2[0] = o2[1] = o2[2] = e;
+    return;
+  }
+
+  o0[0] = d == b ? d : e;
+  o0[1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+  o0[2] = b == f ? f : e;
+  o1[0] = (d == b && e != g) || (d == h && e != a) ? d : e;
+  o1[1] = e;
+  o1[2] = (b == f && e != i) || (h == f && e != c) ? f : e;
+  o2[0] = d == h ? d : e;
+  o2[1] = (d == h && e != i) || (h == f && e != g) ? h : e;
+  o2[2] = h == f ? f : e;
+}
+
+#ifdef SCALE_SSE2
+// Stores four pixels' worth of left, middle and right output pixels interleaved, as 12 pixels from out
+static inline void scale_store3(u32 *out, __m128i l, __m128i m, __m128i r) {
+  __m128 lm_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(l, m)), lm_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(l, m));
+  __m128 rl_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(r, l)), rl_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(r, l));
+  __m128 mr_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(m, r)), mr_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(m, r));
+
+  _mm_storeu_si128((__m128i *) out, _mm_castps_si128(_mm_shuffle_ps(lm_lo, rl_lo, _MM_SHUFFLE(3, 0, 1, 0))));
+  _mm_storeu_si128((__m128i *) (out + 4), _mm_castps_si128(_mm_shuffle_ps(mr_lo, lm_hi, _MM_SHUFFLE(1, 0, 3, 2))));
+  _mm_storeu_si128((__m128i *) (out + 8), _mm_castps_si128(_mm_shuffle_ps(rl_hi, mr_hi, _MM_SHUFFLE(3, 2, 3, 0))));
+}
+#endif
+
+static void scale3x_row(const u32 *up, const u32 *mid, const u32 *down, u32 *out0, u32 *out1, u32 *out2) {
+  u32 x = 1;
+
+  scale3x_px(up, mid, down, out0, out1, out2, 0);
+
+#ifdef SCALE_SSE2
+  // Four pixels at a time, as long as the ones to the right of them are in the rows
+  for (; x + 5 <= WINDOW_W; x += 4) {
+    __m128i a = _mm_loadu_si128((const __m128i *) (up + x - 1));
+    __m128i b = _mm_loadu_si128((const __m128i *) (up + x));
+    __m128i c = _mm_loadu_si128((const __m128i *) (up + x + 1));
+    __m128i d = _mm_loadu_si128((const __m128i *) (mid + x - 1));
+    __m128i e = _mm_loadu_si128((const __m128i *) (mid + x));
+    __m128i f = _mm_loadu_si128((const __m128i *) (mid + x + 1));
+    __m128i g = _mm_loadu_si128((const __m128i *) (down + x - 1));
+    __m128i h = _mm_loadu_si128((const __m128i *) (down + x));
+    __m128i i = _mm_loadu_si128((const __m128i *) (down + x + 1));
+
+    // Nothing changes where B and H or D and F match
+    __m128i skip = _mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f));
+    __m128i db = _mm_andnot_si128(skip, _mm_cmpeq_epi32(d, b)), bf = _mm_andnot_si128(skip, _mm_cmpeq_epi32(b, f));
+    __m128i dh = _mm_andnot_si128(skip, _mm_cmpeq_epi32(d, h)), hf = _mm_andnot_si128(skip, _mm_cmpeq_epi32(h, f));
+    __m128i ea = _mm_cmpeq_epi32(e, a), ec = _mm_cmpeq_epi32(e, c);
+    __m128i eg = _mm_cmpeq_epi32(e, g), ei = _mm_cmpeq_epi32(e, i);
+
+    __m128i e0 = scale_select(db, d, e);
+    __m128i e1 = scale_select(_mm_or_si128(_mm_andnot_si128(ec, db), _mm_andnot_si128(ea, bf)), b, e);
+    __m128i e2 = scale_select(bf, f, e);
+    __m128i e3 = scale_select(_mm_or_si128(_mm_andnot_si128(eg, db), _mm_andnot_si128(ea, dh)), d, e);
+    __m128i e5 = scale_select(_mm_or_si128(_mm_andnot_si128(ei, bf), _mm_andnot_si128(ec, hf)), f, e);
+    __m128i e6 = scale_select(dh, d, e);
+    __m128i e7 = scale_select(_mm_or_si128(_mm_andnot_si128(ei, dh), _mm_andnot_si128(eg, hf)), h, e);
+    __m128i e8 = scale_select(hf, f, e);
+
+    scale_store3(out0 + 3 * x, e0, e1, e2);
+    scale_store3(out1 + 3 * x, e3, e, e5);
+    scale_store3(out2 + 3 * x, e6, e7, e8);
+  }
+#endif
+
+  for (; x < WINDOW_W; x++)
+    scale3x_px(up, mid, down, out0, out1, out2, x);
+}
+
+// Luma and the two chroma differences of a pixel, 8 bits each, packed as Y << 16 | U << 8 | V
+static u32 xbr_yuv(u32 px) {
+  i32 r = px >> xbr_rshift & 0xFF, g = px >> xbr_gshift & 0xFF, b = px >> xbr_bshift & 0xFF;
+  u32 y = (77 * r + 150 * g + 29 * b) >> 8;
+  u32 u = (-43 * r - 85 * g + 128 * b + 0x8000) >> 8;
+  u32 v = (128 * r - 107 * g - 21 * b + 0x8000) >> 8;
+  return y << 16 | u << 8 | v;
+}
+
+// Distance between two packed YUV colours
+static u32 xbr_dist(u32 a, u32 b) {
+  i32 dy = (i32) (a >> 16) - (i32) (b >> 16);
+  i32 du = (i32) (a >> 8 & 0xFF) - (i32) (b >> 8 & 0xFF);
+  i32 dv = (i32) (a & 0xFF) - (i32) (b & 0xFF);
+  return (u32) (abs(dy) + abs(du) + abs(dv));
+}
+
+// Moves a w/8 of the way to b, channel by channel
+static u32 xbr_blend(u32 a, u32 b, u32 w) {
+  u32 lo = (((a & 0x00FF00FF) * (8 - w) + (b & 0x00FF00FF) * w) >> 3) & 0x00FF00FF;
+  u32 hi = (((a >> 8 & 0x00FF00FF) * (8 - w) + (b >> 8 & 0x00FF00FF) * w) << 5) & 0xFF00FF00;
+  return lo | hi;
+}
+
+// Looks for an edge across corner r of the pixel at p and blends the output pixels out near it. E and I are on
+// opposite sides of the edge if the colour changes more along the E-I diagonal than across it
+static void xbr_corner(const scaler_t *scaler, const u32 *p, const u32 *yuv, u32 r, u32 *out) {
+  const i32 *o = xbr_offset[r];
+  u32 pe = p[o[XBR_E]], ph = p[o[XBR_H]], pf = p[o[XBR_F]];
+  if (pe == ph || pe == pf)
+    return;
+
+#define XBR_D(m, n) xbr_dist(yuv[o[XBR_##m]], yuv[o[XBR_##n]])
+#define XBR_EQ(m, n) (XBR_D(m, n) < XBR_EQ_MAX)
+  u32 e = XBR_D(E, C) + XBR_D(E, G) + XBR_D(I, H5) + XBR_D(I, F4) + 4 * XBR_D(H, F);
+  u32 i = XBR_D(H, D) + XBR_D(H, I5) + XBR_D(F, I4) + XBR_D(F, B) + 4 * XBR_D(E, I);
+  if (e > i)
+    return;
+
+  u32 px = XBR_D(E, F) <= XBR_D(E, H) ? pf : ph;
+  u32 shape = XBR_SOFT;
+  if (e < i && ((!XBR_EQ(F, B) && !XBR_EQ(H, D)) || (XBR_EQ(E, I) && !XBR_EQ(F, I4) && !XBR_EQ(H, I5)) ||
+                XBR_EQ(E, G) || XBR_EQ(E, C))) {
+    // A shallow edge runs from G through F, a steep one from C through H
+    u32 ke = XBR_D(F, G), ki = XBR_D(H, C);
+    bool left = 2 * ke <= ki && pe != p[o[XBR_G]] && p[o[XBR_D]] != p[o[XBR_G]];
+    bool up = ke >= 2 * ki && pe != p[o[XBR_C]] && p[o[XBR_B]] != p[o[XBR_C]];
+    shape = left && up ? XBR_LEFT_UP : left ? XBR_LEFT : up ? XBR_UP : XBR_DIAG;
+  }
+#undef XBR_D
+#undef XBR_EQ
+
+  u32 scale = scaler->scale;
+  const u8 (*w)[SCALE_MAX] = XBR_WEIGHTS[scale - 2][shape];
+  for (u32 sy = 0; sy < scale; sy++) {
+    for (u32 sx = 0; sx < scale; sx++) {
+      if (w[sy][sx]) {
+        u32 *dst = &out[xbr_out[r][sy * scale + sx]];
+        *dst = xbr_blend(*dst, px, w[sy][sx]);
+      }
+    }
+  }
+}
+
+static void xbr_row(const scaler_t *scaler, scale_worker_t *w, const u32 *in, u32 *out, u32 y) {
+  // Copy the rows around y with the picture's edges repeated outwards, and find their colours' YUV
+  for (u32 i = 0; i < XBR_ROWS; i++) {
+    i32 src_y = (i32) (y + i) - XBR_REACH;
+    src_y = src_y < 0 ? 0 : src_y > WINDOW_H - 1 ? WINDOW_H - 1 : src_y;
+    const u32 *src = in + src_y * WINDOW_W;
+    u32 *dst = w->xbr_px + i * XBR_STRIDE;
+
+    memcpy(dst + XBR_REACH, src, WINDOW_W * sizeof *dst);
+    for (u32 x = 0; x < XBR_REACH; x++) {
+      dst[x] = src[0];
+      dst[XBR_REACH + WINDOW_W + x] = src[WINDOW_W - 1];
+    }
+    for (u32 x = 0; x < XBR_STRIDE; x++)
+      w->xbr_yuv[i * XBR_STRIDE + x] = xbr_yuv(dst[x]);
+  }
+
+  u32 scale = scaler->scale;
+  u32 center = XBR_REACH * XBR_STRIDE + XBR_REACH;
+  for (u32 x = 0; x < WINDOW_W; x++) {
+    const u32 *p = w->xbr_px + center + x;
+    u32 block[SCALE_MAX * SCALE_MAX];
+    for (u32 i = 0; i < scale * scale; i++)
+      block[i] = *p;
+
+    for (u32 r = 0; r < 4; r++)
+      xbr_corner(scaler, p, w->xbr_yuv + center + x, r, block);
+
+    for (u32 sy = 0; sy < scale; sy++)
+      memcpy(out + sy * scaler->out_w + x * scale, block + sy * scale, scale * sizeof *out);
+  }
+}
+
+static void scale_row(const scaler_t *scaler, scale_worker_t *w, const u32 *in, u32 *out, u32 y) {
+  const u32 *mid = in + y * WINDOW_W;
+  u32 *o = out + y * scaler->scale * scaler->out_w;
+
+  if (scaler->filter == SCALE_SCANLINES) {
+    scale_scanlines_row(scaler, mid, o);
+    return;
+  }
+  if (scaler->filter == SCALE_XBR) {
+    xbr_row(scaler, w, in, o, y);
+    return;
+  }
+
+  // The picture's edges are repeated outwards
+  const u32 *up = y ? mid - WINDOW_W : mid;
+  const u32 *down = y < WINDOW_H - 1 ? mid + WINDOW_W : mid;
+  if (scaler->scale == 2)
+    scale2x_row(up, mid, down, o, o + scaler->out_w);
+  else
+    scale3x_row(up, mid, down, o, o + scaler->out_w, o + 2 * scaler->out_w);
+}
+
+static void scale_rows(scale_worker_t *w) {
+  scaler_t *scaler = w->scaler;
+
+  for (int i; (i = SDL_AtomicAdd(&scaler->next_row, 1)) < (int) scaler->job_n_rows;)
+    scale_row(scaler, w, scaler->job_in, scaler->job_out, scaler->job_rows[i]);
+}
+
+static int scale_worker_thread(void *data) {
+  scale_worker_t *w = data;
+  scaler_t *scaler = w->scaler;
+
+  for (;;) {
+    SDL_SemWait(scaler->go);
+    if (scaler->quit)
+      break;
+
+    scale_rows(w);
+    SDL_SemPost(scaler->done);
+  }
+  return 0;
+}
+
+void scale_frame(scaler_t *scaler, const u32 *in, u32 *out, const u16 *rows, u32 n_rows) {
+  scaler->job_in = in;
+  scaler->job_out = out;
+  scaler->job_rows = rows;
+  scaler->job_n_rows = n_rows;
+  SDL_AtomicSet(&scaler->next_row, 0);
+
+  // Only wake the workers when there's enough for them to do
+  u32 helpers = MIN(scaler->n_workers - 1, n_rows / 8);
+  for (u32 i = 0; i < helpers; i++)
+    SDL_SemPost(scaler->go);
+  scale_rows(&scaler->workers[0]);
+  for (u32 i = 0; i < helpers; i++)
+    SDL_SemWait(scaler->done);
+}
+
+void scale_destroy(scaler_t *scaler) {
+  if (scaler->n_workers > 1) {
+    scaler->quit = true;
+    for (u32 i = 1; i < scaler->n_workers; i++)
+      SDL_SemPost(scaler->go);
+    for (u32 i = 1; i < scaler->n_workers; i++)
+      SDL_WaitThread(scaler->workers[i].thread, NULL);
+    SDL_DestroySemaphore(scaler->go);
+    SDL_DestroySemaphore(scaler->done);
+  }
+
+  for (u32 i = 0; i < scaler->n_workers; i++) {
+    free(scaler->workers[i].xbr_px);
+    free(scaler->workers[i].xbr_yuv);
+  }
+  free(scaler->workers);
+  memset(scaler, 0, sizeof *scaler);
+}
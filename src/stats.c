@@ -0,0 +1,101 @@
+#include "include/stats.h"
+
+#ifdef CNES_STATS
+
+#include "include/cpu.h"
+#include "include/ppu.h"
+#include "include/apu.h"
+#include "include/args.h"
+#include "include/util.h"
+#include "include/log.h"
+
+#include <signal.h>
+
+stats_t stats;
+
+static char *stats_fn;
+static volatile sig_atomic_t stats_dump_requested;
+
+static void stats_signal(int sig) {
+  stats_dump_requested = 1;
+}
+
+void stats_init(char *fn) {
+  memset(&stats, 0, sizeof stats);
+  stats_fn = fn;
+
+#ifdef SIGUSR1
+  signal(SIGUSR1, stats_signal);
+#endif
+}
+
+void stats_poll(nes_t *nes) {
+  if (stats_dump_requested) {
+    stats_dump_requested = 0;
+    stats_dump(nes);
+  }
+}
+
+// Writes str as a JSON string literal, escaping quotes, backslashes and control characters
+static void stats_write_str(FILE *f, const char *str) {
+  fputc('"', f);
+  for (const unsigned char *c = (const unsigned char *) str; *c; c++) {
+    if (*c == '"' || *c == '\\')
+      fprintf(f, "\\%c", *c);
+    else if (*c < 0x20)
+      fprintf(f, "\\u%04x", *c);
+    else
+      fputc(*c, f);
+  }
+  fputc('"', f);
+}
+
+void stats_dump(nes_t *nes) {
+  // Frames still queued for the audio thread haven't had their samples counted yet
+  apu_sync(nes);
+
+  FILE *f = stats_fn ? nes_fopen(stats_fn, "w") : stdout;
+
+  fprintf(f, "{\n");
+  fprintf(f, "  \"rom\": ");
+  stats_write_str(f, nes->args->cart_fn);
+  fprintf(f, ",\n");
+  fprintf(f, "  \"frames\": %lu,\n", (unsigned long) (nes->ppu ? nes->ppu->frameno : 0));  // No PPU for NSF tunes
+  fprintf(f, "  \"cpu_cycles\": %lu,\n", (unsigned long) nes->cpu->ticks);
+
+  // Only opcodes that actually ran, so the dump stays readable
+  fprintf(f, "  \"opcodes\": {");
+  bool first = true;
+  for (u32 i = 0; i < 256; i++) {
+    if (!stats.opcodes[i])
+      continue;
+    fprintf(f, "%s\n    \"%02X %s\": %lu", first ? "" : ",", i, cpu_opcode_tos(i), (unsigned long) stats.opcodes[i]);
+    first = false;
+  }
+  fprintf(f, "\n  },\n");
+
+  fprintf(f, "  \"oam_dma_cycles\": %lu,\n", (unsigned long) stats.oam_dma_cycles);
+  fprintf(f, "  \"interrupt_cycles\": {\"nmi\": %lu, \"irq\": %lu, \"brk\": %lu},\n",
+          (unsigned long) stats.intr_cycles[INTR_NMI], (unsigned long) stats.intr_cycles[INTR_IRQ],
+          (unsigned long) stats.intr_cycles[INTR_BRK]);
+  fprintf(f, "  \"ppu_reads\": {\"pattern\": %lu, \"nametable\": %lu, \"palette\": %lu},\n",
+          (unsigned long) stats.ppu_reads[STATS_PPU_PATTERN], (unsigned long) stats.ppu_reads[STATS_PPU_NAMETABLE],
+          (unsigned long) stats.ppu_reads[STATS_PPU_PALETTE]);
+  fprintf(f, "  \"mapper\": {\"cpu_writes\": %lu, \"bank_switches\": %lu},\n",
+          (unsigned long) stats.mapper_cpu_writes, (unsigned long) stats.mapper_bank_switches);
+  fprintf(f, "  \"apu_samples\": %lu,\n", (unsigned long) stats.apu_samples);
+  fprintf(f, "  \"audio_ring\": {\"fill\": %u, \"target\": %u, \"underruns\": %d, \"overruns\": %d, "
+             "\"drift_ppm\": %d, \"rate_adj\": %d}\n",
+          ring_fill(&nes->apu->smp_ring), nes->apu->smp_target, SDL_AtomicGet(&nes->apu->smp_ring.underruns),
+          SDL_AtomicGet(&nes->apu->smp_ring.overruns), nes->apu->drift_ppm, nes->apu->rate_adj);
+  fprintf(f, "}\n");
+
+  if (stats_fn) {
+    nes_fclose(f);
+    log_msg(LOG_INFO, LOG_CAT_MAIN, "stats_dump: wrote counters to %s", stats_fn);
+  } else {
+    fflush(f);
+  }
+}
+
+#endif
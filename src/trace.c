@@ -0,0 +1,73 @@
+#include "include/trace.h"
+#include "include/util.h"
+#include "include/log.h"
+
+#ifndef WIN32
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <unistd.h>
+#endif
+
+void trace_open(trace_t *trace, char *fn, u32 n_records) {
+  assert(sizeof(trace_header_t) == 64 && sizeof(trace_rec_t) == 32);
+  memset(trace, 0, sizeof *trace);
+
+  // Round the ring size up to a power of two so the write index can be masked
+  u64 capacity = 1;
+  while (capacity < n_records)
+    capacity <<= 1;
+
+  trace->fn = fn;
+  trace->mask = capacity - 1;
+  trace->map_sz = sizeof(trace_header_t) + capacity * sizeof(trace_rec_t);
+
+#ifndef WIN32
+  if ((trace->fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+    crash_and_burn("trace_open: could not open %s: %s\n", fn, strerror(errno));
+  if (ftruncate(trace->fd, (off_t) trace->map_sz) != 0)
+    crash_and_burn("trace_open: could not resize %s: %s\n", fn, strerror(errno));
+
+  void *map = mmap(NULL, trace->map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, trace->fd, 0);
+  if (map == MAP_FAILED)
+    crash_and_burn("trace_open: could not map %s: %s\n", fn, strerror(errno));
+#else
+  // No mmap here, keep the ring in memory and write it out in trace_close()
+  void *map = nes_calloc(1, trace->map_sz);
+#endif
+
+  trace->header = map;
+  trace->recs = (trace_rec_t *) (trace->header + 1);
+
+  memcpy(trace->header->magic, TRACE_MAGIC, sizeof trace->header->magic);
+  trace->header->version = TRACE_VERSION;
+  trace->header->rec_sz = sizeof(trace_rec_t);
+  trace->header->capacity = capacity;
+  trace->header->count = 0;
+
+  log_msg(LOG_INFO, LOG_CAT_CPU, "trace_open: tracing CPU to %s, ring holds %lu records", fn, (unsigned long) capacity);
+}
+
+void trace_close(trace_t *trace) {
+  if (!trace->header)
+    return;
+
+  // Drop the unused part of the ring if it never wrapped around
+  size_t used_sz = trace->map_sz;
+  if (trace->header->count < trace->header->capacity)
+    used_sz = sizeof(trace_header_t) + trace->header->count * sizeof(trace_rec_t);
+
+#ifndef WIN32
+  munmap(trace->header, trace->map_sz);
+  if (ftruncate(trace->fd, (off_t) used_sz) != 0)
+    perror("trace_close");
+  close(trace->fd);
+#else
+  FILE *trace_f = nes_fopen(trace->fn, "wb");
+  nes_fwrite(trace->header, 1, used_sz, trace_f);
+  nes_fclose(trace_f);
+  free(trace->header);
+#endif
+
+  memset(trace, 0, sizeof *trace);
+}
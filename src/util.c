@@ -22,6 +22,17 @@ void *nes_calloc(size_t count, size_t sz) {
   return ret;
 }
 
+void *nes_realloc(void *ptr, size_t sz) {
+  void *ret;
+
+  if ((ret = realloc(ptr, sz)) == NULL) {
+    perror("nes_realloc");
+    exit(EXIT_FAILURE);
+  }
+
+  return ret;
+}
+
 FILE *nes_fopen(char *fn, char *mode) {
   FILE *f;
 
@@ -0,0 +1,143 @@
+#include "include/wav.h"
+#include "include/util.h"
+#include "include/log.h"
+
+// Stores v as little endian at p
+static void wav_put_u16(u8 *p, u16 v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+static void wav_put_u32(u8 *p, u32 v) {
+  wav_put_u16(p, v & 0xFFFF);
+  wav_put_u16(p + 2, v >> 16);
+}
+
+// Writes the 44 byte header of a 16-bit mono PCM RIFF file holding n_samples samples
+static void wav_write_header(wav_t *wav, u64 n_samples) {
+  u32 data_sz = (u32) MIN(n_samples * 2, UINT32_MAX - 36);
+  u8 hdr[44];
+
+  memcpy(hdr, "RIFF", 4);
+  wav_put_u32(hdr + 4, 36 + data_sz);
+  memcpy(hdr + 8, "WAVEfmt ", 8);
+  wav_put_u32(hdr + 16, 16);                    // fmt chunk size
+  wav_put_u16(hdr + 20, 1);                     // PCM
+  wav_put_u16(hdr + 22, 1);                     // Mono
+  wav_put_u32(hdr + 24, wav->sample_rate);
+  wav_put_u32(hdr + 28, wav->sample_rate * 2);  // Bytes per second
+  wav_put_u16(hdr + 32, 2);                     // Bytes per sample
+  wav_put_u16(hdr + 34, 16);                    // Bits per sample
+  memcpy(hdr + 36, "data", 4);
+  wav_put_u32(hdr + 40, data_sz);
+
+  fseek(wav->f, 0, SEEK_SET);
+  nes_fwrite(hdr, sizeof hdr, 1, wav->f);
+}
+
+// Writes everything currently queued. Returns false if the ring was empty
+static bool wav_drain(wav_t *wav) {
+  i16 chunk[WAV_CHUNK_SZ];
+  u8 bytes[2 * WAV_CHUNK_SZ];
+  bool wrote = false;
+
+  u32 n;
+  while ((n = MIN(ring_fill(&wav->ring), WAV_CHUNK_SZ)) > 0) {
+    ring_read(&wav->ring, chunk, n);
+    for (u32 i = 0; i < n; i++)
+      wav_put_u16(bytes + 2 * i, (u16) chunk[i]);
+    if (SDL_AtomicGet(&wav->waiting))
+      SDL_SemPost(wav->space);
+    nes_fwrite(bytes, 2, n, wav->f);
+    wav->n_written += n;
+    wrote = true;
+  }
+
+  return wrote;
+}
+
+static int wav_thread(void *data) {
+  wav_t *wav = data;
+
+  for (;;) {
+    if (wav_drain(wav))
+      continue;
+    if (!SDL_AtomicGet(&wav->running))
+      break;
+    SDL_SemWait(wav->wake);
+  }
+
+  // running is cleared after the last wav_write(), so anything queued before it is visible now
+  wav_drain(wav);
+  return 0;
+}
+
+void wav_open(wav_t *wav, char *fn, u32 sample_rate, bool block) {
+  memset(wav, 0, sizeof *wav);
+
+  size_t len = strlen(fn);
+  wav->riff = len >= 4 && SDL_strcasecmp(fn + len - 4, ".wav") == 0;
+  wav->sample_rate = sample_rate;
+  wav->block = block;
+  wav->f = nes_fopen(fn, "wb");
+
+  // Leave room for the header, it's filled in once the length is known
+  if (wav->riff)
+    wav_write_header(wav, 0);
+
+  ring_init(&wav->ring, WAV_RING_SZ);
+  SDL_AtomicSet(&wav->running, 1);
+  if ((wav->wake = SDL_CreateSemaphore(0)) == NULL || (wav->space = SDL_CreateSemaphore(0)) == NULL)
+    crash_and_burn("wav_open: SDL_CreateSemaphore failed: %s\n", SDL_GetError());
+  if ((wav->thread = SDL_CreateThread(wav_thread, "cnes-wav", wav)) == NULL)
+    crash_and_burn("wav_open: SDL_CreateThread failed: %s\n", SDL_GetError());
+
+  log_msg(LOG_INFO, LOG_CAT_APU, "wav_open: capturing audio to %s at %u Hz (%s)", fn, sample_rate,
+          wav->riff ? "wav" : "raw");
+}
+
+// Room left on the ring. Only shrinks when the producer writes
+static u32 wav_space(wav_t *wav) {
+  return ring_capacity(&wav->ring) - ring_fill(&wav->ring);
+}
+
+void wav_write(wav_t *wav, const i16 *samples, u32 n) {
+  // Queue whatever fits and wait for the writer to make room for the rest. waiting is set before the space is checked
+  // again, so the writer either sees it and posts, or freed the room before the check
+  while (wav->block && n > wav_space(wav)) {
+    u32 written = ring_write(&wav->ring, samples, wav_space(wav));
+    samples += written;
+    n -= written;
+    SDL_SemPost(wav->wake);
+
+    SDL_AtomicSet(&wav->waiting, 1);
+    if (n > wav_space(wav))
+      SDL_SemWait(wav->space);
+    SDL_AtomicSet(&wav->waiting, 0);
+  }
+
+  ring_write(&wav->ring, samples, n);
+  SDL_SemPost(wav->wake);
+}
+
+bool wav_close(wav_t *wav) {
+  // Let the writer drain the ring and exit
+  SDL_AtomicSet(&wav->running, 0);
+  SDL_SemPost(wav->wake);
+  SDL_WaitThread(wav->thread, NULL);
+  SDL_DestroySemaphore(wav->wake);
+  SDL_DestroySemaphore(wav->space);
+
+  if (wav->riff)
+    wav_write_header(wav, wav->n_written);
+
+  u32 overruns = SDL_AtomicGet(&wav->ring.overruns);
+  if (overruns)
+    log_msg(LOG_ERROR, LOG_CAT_APU, "wav_close: %u samples dropped, the disk couldn't keep up", overruns);
+  log_msg(LOG_INFO, LOG_CAT_APU, "wav_close: wrote %lu samples", (unsigned long) wav->n_written);
+
+  nes_fclose(wav->f);
+  ring_destroy(&wav->ring);
+  memset(wav, 0, sizeof *wav);
+  return overruns == 0;
+}
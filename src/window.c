@@ -2,59 +2,328 @@
 #include "include/ppu.h"
 #include "include/cpu.h"
 #include "include/apu.h"
+#include "include/log.h"
+#include "include/stats.h"
+#include "include/util.h"
+#include "include/args.h"
 
-void window_init(window_t *wnd) {
+void window_init(window_t *wnd, args_t *args) {
   // Create the main display window
   wnd->disp_window = SDL_CreateWindow("CNES",
                                       SDL_WINDOWPOS_CENTERED,SDL_WINDOWPOS_CENTERED,
                                       WINDOW_W, WINDOW_H, SDL_WINDOW_RESIZABLE);
   if (!wnd->disp_window)
-    printf("window_init: SDL_CreateWindow() failed: %s\n", SDL_GetError());
+    log_msg(LOG_ERROR, LOG_CAT_MAIN, "window_init: SDL_CreateWindow() failed: %s", SDL_GetError());
 
   // Create RGB pixel_surface from PPU rendered pixel_surface
   wnd->renderer = SDL_CreateRenderer(wnd->disp_window, -1,
-                                     SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
+                                     SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE |
+                                     SDL_RENDERER_PRESENTVSYNC);
   if (!wnd->renderer)
-    printf("window_init: SDL_GetRenderer() failed: %s\n", SDL_GetError());
+    log_msg(LOG_ERROR, LOG_CAT_MAIN, "window_init: SDL_GetRenderer() failed: %s", SDL_GetError());
+
+  // The NTSC filter's output is several times wider than the NES picture, an upscaler's bigger both ways. Without
+  // either the renderer stretches the texture to the window with nearest neighbour scaling
+  wnd->ntsc = NULL;
+  wnd->scaler = NULL;
+  wnd->scaled = NULL;
+  wnd->tex_w = WINDOW_W;
+  wnd->tex_h = WINDOW_H;
+  wnd->filter_name = scale_filter_name(args->filter);
+  u32 n_threads = 1;
+  if (args->ntsc_scale) {
+    wnd->ntsc = nes_malloc(sizeof *wnd->ntsc);
+    ntsc_init(wnd->ntsc, args->ntsc_scale, args->ntsc_threads);
+    wnd->tex_w = wnd->ntsc->out_w;
+    wnd->filter_name = "ntsc";
+    n_threads = wnd->ntsc->n_workers;
+  } else if (args->filter != SCALE_NEAREST) {
+    wnd->scaler = nes_malloc(sizeof *wnd->scaler);
+    scale_init(wnd->scaler, args->filter, args->scale, args->filter_threads);
+    wnd->tex_w = wnd->scaler->out_w;
+    wnd->tex_h = WINDOW_H * args->scale;
+    wnd->scaled = nes_malloc(wnd->tex_w * wnd->tex_h * sizeof *wnd->scaled);
+    n_threads = wnd->scaler->n_workers;
+  }
+  wnd->argb = nes_malloc((wnd->ntsc ? wnd->tex_w : WINDOW_W) * WINDOW_H * sizeof *wnd->argb);
+  log_msg(LOG_INFO, LOG_CAT_MAIN, "window_init: %ux%u, %s filter on %u thread%s", WINDOW_W * args->scale,
+          WINDOW_H * args->scale, wnd->filter_name, n_threads, n_threads == 1 ? "" : "s");
 
   // Create texture to render the screen to
   SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
   wnd->texture = SDL_CreateTexture(wnd->renderer, SDL_PIXELFORMAT_ARGB32,
-                                   SDL_TEXTUREACCESS_STREAMING, WINDOW_W, WINDOW_H);
+                                   SDL_TEXTUREACCESS_STREAMING, wnd->tex_w, wnd->tex_h);
   if (!wnd->texture)
-    printf("window_init: SDL_CreateTexture() failed: %s\n", SDL_GetError());
+    log_msg(LOG_ERROR, LOG_CAT_MAIN, "window_init: SDL_CreateTexture() failed: %s", SDL_GetError());
+  SDL_SetWindowSize(wnd->disp_window, WINDOW_W * args->scale, WINDOW_H * args->scale);
+
+  // The presenter can only measure the refresh rate if presents wait for vsync
+  SDL_RendererInfo info;
+  SDL_DisplayMode mode;
+  wnd->refresh_hz = 0;
+  if (SDL_GetRendererInfo(wnd->renderer, &info) == 0 && (info.flags & SDL_RENDERER_PRESENTVSYNC) &&
+      SDL_GetWindowDisplayMode(wnd->disp_window, &mode) == 0)
+    wnd->refresh_hz = mode.refresh_rate;
+  wnd->last_present = 0;
+  wnd->present_sum = 0;
+  wnd->present_n = 0;
+  SDL_AtomicSet(&wnd->vsync_period, 0);
+
+  palette_load(&wnd->palette, "../palette/palette.pal");
+  wnd->back = 0;
+  SDL_AtomicSet(&wnd->latest, 1);
+  wnd->front = 2;
+  if ((wnd->frame_posted = SDL_CreateSemaphore(0)) == NULL)
+    crash_and_burn("window_init: SDL_CreateSemaphore failed: %s\n", SDL_GetError());
 
   wnd->frame_ready = false;
+  wnd->skip_render = false;
+  wnd->frames_drawn = wnd->frames_skipped = 0;
+  wnd->time_drawn = wnd->time_skipped = 0;
+  wnd->frames_dropped = wnd->frames_presented = wnd->frames_unchanged = wnd->present_timeouts = 0;
+  wnd->rows_uploaded = 0;
+  wnd->time_filtered = 0;
+
+  perf_init(&wnd->perf_emu, "emulation");
+  perf_init(&wnd->perf_audio, "audio submission");
+  perf_init(&wnd->perf_present, "present");
+  perf_init(&wnd->perf_frame, "frame time");
+  wnd->show_overlay = args->overlay;
+  overlay_init(&wnd->overlay);
+  wnd->tex_valid = false;
+  wnd->redraw = false;
+}
+
+static bool window_row_changed(window_t *wnd, const frame_t *frame, int y) {
+  return !wnd->tex_valid || frame->row_hash[y] != wnd->tex_hash[y];
+}
+
+// Lists the rows within reach of any of the n_rows sorted rows, in order. Returns how many there are
+static u32 window_rows_within(const u16 *rows, u32 n_rows, u32 reach, u16 *out) {
+  u32 n = 0;
+
+  for (u32 i = 0; i < n_rows; i++) {
+    u32 y0 = rows[i] > reach ? rows[i] - reach : 0;
+    u32 y1 = MIN(rows[i] + reach, WINDOW_H - 1);
+    for (u32 y = n && out[n - 1] >= y0 ? out[n - 1] + 1 : y0; y <= y1; y++)
+      out[n++] = y;
+  }
+  return n;
+}
+
+// Converts the rows of frame that differ from what's in the texture to ARGB, through the NTSC filter or upscaler if one
+// is on, and uploads them, one update per run of changed rows. Returns the number of rows that changed
+static u32 window_update_texture(window_t *wnd, const frame_t *frame) {
+  u64 t0 = SDL_GetPerformanceCounter();
+  u16 rows[WINDOW_H];
+  u32 n_rows = 0;
+
+  for (u32 y = 0; y < WINDOW_H; y++) {
+    if (window_row_changed(wnd, frame, y))
+      rows[n_rows++] = y;
+  }
+  for (u32 i = 0; i < n_rows; i++)
+    wnd->tex_hash[rows[i]] = frame->row_hash[rows[i]];
+
+  if (wnd->ntsc) {
+    ntsc_filter(wnd->ntsc, frame->px, wnd->argb, rows, n_rows);
+  } else {
+    for (u32 i = 0; i < n_rows; i++)
+      palette_to_argb(&wnd->palette, frame->px + rows[i] * WINDOW_W, wnd->argb + rows[i] * WINDOW_W, WINDOW_W);
+  }
+
+  // An upscaled row also depends on the rows next to it
+  u16 near[WINDOW_H];
+  const u16 *tex_rows = rows;
+  u32 n_tex_rows = n_rows;
+  const u32 *px = wnd->argb;
+  if (wnd->scaler) {
+    n_tex_rows = window_rows_within(rows, n_rows, wnd->scaler->reach, near);
+    scale_frame(wnd->scaler, wnd->argb, wnd->scaled, near, n_tex_rows);
+    tex_rows = near;
+    px = wnd->scaled;
+  }
+  wnd->time_filtered += SDL_GetPerformanceCounter() - t0;
+
+  // Each row of the frame is tex_h / WINDOW_H rows of the texture
+  u32 k = wnd->tex_h / WINDOW_H;
+  bool ok = true;
+  for (u32 i = 0, end; i < n_tex_rows; i = end) {
+    for (end = i + 1; end < n_tex_rows && tex_rows[end] == tex_rows[end - 1] + 1; end++)
+      ;
+
+    SDL_Rect rect = {0, tex_rows[i] * k, (int) wnd->tex_w, (int) ((end - i) * k)};
+    if (SDL_UpdateTexture(wnd->texture, &rect, px + tex_rows[i] * k * wnd->tex_w, wnd->tex_w * sizeof *px) != 0)
+      ok = false;  // The presenter can't log. Upload everything again next time
+  }
+
+  wnd->tex_valid = ok;
+  return n_rows;
 }
 
 void window_draw_frame(window_t *wnd, nes_t *nes) {
-  // One row in the framebuffer is 4 * WINDOW_W bytes long (Framebuffer pixels are ARGB)
-  int pitch = 4 * WINDOW_W;
-  u32 *pixels = NULL;
+  u64 t0 = SDL_GetPerformanceCounter();
 
-  // Grab rendering surface
-  SDL_LockTexture(wnd->texture, NULL, (void **) &pixels, &pitch);
+  // With a render thread or when skipping the frame, the PPU doesn't draw into the framebuffer
+  bool threaded = nes->ppu->render != NULL;
+  bool draw = !wnd->skip_render;
+  frame_t *frame = threaded || !draw ? NULL : &wnd->fb[wnd->back];
   while (!wnd->frame_ready) {
     cpu_tick(nes);
 
     // Three PPU ticks per CPU cycle
-    ppu_tick(nes, wnd, pixels);
-    ppu_tick(nes, wnd, pixels);
-    ppu_tick(nes, wnd, pixels);
+    ppu_tick(nes, wnd, frame);
+    ppu_tick(nes, wnd, frame);
+    ppu_tick(nes, wnd, frame);
 
     // APU tick every two CPU cycles
     if (nes->cpu->ticks & 1)
       apu_tick(nes);
   }
 
-  // Draw the screen texture to the screen
-  SDL_UnlockTexture(wnd->texture);
+  // Hand this frame's audio to the sound card
+  u64 t_audio = SDL_GetPerformanceCounter();
+  apu_end_frame(nes);
+  perf_add(&wnd->perf_audio, SDL_GetPerformanceCounter() - t_audio);
+
+  // The render thread finished the previous frame while this one was emulated
+  bool finished = frame != NULL;
+  if (threaded) {
+    frame_t *prev = ppu_end_frame(nes, draw);
+    if (prev) {
+      memcpy(&wnd->fb[wnd->back], prev, sizeof *prev);
+      finished = true;
+    }
+  }
+
+  // Hand the frame to the presenter, taking whichever buffer it left behind
+  if (wnd->show_overlay) {
+    overlay_update(&wnd->overlay, nes, wnd);
+    if (finished)
+      overlay_draw(&wnd->overlay, wnd);
+  }
+  if (finished) {
+    int old = SDL_AtomicSet(&wnd->latest, wnd->back | WINDOW_FB_FRESH);
+    if (old & WINDOW_FB_FRESH)
+      wnd->frames_dropped++;
+    wnd->back = old & ~WINDOW_FB_FRESH;
+    SDL_SemPost(wnd->frame_posted);
+  }
+
+  u64 elapsed = SDL_GetPerformanceCounter() - t0;
+  perf_add(&wnd->perf_emu, elapsed);
+  if (draw) {
+    wnd->frames_drawn++;
+    wnd->time_drawn += elapsed;
+  } else {
+    wnd->frames_skipped++;
+    wnd->time_skipped += elapsed;
+  }
+  wnd->frame_ready = false;
+
+  stats_poll(nes);
+}
+
+// Every present returns at a vblank, so the time between two of them is a whole number of refreshes. Adding up the
+// times and refresh counts between consecutive presents, wakeup latency only matters at the ends, and the average
+// over WINDOW_REFRESH_SAMPLES refreshes is accurate enough to tell 60 Hz from 59.94 Hz, which the display mode's
+// integer rate can't
+static void window_measure_refresh(window_t *wnd) {
+  u64 now = SDL_GetPerformanceCounter();
+  u64 dt = now - wnd->last_present;
+  wnd->last_present = now;
+  if (!wnd->refresh_hz)
+    return;
+
+  u64 nominal = SDL_GetPerformanceFrequency() / wnd->refresh_hz;
+  u64 refreshes = (dt + nominal / 2) / nominal;
+  if (refreshes < 1 || refreshes > 4) {
+    wnd->present_sum = wnd->present_n = 0;  // Too far apart to count the refreshes in between
+    return;
+  }
+
+  wnd->present_sum += dt;
+  wnd->present_n += refreshes;
+  if (wnd->present_n >= WINDOW_REFRESH_SAMPLES) {
+    SDL_AtomicSet(&wnd->vsync_period, (int) (wnd->present_sum / wnd->present_n));
+    wnd->present_sum = 0;
+    wnd->present_n = 0;
+  }
+}
+
+void window_present(window_t *wnd) {
+  // Every post is for a frame that's in latest now or was replaced there, one check covers them all
+  if (SDL_SemWaitTimeout(wnd->frame_posted, WINDOW_PRESENT_TIMEOUT_MS) == 0) {
+    while (SDL_SemTryWait(wnd->frame_posted) == 0)
+      ;
+  }
+
+  u64 t0 = SDL_GetPerformanceCounter();
+  bool present = wnd->redraw;
+  bool fresh = SDL_AtomicGet(&wnd->latest) & WINDOW_FB_FRESH;
+  if (fresh) {
+    // Only the emulation thread sets the fresh bit, so it's still set and the exchange takes the newest frame
+    wnd->front = SDL_AtomicSet(&wnd->latest, wnd->front) & ~WINDOW_FB_FRESH;
+
+    u32 rows = window_update_texture(wnd, &wnd->fb[wnd->front]);
+    wnd->rows_uploaded += rows;
+    if (rows) {
+      wnd->frames_presented++;
+      present = true;
+    } else {
+      wnd->frames_unchanged++;
+    }
+  } else if (wnd->tex_valid) {
+    wnd->present_timeouts++;
+  }
+
+  // Nothing changed, or nothing to show yet
+  if (!present || !wnd->tex_valid) {
+    if (fresh)
+      perf_add(&wnd->perf_present, SDL_GetPerformanceCounter() - t0);
+    return;
+  }
+
   SDL_RenderCopy(wnd->renderer, wnd->texture, NULL, NULL);
   SDL_RenderPresent(wnd->renderer);
-  wnd->frame_ready = false;
+  window_measure_refresh(wnd);
+  wnd->redraw = false;
+  perf_add(&wnd->perf_present, SDL_GetPerformanceCounter() - t0);
+}
+
+void window_redraw(window_t *wnd) {
+  wnd->redraw = true;
 }
 
 void window_destroy(window_t *wnd) {
+  // Emulation speed with and without drawing
+  double freq = (double) SDL_GetPerformanceFrequency();
+  log_msg(LOG_INFO, LOG_CAT_MAIN, "window_destroy: %lu frames drawn at %.1f fps, %lu skipped at %.1f fps",
+          (unsigned long) wnd->frames_drawn, wnd->frames_drawn * freq / MAX(wnd->time_drawn, 1),
+          (unsigned long) wnd->frames_skipped, wnd->frames_skipped * freq / MAX(wnd->time_skipped, 1));
+  log_msg(LOG_INFO, LOG_CAT_MAIN, "window_destroy: %lu frames presented, %lu unchanged, %lu dropped, %lu timeouts, "
+          "%.1f rows uploaded per frame presented", (unsigned long) wnd->frames_presented,
+          (unsigned long) wnd->frames_unchanged, (unsigned long) wnd->frames_dropped,
+          (unsigned long) wnd->present_timeouts, (double) wnd->rows_uploaded / MAX(wnd->frames_presented, 1));
+  log_msg(LOG_INFO, LOG_CAT_MAIN, "window_destroy: %s filter took %.3f ms per frame presented", wnd->filter_name,
+          wnd->time_filtered * 1000 / freq / MAX(wnd->frames_presented, 1));
+  perf_log_total(&wnd->perf_emu);
+  perf_log_total(&wnd->perf_audio);
+  perf_log_total(&wnd->perf_present);
+  perf_log_total(&wnd->perf_frame);
+
+  SDL_DestroySemaphore(wnd->frame_posted);
+  if (wnd->ntsc) {
+    ntsc_destroy(wnd->ntsc);
+    free(wnd->ntsc);
+  }
+  if (wnd->scaler) {
+    scale_destroy(wnd->scaler);
+    free(wnd->scaler);
+  }
+  free(wnd->argb);
+  free(wnd->scaled);
+
   SDL_DestroyTexture(wnd->texture);
   SDL_DestroyRenderer(wnd->renderer);
   SDL_DestroyWindow(wnd->disp_window);
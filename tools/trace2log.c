@@ -0,0 +1,135 @@
+// Converts a binary CPU trace written with `cnes --trace <file>` into nestest-style text
+// usage: trace2log <trace file> [output file]
+#include "../src/include/nes.h"
+#include "../src/include/cpu.h"
+#include "../src/include/util.h"
+#include "../src/include/trace.h"
+
+static void trace2log_rec(FILE *log_f, trace_rec_t *rec) {
+  const int OPERAND_SIZES[] = {2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 0};
+  u8 opcode = rec->opcode;
+  addrmode_t mode = rec->mode;
+  u8 low = rec->operand[0];
+  u8 high = rec->operand[1];
+  u16 operand = OPERAND_SIZES[mode] == 2 ? low | (high << 8) : low;
+
+  fprintf(log_f, "%04X  ", rec->pc);
+  switch (OPERAND_SIZES[mode]) {
+    case 0:
+      fprintf(log_f, "%02X       ", opcode);
+      break;
+    case 1:
+      fprintf(log_f, "%02X %02X    ", opcode, low);
+      break;
+    case 2:
+      fprintf(log_f, "%02X %02X %02X ", opcode, low, high);
+      break;
+    default:
+      crash_and_burn("trace2log_rec: invalid operand count, wtf?\n");
+  }
+  fprintf(log_f, " %s", cpu_opcode_tos(opcode));
+  switch (mode) {
+    case ABS:
+      // JSR and JMP absolute shouldn't display val @ address
+      if (opcode == 0x20 || opcode == 0x4C)
+        fprintf(log_f, " $%04X                       ", operand);
+      else {
+        // Registers with side effects, like PPU reg and OAM DMA, were not read when tracing
+        if (!(operand >= 0x2000 && operand <= 0x3FFF) && !(operand >= 0x4000 && operand <= 0x4020))
+          fprintf(log_f, " $%04X = %02X                  ", operand, rec->mem_val);
+        else
+          fprintf(log_f, " $%04X                       ", operand);
+      }
+      break;
+    case ABS_IND:
+      fprintf(log_f, " ($%04X) = %04X              ", operand, rec->ind_addr);
+      break;
+    case ABS_IDX_X:
+    case ABS_IDX_Y: {
+      u8 inc = mode == ABS_IDX_X ? rec->x : rec->y;
+      fprintf(log_f, " $%04X,%s @ %04X = %02X         ", operand,
+              mode == ABS_IDX_X ? "X" : "Y", (operand + inc) & 0xFFFF, rec->mem_val);
+      break;
+    }
+    case REL:
+      // Add two because the PC points at the branch opcode
+      fprintf(log_f, " $%04X                       ", rec->pc + (i8) operand + 2);
+      break;
+    case IMM:
+      fprintf(log_f, " #$%02X                        ", operand);
+      break;
+    case ZP:
+      fprintf(log_f, " $%02X = %02X                    ", operand, rec->mem_val);
+      break;
+    case ZP_IDX_X:
+    case ZP_IDX_Y: {
+      u8 inc_val = mode == ZP_IDX_X ? rec->x : rec->y;
+      fprintf(log_f, " $%02X,%s @ %02X = %02X             ", operand,
+              mode == ZP_IDX_X ? "X" : "Y", (operand + inc_val) & 0xFF, rec->mem_val);
+      break;
+    }
+    case ZP_IDX_IND:
+      fprintf(log_f, " ($%02X,X) @ %02X = %04X = %02X    ", operand,
+              (operand + rec->x) & 0xFF, rec->ind_addr, rec->mem_val);
+      break;
+    case ZP_IND_IDX_Y:
+      fprintf(log_f, " ($%02X),Y = %04X @ %04X = %02X  ", operand,
+              rec->ind_addr, (rec->ind_addr + rec->y) & 0xFFFF, rec->mem_val);
+      break;
+    case IMPL_ACCUM:
+      // For some dumb reason, accumulator arithmetic instructions have "A" as
+      // the operand...
+      // OP_LSR OP_ASL OP_ROL OP_ROR
+      if (opcode == 0x4A || opcode == 0x0A || opcode == 0x2A || opcode == 0x6A)
+        fprintf(log_f, " A                           ");
+      else
+        fprintf(log_f, "                             ");
+      break;
+  }
+
+  // Print registers
+  fprintf(log_f,
+          "A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3u,%3u CYC:%lu",
+          rec->a, rec->x, rec->y, rec->p, rec->sp, rec->scanline,
+          rec->dot, (unsigned long) rec->cycle);
+
+  // Mark where interrupts occur
+  if (rec->flags & TRACE_FLAG_OAM_DMA) {
+    fprintf(log_f, " OAM_DMA! ");
+  }
+  if (rec->flags & TRACE_FLAG_NMI) {
+    fprintf(log_f, " NMI!");
+  }
+
+  fprintf(log_f, "\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2 && argc != 3)
+    crash_and_burn("usage: trace2log <trace file> [output file]\n");
+
+  FILE *trace_f = nes_fopen(argv[1], "rb");
+  FILE *log_f = argc == 3 ? nes_fopen(argv[2], "w") : stdout;
+
+  trace_header_t header;
+  nes_fread(&header, sizeof header, 1, trace_f);
+  if (memcmp(header.magic, TRACE_MAGIC, sizeof header.magic) != 0 || header.version != TRACE_VERSION ||
+      header.rec_sz != sizeof(trace_rec_t))
+    crash_and_burn("trace2log: %s is not a CNES CPU trace.\n", argv[1]);
+
+  // Once the ring has wrapped around, the oldest record is the one that would have been overwritten next
+  u64 n_recs = header.count < header.capacity ? header.count : header.capacity;
+  u64 first = header.count < header.capacity ? 0 : header.count % header.capacity;
+
+  trace_rec_t *recs = nes_malloc(n_recs * sizeof *recs);
+  nes_fread(recs, sizeof *recs, n_recs, trace_f);
+  nes_fclose(trace_f);
+
+  for (u64 i = 0; i < n_recs; i++)
+    trace2log_rec(log_f, &recs[(first + i) % header.capacity]);
+
+  free(recs);
+  if (log_f != stdout)
+    nes_fclose(log_f);
+  return 0;
+}